@@ -0,0 +1,332 @@
+#ifndef AGGAVLBST_H
+#define AGGAVLBST_H
+
+#include <iostream>
+#include <exception>
+#include <cstdlib>
+#include <cstddef>
+#include <limits>
+#include "avlbst.h"
+
+/*
+ * Monoids for AggregateAVLTree. A monoid provides the aggregate type, an
+ * identity element, an associative combine (it does not need to be
+ * commutative, items are always combined in key order) and lift, which
+ * turns a single key/value pair into an aggregate.
+ */
+template <typename Value>
+struct SumMonoid
+{
+    typedef Value type;
+    static type identity() { return Value(); }
+    static type combine(const type& a, const type& b) { return a + b; }
+    template<typename Key>
+    static type lift(const Key&, const Value& value) { return value; }
+};
+
+template <typename Value>
+struct MinMonoid
+{
+    typedef Value type;
+    static type identity() { return std::numeric_limits<Value>::max(); }
+    static type combine(const type& a, const type& b) { return b < a ? b : a; }
+    template<typename Key>
+    static type lift(const Key&, const Value& value) { return value; }
+};
+
+template <typename Value>
+struct MaxMonoid
+{
+    typedef Value type;
+    static type identity() { return std::numeric_limits<Value>::lowest(); }
+    static type combine(const type& a, const type& b) { return a < b ? b : a; }
+    template<typename Key>
+    static type lift(const Key&, const Value& value) { return value; }
+};
+
+template <typename Value>
+struct CountMonoid
+{
+    typedef size_t type;
+    static type identity() { return 0; }
+    static type combine(const type& a, const type& b) { return a + b; }
+    template<typename Key>
+    static type lift(const Key&, const Value&) { return 1; }
+};
+
+/**
+* An AVLNode that also stores the aggregate of every value in its subtree.
+*/
+template <typename Key, typename Value, typename Monoid>
+class AggregateAVLNode : public AVLNode<Key, Value>
+{
+public:
+    AggregateAVLNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent);
+    virtual ~AggregateAVLNode();
+
+    const typename Monoid::type& getAggregate() const;
+    void setAggregate(const typename Monoid::type& aggregate);
+
+    virtual AggregateAVLNode<Key, Value, Monoid>* getParent() const override;
+    virtual AggregateAVLNode<Key, Value, Monoid>* getLeft() const override;
+    virtual AggregateAVLNode<Key, Value, Monoid>* getRight() const override;
+    virtual AggregateAVLNode<Key, Value, Monoid>* clone() const override;
+
+protected:
+    typename Monoid::type aggregate_;
+};
+
+/*
+  -----------------------------------------------------
+  Begin implementations for the AggregateAVLNode class.
+  -----------------------------------------------------
+*/
+
+template<class Key, class Value, class Monoid>
+AggregateAVLNode<Key, Value, Monoid>::AggregateAVLNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent) :
+    AVLNode<Key, Value>(key, value, parent), aggregate_(Monoid::lift(key, value))
+{
+
+}
+
+template<class Key, class Value, class Monoid>
+AggregateAVLNode<Key, Value, Monoid>::~AggregateAVLNode()
+{
+
+}
+
+template<class Key, class Value, class Monoid>
+const typename Monoid::type& AggregateAVLNode<Key, Value, Monoid>::getAggregate() const
+{
+    return aggregate_;
+}
+
+template<class Key, class Value, class Monoid>
+void AggregateAVLNode<Key, Value, Monoid>::setAggregate(const typename Monoid::type& aggregate)
+{
+    aggregate_ = aggregate;
+}
+
+template<class Key, class Value, class Monoid>
+AggregateAVLNode<Key, Value, Monoid>* AggregateAVLNode<Key, Value, Monoid>::getParent() const
+{
+    return static_cast<AggregateAVLNode<Key, Value, Monoid>*>(this->parent_);
+}
+
+template<class Key, class Value, class Monoid>
+AggregateAVLNode<Key, Value, Monoid>* AggregateAVLNode<Key, Value, Monoid>::getLeft() const
+{
+    return static_cast<AggregateAVLNode<Key, Value, Monoid>*>(this->left_);
+}
+
+template<class Key, class Value, class Monoid>
+AggregateAVLNode<Key, Value, Monoid>* AggregateAVLNode<Key, Value, Monoid>::getRight() const
+{
+    return static_cast<AggregateAVLNode<Key, Value, Monoid>*>(this->right_);
+}
+
+/**
+* Copies the item, balance and aggregate, but none of the links.
+*/
+template<class Key, class Value, class Monoid>
+AggregateAVLNode<Key, Value, Monoid>* AggregateAVLNode<Key, Value, Monoid>::clone() const
+{
+    AggregateAVLNode<Key, Value, Monoid>* copy =
+        new AggregateAVLNode<Key, Value, Monoid>(this->item_.first, this->item_.second, NULL);
+    copy->setBalance(this->balance_);
+    copy->setAggregate(aggregate_);
+    return copy;
+}
+
+/*
+  ---------------------------------------------------
+  End implementations for the AggregateAVLNode class.
+  ---------------------------------------------------
+*/
+
+/**
+* An AVL tree that keeps the Monoid aggregate of every subtree, so the
+* aggregate over any key range can be answered in O(log n).
+*
+* Values must be changed through insert, update or upsert (not through
+* iterators) so that the stored aggregates stay current. For the same
+* reason operator[] is read-only here.
+*/
+template <class Key, class Value, class Monoid = SumMonoid<Value> >
+class AggregateAVLTree : public AVLTree<Key, Value>
+{
+public:
+    typename Monoid::type aggregate() const;
+    typename Monoid::type aggregate(const Key& lo, const Key& hi) const;
+
+    using AVLTree<Key, Value>::operator[];
+    Value& operator[](const Key& key) = delete;
+
+protected:
+    typedef AggregateAVLNode<Key, Value, Monoid> AggNode;
+
+    virtual AVLNode<Key, Value>* createNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent) const;
+    virtual const std::type_info& nodeType() const;
+    virtual void updatePath(AVLNode<Key, Value>* current);
+    virtual void rotateLeft(AVLNode<Key, Value>* current);
+    virtual void rotateRight(AVLNode<Key, Value>* current);
+    virtual void nodeSwap(AVLNode<Key, Value>* n1, AVLNode<Key, Value>* n2);
+
+    static typename Monoid::type aggregateOf(AggNode* node);
+    static void recompute(AggNode* node);
+    AggNode* getRoot() const;
+};
+
+template<class Key, class Value, class Monoid>
+typename AggregateAVLTree<Key, Value, Monoid>::AggNode* AggregateAVLTree<Key, Value, Monoid>::getRoot() const
+{
+    return static_cast<AggNode*>(this->root_);
+}
+
+/**
+* The aggregate of an empty subtree is the identity.
+*/
+template<class Key, class Value, class Monoid>
+typename Monoid::type AggregateAVLTree<Key, Value, Monoid>::aggregateOf(AggNode* node)
+{
+    return node == nullptr ? Monoid::identity() : node->getAggregate();
+}
+
+/**
+* Rebuilds a node's aggregate from its children, which must be current.
+*/
+template<class Key, class Value, class Monoid>
+void AggregateAVLTree<Key, Value, Monoid>::recompute(AggNode* node)
+{
+    node->setAggregate(Monoid::combine(aggregateOf(node->getLeft()),
+        Monoid::combine(Monoid::lift(node->getKey(), node->getValue()), aggregateOf(node->getRight()))));
+}
+
+template<class Key, class Value, class Monoid>
+AVLNode<Key, Value>* AggregateAVLTree<Key, Value, Monoid>::createNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent) const
+{
+    return new AggNode(key, value, parent);
+}
+
+template<class Key, class Value, class Monoid>
+const std::type_info& AggregateAVLTree<Key, Value, Monoid>::nodeType() const
+{
+    return typeid(AggNode);
+}
+
+template<class Key, class Value, class Monoid>
+void AggregateAVLTree<Key, Value, Monoid>::updatePath(AVLNode<Key, Value>* current)
+{
+    AggNode* node = static_cast<AggNode*>(current);
+    while(node != nullptr)
+    {
+        recompute(node);
+        node = node->getParent();
+    }
+}
+
+/**
+* A rotation keeps the contents of the rotated subtree, so only the two
+* nodes that moved need new aggregates (the lower one first).
+*/
+template<class Key, class Value, class Monoid>
+void AggregateAVLTree<Key, Value, Monoid>::rotateLeft(AVLNode<Key, Value>* current)
+{
+    AVLTree<Key, Value>::rotateLeft(current);
+    recompute(static_cast<AggNode*>(current));
+    recompute(static_cast<AggNode*>(current->getParent()));
+}
+
+template<class Key, class Value, class Monoid>
+void AggregateAVLTree<Key, Value, Monoid>::rotateRight(AVLNode<Key, Value>* current)
+{
+    AVLTree<Key, Value>::rotateRight(current);
+    recompute(static_cast<AggNode*>(current));
+    recompute(static_cast<AggNode*>(current->getParent()));
+}
+
+/**
+* Swapping two nodes changes both subtrees; the deeper one is refreshed
+* first. The remove that follows refreshes the rest of the path.
+*/
+template<class Key, class Value, class Monoid>
+void AggregateAVLTree<Key, Value, Monoid>::nodeSwap(AVLNode<Key, Value>* n1, AVLNode<Key, Value>* n2)
+{
+    AVLTree<Key, Value>::nodeSwap(n1, n2);
+    if(n1->getParent() == n2)
+    {
+        recompute(static_cast<AggNode*>(n1));
+        recompute(static_cast<AggNode*>(n2));
+    }
+    else
+    {
+        recompute(static_cast<AggNode*>(n2));
+        recompute(static_cast<AggNode*>(n1));
+    }
+}
+
+/**
+* Returns the aggregate of every value in the tree.
+*/
+template<class Key, class Value, class Monoid>
+typename Monoid::type AggregateAVLTree<Key, Value, Monoid>::aggregate() const
+{
+    return aggregateOf(getRoot());
+}
+
+/**
+* Returns the aggregate of the values whose keys are in [lo, hi).
+* Walks down to the first node inside the range, then down both
+* boundaries, picking up whole subtrees on the inner side.
+*/
+template<class Key, class Value, class Monoid>
+typename Monoid::type AggregateAVLTree<Key, Value, Monoid>::aggregate(const Key& lo, const Key& hi) const
+{
+    AggNode* split = getRoot();
+    while(split != nullptr && (split->getKey() < lo || !(split->getKey() < hi)))
+    {
+        split = (split->getKey() < lo) ? split->getRight() : split->getLeft();
+    }
+    if(split == nullptr)
+    {
+        return Monoid::identity();
+    }
+
+    // keys >= lo in the left subtree, collected from the right
+    typename Monoid::type leftPart = Monoid::identity();
+    AggNode* current = split->getLeft();
+    while(current != nullptr)
+    {
+        if(current->getKey() < lo)
+        {
+            current = current->getRight();
+        }
+        else
+        {
+            leftPart = Monoid::combine(Monoid::lift(current->getKey(), current->getValue()),
+                Monoid::combine(aggregateOf(current->getRight()), leftPart));
+            current = current->getLeft();
+        }
+    }
+
+    // keys < hi in the right subtree, collected from the left
+    typename Monoid::type rightPart = Monoid::identity();
+    current = split->getRight();
+    while(current != nullptr)
+    {
+        if(current->getKey() < hi)
+        {
+            rightPart = Monoid::combine(rightPart,
+                Monoid::combine(aggregateOf(current->getLeft()), Monoid::lift(current->getKey(), current->getValue())));
+            current = current->getRight();
+        }
+        else
+        {
+            current = current->getLeft();
+        }
+    }
+
+    return Monoid::combine(leftPart, Monoid::combine(Monoid::lift(split->getKey(), split->getValue()), rightPart));
+}
+
+#endif
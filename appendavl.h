@@ -0,0 +1,181 @@
+#ifndef APPENDAVL_H
+#define APPENDAVL_H
+
+#include <iostream>
+#include <exception>
+#include <cstdlib>
+#include <utility>
+#include <stdexcept>
+#include "avlbst.h"
+
+/**
+* An AVLTree for keys that mostly arrive in increasing order, such as
+* timestamps. It remembers its rightmost node, so an insert past the
+* current maximum hangs the new node straight off it instead of
+* descending from the root; the rebalancing after it only touches the
+* right spine, as it would anyway. insert takes this path on its own
+* whenever the key is larger than every key in the tree, and pushBack
+* insists on it.
+*
+* The remembered node is kept up to date by every insert and forgotten
+* when it is unlinked or destroyed, or when nodes are moved wholesale;
+* the next append then finds the maximum again by walking down the right
+* spine. All of these go through the base class hooks, so this holds
+* whichever tree starts the operation and whether it is called through
+* a base class reference.
+*/
+template <class Key, class Value>
+class AppendAVLTree : public AVLTree<Key, Value>
+{
+public:
+    AppendAVLTree();
+    AppendAVLTree(const AppendAVLTree<Key, Value>& other);
+    AppendAVLTree(AppendAVLTree<Key, Value>&& other);
+    AppendAVLTree<Key, Value>& operator=(const AppendAVLTree<Key, Value>& other);
+    AppendAVLTree<Key, Value>& operator=(AppendAVLTree<Key, Value>&& other);
+
+    using AVLTree<Key, Value>::insert;
+    virtual void insert(const std::pair<const Key, Value>& keyValuePair);
+    void pushBack(const std::pair<const Key, Value>& keyValuePair);
+
+protected:
+    virtual void linkNode(AVLNode<Key, Value>* newPair, AVLNode<Key, Value>* parent, bool goesLeft);
+    virtual void unlinkNode(AVLNode<Key, Value>* node);
+    virtual void destroyNode(AVLNode<Key, Value>* node);
+    virtual void nodesMoved();
+
+    AVLNode<Key, Value>* rightmost();
+
+    AVLNode<Key, Value>* rightmost_;
+};
+
+template<class Key, class Value>
+AppendAVLTree<Key, Value>::AppendAVLTree() : rightmost_(nullptr)
+{
+
+}
+
+/*
+ * Copies and moves find their maximum again on the first append; the
+ * moved from tree forgets its own through nodesMoved.
+ */
+template<class Key, class Value>
+AppendAVLTree<Key, Value>::AppendAVLTree(const AppendAVLTree<Key, Value>& other) :
+    AVLTree<Key, Value>(other), rightmost_(nullptr)
+{
+
+}
+
+template<class Key, class Value>
+AppendAVLTree<Key, Value>::AppendAVLTree(AppendAVLTree<Key, Value>&& other) :
+    AVLTree<Key, Value>(std::move(other)), rightmost_(nullptr)
+{
+
+}
+
+template<class Key, class Value>
+AppendAVLTree<Key, Value>& AppendAVLTree<Key, Value>::operator=(const AppendAVLTree<Key, Value>& other)
+{
+    AVLTree<Key, Value>::operator=(other);
+    return *this;
+}
+
+template<class Key, class Value>
+AppendAVLTree<Key, Value>& AppendAVLTree<Key, Value>::operator=(AppendAVLTree<Key, Value>&& other)
+{
+    AVLTree<Key, Value>::operator=(std::move(other));
+    return *this;
+}
+
+/*
+ * One comparison against the maximum decides whether the descent can be
+ * skipped.
+ */
+template<class Key, class Value>
+void AppendAVLTree<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    AVLNode<Key, Value>* last = rightmost();
+    if(last == nullptr || last->getKey() < keyValuePair.first)
+    {
+      linkNode(this->createNode(keyValuePair.first, keyValuePair.second, last), last, false);
+      return;
+    }
+    AVLTree<Key, Value>::insert(keyValuePair);
+}
+
+/**
+* Appends an item whose key is larger than every key in the tree, in
+* O(1) amortized. Throws std::invalid_argument for any other key, so a
+* feed that goes out of order is noticed instead of silently taking the
+* slow path.
+*/
+template<class Key, class Value>
+void AppendAVLTree<Key, Value>::pushBack(const std::pair<const Key, Value>& keyValuePair)
+{
+    AVLNode<Key, Value>* last = rightmost();
+    if(last != nullptr && !(last->getKey() < keyValuePair.first))
+    {
+      throw std::invalid_argument("pushBack key is not larger than the largest key");
+    }
+    linkNode(this->createNode(keyValuePair.first, keyValuePair.second, last), last, false);
+}
+
+/*
+ * A new maximum always lands to the right of the old one. Rotations move
+ * nodes around but never change which one is rightmost.
+ */
+template<class Key, class Value>
+void AppendAVLTree<Key, Value>::linkNode(AVLNode<Key, Value>* newPair, AVLNode<Key, Value>* parent, bool goesLeft)
+{
+    AVLTree<Key, Value>::linkNode(newPair, parent, goesLeft);
+    if(parent == nullptr || (parent == rightmost_ && !goesLeft))
+    {
+      rightmost_ = newPair;
+    }
+}
+
+template<class Key, class Value>
+void AppendAVLTree<Key, Value>::unlinkNode(AVLNode<Key, Value>* node)
+{
+    if(node == rightmost_)
+    {
+      rightmost_ = nullptr;
+    }
+    AVLTree<Key, Value>::unlinkNode(node);
+}
+
+template<class Key, class Value>
+void AppendAVLTree<Key, Value>::destroyNode(AVLNode<Key, Value>* node)
+{
+    if(node == rightmost_)
+    {
+      rightmost_ = nullptr;
+    }
+    AVLTree<Key, Value>::destroyNode(node);
+}
+
+template<class Key, class Value>
+void AppendAVLTree<Key, Value>::nodesMoved()
+{
+    rightmost_ = nullptr;
+}
+
+/*
+ * The remembered maximum, found again down the right spine if it was
+ * forgotten. nullptr only for an empty tree.
+ */
+template<class Key, class Value>
+AVLNode<Key, Value>* AppendAVLTree<Key, Value>::rightmost()
+{
+    if(rightmost_ == nullptr && this->root_ != nullptr)
+    {
+      rightmost_ = static_cast<AVLNode<Key, Value>*>(this->root_);
+      while(rightmost_->getRight() != nullptr)
+      {
+        rightmost_ = rightmost_->getRight();
+      }
+    }
+    return rightmost_;
+}
+
+#endif
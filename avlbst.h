@@ -6,6 +6,10 @@
 #include <cstdlib>
 #include <cstdint>
 #include <algorithm>
+#include <stdexcept>
+#include <vector>
+#include <thread>
+#include <typeinfo>
 #include "bst.h"
 
 struct KeyError { };
@@ -34,6 +38,7 @@ public:
     virtual AVLNode<Key, Value>* getParent() const override;
     virtual AVLNode<Key, Value>* getLeft() const override;
     virtual AVLNode<Key, Value>* getRight() const override;
+    virtual AVLNode<Key, Value>* clone() const override;
 
 protected:
     int8_t balance_;    // effectively a signed char
@@ -120,6 +125,16 @@ AVLNode<Key, Value> *AVLNode<Key, Value>::getRight() const
     return static_cast<AVLNode<Key, Value>*>(this->right_);
 }
 
+/**
+* Copies the item and the balance, but none of the links.
+*/
+template<class Key, class Value>
+AVLNode<Key, Value> *AVLNode<Key, Value>::clone() const
+{
+    AVLNode<Key, Value>* copy = new AVLNode<Key, Value>(this->item_.first, this->item_.second, NULL);
+    copy->setBalance(balance_);
+    return copy;
+}
 
 /*
   -----------------------------------------------
@@ -132,16 +147,94 @@ template <class Key, class Value>
 class AVLTree : public BinarySearchTree<Key, Value>
 {
 public:
+    /**
+    * Owns a node that has been extracted from a tree. The node can be
+    * relinked into any AVLTree of the same type without reallocating it.
+    */
+    class node_type
+    {
+    public:
+        node_type();
+        node_type(node_type&& other);
+        node_type& operator=(node_type&& other);
+        ~node_type();
+
+        bool empty() const;
+        const Key& key() const;
+        Value& mapped() const;
+
+    protected:
+        friend class AVLTree<Key, Value>;
+        node_type(AVLNode<Key, Value>* node);
+        node_type(const node_type&);
+        node_type& operator=(const node_type&);
+        AVLNode<Key, Value>* node_;
+    };
+
+    /**
+    * One entry of a batch for applySorted: either an insert of key and
+    * value, or a remove of key.
+    */
+    struct mutation
+    {
+        mutation(const Key& key, const Value& value) : key(key), value(value), erase(false) { }
+        explicit mutation(const Key& key) : key(key), value(), erase(true) { }
+        Key key;
+        Value value;
+        bool erase;
+    };
+
     virtual void insert (const std::pair<const Key, Value> &new_item); // TODO
     virtual void remove(const Key& key);  // TODO
+    template<typename Iterator>
+    void applySorted(Iterator first, Iterator last, unsigned int threads = 1);
+    bool insert(node_type&& handle);
+    node_type extract(const Key& key);
+    node_type extract(typename BinarySearchTree<Key, Value>::iterator pos);
+    void merge(AVLTree<Key, Value>& other);
+    void split(const Key& key, AVLTree<Key, Value>& greater);
+    void join(AVLTree<Key, Value>& greater);
+    using BinarySearchTree<Key, Value>::erase;
+    virtual typename BinarySearchTree<Key, Value>::iterator erase(
+        typename BinarySearchTree<Key, Value>::iterator first,
+        typename BinarySearchTree<Key, Value>::iterator last);
 protected:
     virtual void nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2);
 
     // Add helper functions here
+    AVLNode<Key, Value>* insertPosition(const Key& key, AVLNode<Key, Value>*& parent, bool& goesLeft) const;
+    virtual void linkNode(AVLNode<Key, Value>* newPair, AVLNode<Key, Value>* parent, bool goesLeft);
+    virtual void unlinkNode(AVLNode<Key, Value>* current);
+    virtual void removeNode(Node<Key, Value>* target);
+    virtual Node<Key, Value>* findOrCreate(const Key& key, const Value& init, bool& created);
+    virtual void valueChanged(Node<Key, Value>* node);
+
+    // Split/join on detached subtrees. These use root_ as scratch space,
+    // so the caller must set root_ once it has the final tree.
+    static int subtreeHeight(AVLNode<Key, Value>* node);
+    bool joinFix(AVLNode<Key, Value>* current);
+    AVLNode<Key, Value>* join(AVLNode<Key, Value>* left, int leftHeight, AVLNode<Key, Value>* mid,
+                              AVLNode<Key, Value>* right, int rightHeight, int& height);
+    AVLNode<Key, Value>* join(AVLNode<Key, Value>* left, int leftHeight,
+                              AVLNode<Key, Value>* right, int rightHeight, int& height);
+    void split(AVLNode<Key, Value>* node, int height, const Key& key,
+               AVLNode<Key, Value>*& left, int& leftHeight,
+               AVLNode<Key, Value>*& right, int& rightHeight);
+    AVLNode<Key, Value>* applyBatch(AVLNode<Key, Value>* node, int nodeHeight, const std::vector<const mutation*>& batch,
+                                    size_t lo, size_t hi, unsigned int threads, int& height);
+    AVLNode<Key, Value>* buildBatch(const std::vector<const mutation*>& inserts, size_t lo, size_t hi);
     void insertFix(AVLNode<Key, Value>* parent, AVLNode<Key, Value>* current);
-    void removeFix(AVLNode<Key, Value>* current, int diff);
-    void rotateLeft(AVLNode<Key, Value>* current);
-    void rotateRight(AVLNode<Key, Value>* current);
+    virtual void removeFix(AVLNode<Key, Value>* current, int diff);
+    virtual void rotateLeft(AVLNode<Key, Value>* current);
+    virtual void rotateRight(AVLNode<Key, Value>* current);
+    virtual AVLNode<Key, Value>* createNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent) const;
+    virtual const std::type_info& nodeType() const;
+    virtual bool parallelBuildSafe() const;
+    virtual void destroyNode(AVLNode<Key, Value>* node);
+    virtual Node<Key, Value>* buildNode(const Key& key, const Value& value,
+        Node<Key, Value>* left, uint64_t leftSize, Node<Key, Value>* right, uint64_t rightSize);
+    void destroySubtree(AVLNode<Key, Value>* node);
+    virtual void updatePath(AVLNode<Key, Value>* current);
     AVLNode<Key, Value>* internalFind(const Key& k) const; 
     static AVLNode<Key, Value>* predecessor(AVLNode<Key, Value>* current); 
     static AVLNode<Key, Value>* successor(AVLNode<Key, Value>* current);
@@ -155,62 +248,135 @@ protected:
 template<class Key, class Value>
 void AVLTree<Key, Value>::insert (const std::pair<const Key, Value> &new_item)
 {
-    // TODO
     bool goesLeft=0;
-
-    AVLNode<Key, Value> *AVLRoot = static_cast<AVLNode<Key, Value>*>(this->root_);
-
-    if(AVLRoot == nullptr)
+    AVLNode<Key, Value>* parent=nullptr;
+    AVLNode<Key, Value>* current=insertPosition(new_item.first, parent, goesLeft);
+    if(current != nullptr)
     {
-      AVLNode<Key, Value>* newPair= new AVLNode<Key,Value>(new_item.first, new_item.second, nullptr);
-      newPair->setRight(nullptr);
-      newPair->setLeft(nullptr);
-      newPair->setBalance(0); 
-
-      this->root_ = newPair;
+      current->setValue(new_item.second);
+      updatePath(current);
       return;
     }
-    AVLNode<Key, Value>* current=AVLRoot;
+    linkNode(createNode(new_item.first, new_item.second, parent), parent, goesLeft);
+}
+
+/*
+ * Relinks an extracted node into this tree. If the key is already present
+ * nothing happens, the handle keeps its node and false is returned.
+ * A node made by a tree with another node type is not linked as it is:
+ * its item is copied into a node of this tree and the handle's node is
+ * freed.
+ */
+template<class Key, class Value>
+bool AVLTree<Key, Value>::insert (node_type&& handle)
+{
+    if(handle.empty())
+    {
+      return false;
+    }
+    bool goesLeft=0;
+    AVLNode<Key, Value>* parent=nullptr;
+    if(insertPosition(handle.key(), parent, goesLeft) != nullptr)
+    {
+      return false;
+    }
+    if(typeid(*handle.node_) != nodeType())
+    {
+      node_type copied(std::move(handle));
+      bool created=false;
+      findOrCreate(copied.key(), copied.mapped(), created);
+      return true;
+    }
+    AVLNode<Key, Value>* newPair=handle.node_;
+    handle.node_=nullptr;
+    linkNode(newPair, parent, goesLeft);
+    return true;
+}
+
+/*
+ * One descent with insertPosition; only a newly linked node triggers
+ * any rebalancing.
+ */
+template<class Key, class Value>
+Node<Key, Value>* AVLTree<Key, Value>::findOrCreate(const Key& key, const Value& init, bool& created)
+{
+    bool goesLeft=0;
     AVLNode<Key, Value>* parent=nullptr;
+    AVLNode<Key, Value>* current=insertPosition(key, parent, goesLeft);
+    created=(current == nullptr);
+    if(created)
+    {
+      current=createNode(key, init, parent);
+      linkNode(current, parent, goesLeft);
+    }
+    return current;
+}
+
+template<class Key, class Value>
+void AVLTree<Key, Value>::valueChanged(Node<Key, Value>* node)
+{
+    updatePath(static_cast<AVLNode<Key, Value>*>(node));
+}
 
+/*
+ * Descends to where key belongs. Returns the node holding key if it
+ * exists, otherwise NULL with parent/goesLeft describing the empty slot.
+ */
+template<class Key, class Value>
+AVLNode<Key, Value>* AVLTree<Key, Value>::insertPosition(const Key& key, AVLNode<Key, Value>*& parent, bool& goesLeft) const
+{
+    AVLNode<Key, Value>* current=static_cast<AVLNode<Key, Value>*>(this->root_);
+    parent=nullptr;
+    goesLeft=0;
     while (current)
     {
-      parent=current;
-      if(new_item.first < current->getKey())
+      if(key < current->getKey())
       {
+        parent=current;
         current=current->getLeft();
         goesLeft=1;
       }
-      else if(new_item.first > current->getKey())
+      else if(current->getKey() < key)
       {
+        parent=current;
         current=current->getRight();
         goesLeft=0;
       }
-      else if (new_item.first == current->getKey())
+      else
       {
-        current->setValue(new_item.second);
-        return;
+        return current;
       }
     }
-    
+    return nullptr;
+}
+
+/*
+ * Hangs a detached node off the empty slot found by insertPosition
+ * and restores the balance of the tree.
+ */
+template<class Key, class Value>
+void AVLTree<Key, Value>::linkNode(AVLNode<Key, Value>* newPair, AVLNode<Key, Value>* parent, bool goesLeft)
+{
+    newPair->setParent(parent);
+    newPair->setRight(nullptr);
+    newPair->setLeft(nullptr);
+    newPair->setBalance(0);
+
+    if(parent == nullptr)
+    {
+      this->root_ = newPair;
+      updatePath(newPair);
+      return;
+    }
     if(goesLeft)
     {
-      AVLNode<Key, Value>* newPair= new AVLNode<Key,Value>(new_item.first, new_item.second, parent);
-      newPair->setRight(nullptr);
-      newPair->setLeft(nullptr);
-      newPair->setBalance(0);
       parent->setLeft(newPair);
-      current=newPair;
     }
-    else if(!goesLeft)
+    else
     {
-      AVLNode<Key, Value>* newPair= new AVLNode<Key,Value>(new_item.first, new_item.second, parent);
-      newPair->setRight(nullptr);
-      newPair->setLeft(nullptr);
-      newPair->setBalance(0);
       parent->setRight(newPair);
-      current=newPair;
     }
+    updatePath(newPair);
 
     if(parent->getBalance() == -1 || parent->getBalance() == 1)
     {
@@ -227,11 +393,651 @@ void AVLTree<Key, Value>::insert (const std::pair<const Key, Value> &new_item)
         parent->updateBalance(1);
       }
       
-      insertFix(parent, current);
+      insertFix(parent, newPair);
       
     }
 }
 
+/*
+--------------------------------------------------------
+Begin implementations for the AVLTree::node_type class.
+--------------------------------------------------------
+*/
+
+/**
+* A default constructor for an empty handle.
+*/
+template<class Key, class Value>
+AVLTree<Key, Value>::node_type::node_type() : node_(nullptr)
+{
+
+}
+
+/**
+* Takes ownership of an already detached node.
+*/
+template<class Key, class Value>
+AVLTree<Key, Value>::node_type::node_type(AVLNode<Key, Value>* node) : node_(node)
+{
+
+}
+
+template<class Key, class Value>
+AVLTree<Key, Value>::node_type::node_type(node_type&& other) : node_(other.node_)
+{
+    other.node_ = nullptr;
+}
+
+template<class Key, class Value>
+typename AVLTree<Key, Value>::node_type&
+AVLTree<Key, Value>::node_type::operator=(node_type&& other)
+{
+    if(this != &other)
+    {
+        delete node_;
+        node_ = other.node_;
+        other.node_ = nullptr;
+    }
+    return *this;
+}
+
+/**
+* Frees the node if it was never relinked into a tree.
+*/
+template<class Key, class Value>
+AVLTree<Key, Value>::node_type::~node_type()
+{
+    delete node_;
+}
+
+template<class Key, class Value>
+bool AVLTree<Key, Value>::node_type::empty() const
+{
+    return node_ == nullptr;
+}
+
+template<class Key, class Value>
+const Key& AVLTree<Key, Value>::node_type::key() const
+{
+    return node_->getKey();
+}
+
+template<class Key, class Value>
+Value& AVLTree<Key, Value>::node_type::mapped() const
+{
+    return node_->getValue();
+}
+
+/*
+------------------------------------------------------
+End implementations for the AVLTree::node_type class.
+------------------------------------------------------
+*/
+
+/*
+ * Unlinks the node holding key and hands it back without freeing it.
+ * Returns an empty handle if the key is not in the tree.
+ */
+template<class Key, class Value>
+typename AVLTree<Key, Value>::node_type AVLTree<Key, Value>::extract(const Key& key)
+{
+    AVLNode<Key, Value>* current=internalFind(key);
+    if(current != nullptr)
+    {
+      unlinkNode(current);
+    }
+    return node_type(current);
+}
+
+template<class Key, class Value>
+typename AVLTree<Key, Value>::node_type
+AVLTree<Key, Value>::extract(typename BinarySearchTree<Key, Value>::iterator pos)
+{
+    AVLNode<Key, Value>* current=static_cast<AVLNode<Key, Value>*>(this->iteratorNode(pos));
+    if(current != nullptr)
+    {
+      unlinkNode(current);
+    }
+    return node_type(current);
+}
+
+/*
+ * Moves every node of other whose key is not in this tree over
+ * without reallocating. Nodes with duplicate keys stay in other. If
+ * other uses another node type, the items are copied into new nodes of
+ * this tree instead and other frees its own.
+ */
+template<class Key, class Value>
+void AVLTree<Key, Value>::merge(AVLTree<Key, Value>& other)
+{
+    if(&other == this || other.root_ == nullptr)
+    {
+      return;
+    }
+    const bool sameType=(other.nodeType() == nodeType());
+    AVLNode<Key, Value>* current=static_cast<AVLNode<Key, Value>*>(other.getSmallestNode());
+    while(current != nullptr)
+    {
+      // nodeSwap moves nodes rather than items, so next stays valid across the unlink
+      AVLNode<Key, Value>* next=successor(current);
+      bool goesLeft=0;
+      AVLNode<Key, Value>* parent=nullptr;
+      if(insertPosition(current->getKey(), parent, goesLeft) == nullptr)
+      {
+        other.unlinkNode(current);
+        if(sameType)
+        {
+          linkNode(current, parent, goesLeft);
+        }
+        else
+        {
+          bool created=false;
+          findOrCreate(current->getKey(), current->getValue(), created);
+          other.destroyNode(current);
+        }
+      }
+      current=next;
+    }
+}
+
+template<class Key, class Value>
+void AVLTree<Key, Value>::removeNode(Node<Key, Value>* target)
+{
+    unlinkNode(static_cast<AVLNode<Key, Value>*>(target));
+    destroyNode(static_cast<AVLNode<Key, Value>*>(target));
+}
+
+/*
+ * Removes [first, last) by splitting the tree around the range, freeing
+ * the middle part and joining what is left. This is O(log n + k) and
+ * rebalances once instead of after every removed node.
+ */
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator
+AVLTree<Key, Value>::erase(typename BinarySearchTree<Key, Value>::iterator first,
+                           typename BinarySearchTree<Key, Value>::iterator last)
+{
+    if(first == last)
+    {
+      return last;
+    }
+    Node<Key, Value>* lastNode=this->iteratorNode(last);
+    AVLNode<Key, Value>* AVLRoot=static_cast<AVLNode<Key, Value>*>(this->root_);
+    AVLNode<Key, Value>* left=nullptr;
+    AVLNode<Key, Value>* rest=nullptr;
+    AVLNode<Key, Value>* mid=nullptr;
+    AVLNode<Key, Value>* right=nullptr;
+    int leftHeight=0, restHeight=0, midHeight=0, rightHeight=0, height=0;
+
+    split(AVLRoot, subtreeHeight(AVLRoot), first->first, left, leftHeight, rest, restHeight);
+    if(lastNode != nullptr)
+    {
+      split(rest, restHeight, lastNode->getKey(), mid, midHeight, right, rightHeight);
+    }
+    else
+    {
+      mid=rest;
+    }
+    destroySubtree(mid);
+    this->root_=join(left, leftHeight, right, rightHeight, height);
+    return last;
+}
+
+/*
+ * Moves every item with a key >= key into greater, which must be empty
+ * and use the same node type as this tree. Costs O(log n) and allocates
+ * nothing.
+ */
+template<class Key, class Value>
+void AVLTree<Key, Value>::split(const Key& key, AVLTree<Key, Value>& greater)
+{
+    if(&greater == this)
+    {
+      return;
+    }
+    if(!greater.empty())
+    {
+      throw std::invalid_argument("split target is not empty");
+    }
+    if(greater.nodeType() != nodeType())
+    {
+      throw std::invalid_argument("split target uses another node type");
+    }
+    AVLNode<Key, Value>* AVLRoot=static_cast<AVLNode<Key, Value>*>(this->root_);
+    AVLNode<Key, Value>* left=nullptr;
+    AVLNode<Key, Value>* right=nullptr;
+    int leftHeight=0, rightHeight=0;
+    split(AVLRoot, subtreeHeight(AVLRoot), key, left, leftHeight, right, rightHeight);
+    this->root_=left;
+    greater.root_=right;
+    this->nodesMoved();
+    greater.nodesMoved();
+}
+
+/*
+ * Appends every item of greater, whose keys must all be larger than
+ * the keys in this tree and whose node type must match this tree's,
+ * leaving greater empty. Costs O(log n).
+ */
+template<class Key, class Value>
+void AVLTree<Key, Value>::join(AVLTree<Key, Value>& greater)
+{
+    if(&greater == this || greater.empty())
+    {
+      return;
+    }
+    if(greater.nodeType() != nodeType())
+    {
+      throw std::invalid_argument("joined tree uses another node type");
+    }
+    AVLNode<Key, Value>* left=static_cast<AVLNode<Key, Value>*>(this->root_);
+    AVLNode<Key, Value>* right=static_cast<AVLNode<Key, Value>*>(greater.root_);
+    if(left != nullptr)
+    {
+      AVLNode<Key, Value>* largest=left;
+      while(largest->getRight() != nullptr)
+      {
+        largest=largest->getRight();
+      }
+      if(!(largest->getKey() < greater.getSmallestNode()->getKey()))
+      {
+        throw std::invalid_argument("joined tree has keys that are not larger");
+      }
+    }
+    greater.root_=nullptr;
+    int height=0;
+    this->root_=join(left, subtreeHeight(left), right, subtreeHeight(right), height);
+    this->nodesMoved();
+    greater.nodesMoved();
+}
+
+/*
+ * Applies a batch of mutations sorted by key (the last one wins when a
+ * key repeats) in one pass. The batch is cut at the root key: both halves
+ * are applied to the two subtrees, which are then joined back around the
+ * root, so every subtree is rebalanced once instead of after every item
+ * and subtrees the batch does not touch are not visited at all. The
+ * halves are independent, so large ones run on separate threads, up to
+ * threads at once, unless parallelBuildSafe says the tree's hooks cannot
+ * be left out.
+ */
+template<class Key, class Value>
+template<typename Iterator>
+void AVLTree<Key, Value>::applySorted(Iterator first, Iterator last, unsigned int threads)
+{
+    std::vector<const mutation*> batch;
+    for(; first != last; ++first)
+    {
+      const mutation* current=&*first;
+      if(!batch.empty() && current->key < batch.back()->key)
+      {
+        throw std::invalid_argument("applySorted batch is not sorted");
+      }
+      if(!batch.empty() && !(batch.back()->key < current->key))
+      {
+        batch.back()=current;
+      }
+      else
+      {
+        batch.push_back(current);
+      }
+    }
+    if(!parallelBuildSafe())
+    {
+      threads=1;
+    }
+    int height=0;
+    AVLNode<Key, Value>* AVLRoot=static_cast<AVLNode<Key, Value>*>(this->root_);
+    this->root_=applyBatch(AVLRoot, subtreeHeight(AVLRoot), batch, 0, batch.size(), threads, height);
+    // the new nodes were linked without linkNode
+    this->nodesMoved();
+}
+
+/*
+ * Applies batch[lo, hi) to the detached subtree node of height nodeHeight
+ * and returns the new subtree. Uses root_ as scratch space like join, which is why a helper
+ * thread works in its own empty AVLTree.
+ */
+template<class Key, class Value>
+AVLNode<Key, Value>* AVLTree<Key, Value>::applyBatch(AVLNode<Key, Value>* node, int nodeHeight, const std::vector<const mutation*>& batch,
+                                                     size_t lo, size_t hi, unsigned int threads, int& height)
+{
+    if(lo == hi)
+    {
+      height=nodeHeight;
+      return node;
+    }
+    if(node == nullptr)
+    {
+      size_t erased=0;
+      for(size_t i=lo; i < hi; i++)
+      {
+        if(batch[i]->erase) erased++;
+      }
+      AVLNode<Key, Value>* built=nullptr;
+      if(erased == 0)
+      {
+        built=buildBatch(batch, lo, hi);
+      }
+      else
+      {
+        std::vector<const mutation*> inserts;
+        for(size_t i=lo; i < hi; i++)
+        {
+          if(!batch[i]->erase) inserts.push_back(batch[i]);
+        }
+        built=buildBatch(inserts, 0, inserts.size());
+      }
+      height=subtreeHeight(built);
+      return built;
+    }
+
+    size_t mid=lo, rest=hi;
+    {
+      size_t low=lo, high=hi;
+      while(low < high)
+      {
+        size_t probe=low + (high - low) / 2;
+        if(batch[probe]->key < node->getKey()) low=probe + 1;
+        else high=probe;
+      }
+      mid=low;
+      rest=(mid < hi && !(node->getKey() < batch[mid]->key)) ? mid + 1 : mid;
+    }
+
+    AVLNode<Key, Value>* left=node->getLeft();
+    AVLNode<Key, Value>* right=node->getRight();
+    int leftHeight=nodeHeight - (node->getBalance() > 0 ? 2 : 1);
+    int rightHeight=nodeHeight - (node->getBalance() < 0 ? 2 : 1);
+    if(left != nullptr) left->setParent(nullptr);
+    if(right != nullptr) right->setParent(nullptr);
+    node->setLeft(nullptr);
+    node->setRight(nullptr);
+    node->setParent(nullptr);
+
+    const size_t grain=4096;
+    if(threads > 1 && mid - lo >= grain && hi - rest >= grain)
+    {
+      std::thread helper([&]() {
+        AVLTree<Key, Value> scratch;
+        left=scratch.applyBatch(left, leftHeight, batch, lo, mid, threads / 2, leftHeight);
+        scratch.root_=nullptr;
+      });
+      right=applyBatch(right, rightHeight, batch, rest, hi, threads - threads / 2, rightHeight);
+      helper.join();
+    }
+    else
+    {
+      left=applyBatch(left, leftHeight, batch, lo, mid, 1, leftHeight);
+      right=applyBatch(right, rightHeight, batch, rest, hi, 1, rightHeight);
+    }
+
+    if(rest != mid && batch[mid]->erase)
+    {
+      destroyNode(node);
+      return join(left, leftHeight, right, rightHeight, height);
+    }
+    if(rest != mid)
+    {
+      node->setValue(batch[mid]->value);
+    }
+    return join(left, leftHeight, node, right, rightHeight, height);
+}
+
+/*
+ * Builds a balanced subtree from inserts[lo, hi) with buildNode.
+ */
+template<class Key, class Value>
+AVLNode<Key, Value>* AVLTree<Key, Value>::buildBatch(const std::vector<const mutation*>& inserts, size_t lo, size_t hi)
+{
+    if(lo == hi)
+    {
+      return nullptr;
+    }
+    size_t mid=lo + (hi - lo - 1) / 2;
+    AVLNode<Key, Value>* left=buildBatch(inserts, lo, mid);
+    AVLNode<Key, Value>* right=buildBatch(inserts, mid + 1, hi);
+    return static_cast<AVLNode<Key, Value>*>(
+        buildNode(inserts[mid]->key, inserts[mid]->value, left, mid - lo, right, hi - mid - 1));
+}
+
+/*
+ * Height of a subtree, found by following the taller child down.
+ */
+template<class Key, class Value>
+int AVLTree<Key, Value>::subtreeHeight(AVLNode<Key, Value>* node)
+{
+    int height=0;
+    while(node != nullptr)
+    {
+      height++;
+      node=(node->getBalance() < 0) ? node->getLeft() : node->getRight();
+    }
+    return height;
+}
+
+/*
+ * Like insertFix, but for a subtree that grew by one level while its root
+ * may have balance 0, which happens when join hangs a tree off a spine.
+ * Returns true if the height of the whole tree grew.
+ */
+template<class Key, class Value>
+bool AVLTree<Key, Value>::joinFix(AVLNode<Key, Value>* current)
+{
+    AVLNode<Key, Value>* parent=current->getParent();
+    while(parent != nullptr)
+    {
+      if(parent->getLeft() == current)
+      {
+        parent->updateBalance(-1);
+        if(parent->getBalance() == 0)
+        {
+          return false;
+        }
+        else if(parent->getBalance() == -2)
+        {
+          if(current->getBalance() == 1)
+          {
+            AVLNode<Key, Value>* grandChild=current->getRight();
+            rotateLeft(current);
+            rotateRight(parent);
+            current->setBalance(grandChild->getBalance() == 1 ? -1 : 0);
+            parent->setBalance(grandChild->getBalance() == -1 ? 1 : 0);
+            grandChild->setBalance(0);
+            return false;
+          }
+          rotateRight(parent);
+          if(current->getBalance() == -1)
+          {
+            current->setBalance(0);
+            parent->setBalance(0);
+            return false;
+          }
+          current->setBalance(1);
+          parent->setBalance(-1);
+        }
+        else
+        {
+          current=parent;
+        }
+      }
+      else
+      {
+        parent->updateBalance(1);
+        if(parent->getBalance() == 0)
+        {
+          return false;
+        }
+        else if(parent->getBalance() == 2)
+        {
+          if(current->getBalance() == -1)
+          {
+            AVLNode<Key, Value>* grandChild=current->getLeft();
+            rotateRight(current);
+            rotateLeft(parent);
+            current->setBalance(grandChild->getBalance() == -1 ? 1 : 0);
+            parent->setBalance(grandChild->getBalance() == 1 ? -1 : 0);
+            grandChild->setBalance(0);
+            return false;
+          }
+          rotateLeft(parent);
+          if(current->getBalance() == 1)
+          {
+            current->setBalance(0);
+            parent->setBalance(0);
+            return false;
+          }
+          current->setBalance(-1);
+          parent->setBalance(1);
+        }
+        else
+        {
+          current=parent;
+        }
+      }
+      parent=current->getParent();
+    }
+    return true;
+}
+
+/*
+ * Joins left, mid and right into one tree, where every key in left is
+ * smaller than mid's and every key in right is larger. Costs
+ * O(|leftHeight - rightHeight| + 1).
+ */
+template<class Key, class Value>
+AVLNode<Key, Value>* AVLTree<Key, Value>::join(AVLNode<Key, Value>* left, int leftHeight, AVLNode<Key, Value>* mid,
+                                               AVLNode<Key, Value>* right, int rightHeight, int& height)
+{
+    mid->setParent(nullptr);
+    if(std::abs(leftHeight - rightHeight) <= 1)
+    {
+      mid->setLeft(left);
+      mid->setRight(right);
+      if(left != nullptr) left->setParent(mid);
+      if(right != nullptr) right->setParent(mid);
+      mid->setBalance(rightHeight - leftHeight);
+      height=std::max(leftHeight, rightHeight) + 1;
+      updatePath(mid);
+      return mid;
+    }
+
+    if(leftHeight > rightHeight)
+    {
+      // walk down the right spine of left to a subtree as short as right
+      AVLNode<Key, Value>* parent=nullptr;
+      AVLNode<Key, Value>* current=left;
+      int currHeight=leftHeight;
+      while(currHeight > rightHeight + 1)
+      {
+        currHeight-=(current->getBalance() < 0) ? 2 : 1;
+        parent=current;
+        current=current->getRight();
+      }
+      mid->setLeft(current);
+      mid->setRight(right);
+      if(current != nullptr) current->setParent(mid);
+      if(right != nullptr) right->setParent(mid);
+      mid->setBalance(rightHeight - currHeight);
+      parent->setRight(mid);
+      mid->setParent(parent);
+      updatePath(mid);
+      this->root_=left;
+      height=leftHeight + (joinFix(mid) ? 1 : 0);
+    }
+    else
+    {
+      AVLNode<Key, Value>* parent=nullptr;
+      AVLNode<Key, Value>* current=right;
+      int currHeight=rightHeight;
+      while(currHeight > leftHeight + 1)
+      {
+        currHeight-=(current->getBalance() > 0) ? 2 : 1;
+        parent=current;
+        current=current->getLeft();
+      }
+      mid->setLeft(left);
+      mid->setRight(current);
+      if(left != nullptr) left->setParent(mid);
+      if(current != nullptr) current->setParent(mid);
+      mid->setBalance(currHeight - leftHeight);
+      parent->setLeft(mid);
+      mid->setParent(parent);
+      updatePath(mid);
+      this->root_=right;
+      height=rightHeight + (joinFix(mid) ? 1 : 0);
+    }
+    return static_cast<AVLNode<Key, Value>*>(this->root_);
+}
+
+/*
+ * Joins two trees without a middle node by borrowing the smallest node of right.
+ */
+template<class Key, class Value>
+AVLNode<Key, Value>* AVLTree<Key, Value>::join(AVLNode<Key, Value>* left, int leftHeight,
+                                               AVLNode<Key, Value>* right, int rightHeight, int& height)
+{
+    if(right == nullptr)
+    {
+      height=leftHeight;
+      return left;
+    }
+    if(left == nullptr)
+    {
+      height=rightHeight;
+      return right;
+    }
+    AVLNode<Key, Value>* mid=right;
+    while(mid->getLeft() != nullptr)
+    {
+      mid=mid->getLeft();
+    }
+    this->root_=right;
+    unlinkNode(mid);
+    right=static_cast<AVLNode<Key, Value>*>(this->root_);
+    return join(left, leftHeight, mid, right, subtreeHeight(right), height);
+}
+
+/*
+ * Splits a detached subtree into the keys smaller than key (left)
+ * and the rest (right). Costs O(height).
+ */
+template<class Key, class Value>
+void AVLTree<Key, Value>::split(AVLNode<Key, Value>* node, int height, const Key& key,
+                                AVLNode<Key, Value>*& left, int& leftHeight,
+                                AVLNode<Key, Value>*& right, int& rightHeight)
+{
+    if(node == nullptr)
+    {
+      left=nullptr;
+      right=nullptr;
+      leftHeight=0;
+      rightHeight=0;
+      return;
+    }
+    AVLNode<Key, Value>* currLeft=node->getLeft();
+    AVLNode<Key, Value>* currRight=node->getRight();
+    int currLeftHeight=height - ((node->getBalance() > 0) ? 2 : 1);
+    int currRightHeight=height - ((node->getBalance() < 0) ? 2 : 1);
+    if(currLeft != nullptr) currLeft->setParent(nullptr);
+    if(currRight != nullptr) currRight->setParent(nullptr);
+
+    if(node->getKey() < key)
+    {
+      AVLNode<Key, Value>* splitLeft=nullptr;
+      int splitLeftHeight=0;
+      split(currRight, currRightHeight, key, splitLeft, splitLeftHeight, right, rightHeight);
+      left=join(currLeft, currLeftHeight, node, splitLeft, splitLeftHeight, leftHeight);
+    }
+    else
+    {
+      AVLNode<Key, Value>* splitRight=nullptr;
+      int splitRightHeight=0;
+      split(currLeft, currLeftHeight, key, left, leftHeight, splitRight, splitRightHeight);
+      right=join(splitRight, splitRightHeight, node, currRight, currRightHeight, rightHeight);
+    }
+}
+
 template<class Key, class Value>
 void AVLTree<Key, Value>::insertFix(AVLNode<Key, Value>* parent, AVLNode<Key, Value>* current)
 {
@@ -342,16 +1148,28 @@ void AVLTree<Key, Value>::insertFix(AVLNode<Key, Value>* parent, AVLNode<Key, Va
 template<class Key, class Value>
 void AVLTree<Key, Value>:: remove(const Key& key)
 {
-    // TODO
     AVLNode<Key, Value>* current=internalFind(key);
     if(current==nullptr) return;
+    unlinkNode(current);
+    destroyNode(current);
+}
+
+/*
+ * Detaches current from the tree without freeing it and rebalances.
+ * current is left with no parent or children. remove, extract and merge
+ * all take single nodes out through here, so trees that remember nodes
+ * override it to forget them.
+ */
+template<class Key, class Value>
+void AVLTree<Key, Value>::unlinkNode(AVLNode<Key, Value>* current)
+{
     AVLNode<Key, Value>* currParent=current->getParent();
     AVLNode<Key, Value>* currLeft=current->getLeft();
     AVLNode<Key, Value>* currRight=current->getRight();
     AVLNode<Key, Value>* currPred=predecessor(current);
     AVLNode<Key, Value> *AVLRoot = static_cast<AVLNode<Key, Value>*>(this->root_);
 
-    int diff;
+    int diff = 0;
 
     if(current==AVLRoot) //is root, no parent
     {
@@ -535,7 +1353,7 @@ void AVLTree<Key, Value>:: remove(const Key& key)
       current->setLeft(nullptr);
       current->setRight(nullptr);
     }  
-    delete current; 
+    updatePath(currParent);
     removeFix(currParent, diff);
     
 }
@@ -675,67 +1493,105 @@ void AVLTree<Key, Value>::removeFix(AVLNode<Key, Value>* current, int diff)
 template<class Key, class Value>
 void AVLTree<Key, Value>::rotateLeft(AVLNode<Key, Value>* parent)
 {
-  AVLNode<Key, Value>* current=parent->getRight();
-  AVLNode<Key, Value>* grandParent=parent->getParent();
-  if(grandParent == nullptr)
-  {
-    this->root_=current;
-  }
-  else
-  {
-    if(grandParent->getLeft() != nullptr && grandParent->getLeft()==parent )
-    {
-      grandParent->setLeft(current);
-    }
-    else if(grandParent->getRight() != nullptr && grandParent->getRight()==parent )
-    {
-      grandParent->setRight(current);
-    }
-  }
-  parent->setRight(current->getLeft());
-  if(current->getLeft() != nullptr)
-  {
-    current->getLeft()->setParent(parent);
-  }
-  parent->setParent(current);
-
-  current->setParent(grandParent);
-  current->setLeft(parent);
+  BinarySearchTree<Key, Value>::rotateLeft(parent);
 }
 
 template<class Key, class Value>
 void AVLTree<Key, Value>::rotateRight(AVLNode<Key, Value>* parent)
 {
-  AVLNode<Key, Value>* current=parent->getLeft();
-  AVLNode<Key, Value>* grandParent=parent->getParent();
-  if(grandParent == nullptr)
-  {
-    this->root_=current;
-  }
-  else
-  {
-    if(grandParent->getLeft() != nullptr && grandParent->getLeft()==parent )
-    {
-      grandParent->setLeft(current);
-    }
-    else if(grandParent->getRight() != nullptr && grandParent->getRight()==parent )
+  BinarySearchTree<Key, Value>::rotateRight(parent);
+}
+
+/*
+ * Allocates the nodes for this tree. Trees with their own node type
+ * or allocation strategy override this.
+ */
+template<class Key, class Value>
+AVLNode<Key, Value>* AVLTree<Key, Value>::createNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent) const
+{
+    return new AVLNode<Key, Value>(key, value, parent);
+}
+
+/*
+ * The dynamic type of the nodes createNode makes. Nodes of any other
+ * type are never linked into this tree as they are, since its hooks
+ * would cast them to the wrong type.
+ */
+template<class Key, class Value>
+const std::type_info& AVLTree<Key, Value>::nodeType() const
+{
+    return typeid(AVLNode<Key, Value>);
+}
+
+/*
+ * Whether applySorted may hand parts of a batch to helper threads. A
+ * helper applies its part in a scratch AVLTree, so the nodes it builds
+ * are plain AVLNodes and only this class's hooks see them. That is only
+ * right for trees of plain AVLNodes, so the answer defaults to whether
+ * nodeType is AVLNode. Such a tree whose hooks must see every node, and
+ * not just nodesMoved once the batch is done, has to return false too.
+ */
+template<class Key, class Value>
+bool AVLTree<Key, Value>::parallelBuildSafe() const
+{
+    return nodeType() == typeid(AVLNode<Key, Value>);
+}
+
+/*
+ * Frees a node that remove or erase has unlinked. The counterpart of
+ * createNode; trees whose nodes may still be read by other threads
+ * override it to defer the delete.
+ */
+template<class Key, class Value>
+void AVLTree<Key, Value>::destroyNode(AVLNode<Key, Value>* node)
+{
+    delete node;
+}
+
+/*
+ * buildTree splits sizes evenly, so a subtree of size n has the height of
+ * a complete tree: the number of bits in n.
+ */
+template<class Key, class Value>
+Node<Key, Value>* AVLTree<Key, Value>::buildNode(const Key& key, const Value& value,
+    Node<Key, Value>* left, uint64_t leftSize, Node<Key, Value>* right, uint64_t rightSize)
+{
+    int leftHeight=0, rightHeight=0;
+    for(; leftSize != 0; leftSize >>= 1) leftHeight++;
+    for(; rightSize != 0; rightSize >>= 1) rightHeight++;
+
+    AVLNode<Key, Value>* node=createNode(key, value, nullptr);
+    node->setLeft(left);
+    node->setRight(right);
+    if(left != nullptr) left->setParent(node);
+    if(right != nullptr) right->setParent(node);
+    node->setBalance(rightHeight - leftHeight);
+    updatePath(node);
+    return node;
+}
+
+template<class Key, class Value>
+void AVLTree<Key, Value>::destroySubtree(AVLNode<Key, Value>* node)
+{
+    if(node != nullptr)
     {
-      grandParent->setRight(current);
+      destroySubtree(node->getLeft());
+      destroySubtree(node->getRight());
+      destroyNode(node);
     }
-  }
+}
 
-  parent->setLeft(current->getRight());
-  if(current->getRight() != nullptr)
-  {
-    current->getRight()->setParent(parent);
-  }
-  parent->setParent(current);
+/*
+ * Called with the lowest node whose subtree changed contents, before any
+ * rebalancing rotations. Does nothing here; augmented trees override it
+ * to refresh their per-subtree data from current up to the root.
+ */
+template<class Key, class Value>
+void AVLTree<Key, Value>::updatePath(AVLNode<Key, Value>* current)
+{
 
-  current->setParent(grandParent);
-  current->setRight(parent);
 }
 
-
 template<class Key, class Value>
 void AVLTree<Key, Value>::nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2)
 {
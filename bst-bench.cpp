@@ -0,0 +1,906 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <map>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <string>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "bst.h"
+#include "avlbst.h"
+#include "splaybst.h"
+#include "rbbst.h"
+#include "aggavlbst.h"
+#include "intervalbst.h"
+#include "shardedavl.h"
+#include "parallelbst.h"
+#include "epochavl.h"
+#include "durableavl.h"
+#include "filteredbst.h"
+#include "compactavl.h"
+#include "relaxedavl.h"
+#include "tombstoneavl.h"
+#include "cachedavl.h"
+#include "hugepages.h"
+#include "multiavl.h"
+#include "appendavl.h"
+
+using namespace std;
+
+// Draws keys in [0, n) where key i has probability proportional to 1/(i+1)^s.
+class ZipfGenerator
+{
+public:
+    ZipfGenerator(int n, double s, unsigned int seed) : cdf_(n), rng_(seed), dist_(0.0, 1.0)
+    {
+        double sum = 0;
+        for(int i = 0; i < n; i++) {
+            sum += 1.0 / pow(i + 1, s);
+            cdf_[i] = sum;
+        }
+        for(int i = 0; i < n; i++) {
+            cdf_[i] /= sum;
+        }
+    }
+    int operator()()
+    {
+        return lower_bound(cdf_.begin(), cdf_.end(), dist_(rng_)) - cdf_.begin();
+    }
+private:
+    vector<double> cdf_;
+    mt19937 rng_;
+    uniform_real_distribution<double> dist_;
+};
+
+// Keys are scrambled so that hot keys are spread over the key space.
+static vector<int> zipfTrace(int n, int ops, double s)
+{
+    vector<int> perm(n);
+    for(int i = 0; i < n; i++) perm[i] = i;
+    shuffle(perm.begin(), perm.end(), mt19937(7));
+    ZipfGenerator zipf(n, s, 42);
+    vector<int> trace(ops);
+    for(int i = 0; i < ops; i++) trace[i] = perm[zipf()];
+    return trace;
+}
+
+static void report(const char* name, chrono::steady_clock::time_point start, int ops)
+{
+    double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+    cout << "  " << left << setw(28) << name << right << setw(10) << fixed << setprecision(1)
+         << ns / ops << " ns/op" << endl;
+}
+
+template<typename Tree>
+static void runLookups(const char* name, Tree& tree, const vector<int>& trace)
+{
+    long found = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(size_t i = 0; i < trace.size(); i++) {
+        if(tree.find(trace[i]) != tree.end()) found++;
+    }
+    report(name, start, trace.size());
+    if(found != (long)trace.size()) cout << "  (missing keys!)" << endl;
+}
+
+template<typename Tree>
+static void fill(Tree& tree, int n)
+{
+    vector<int> keys(n);
+    for(int i = 0; i < n; i++) keys[i] = i;
+    shuffle(keys.begin(), keys.end(), mt19937(1));
+    for(int i = 0; i < n; i++) tree.insert(make_pair(keys[i], i));
+}
+
+static void benchZipfLookups(int n, int ops)
+{
+    cout << "Zipf(0.99) lookups, n=" << n << ", ops=" << ops << endl;
+    vector<int> trace = zipfTrace(n, ops, 0.99);
+
+    AVLTree<int,int> avl;
+    fill(avl, n);
+    runLookups("AVLTree", avl, trace);
+
+    SplayTree<int,int> splay;
+    fill(splay, n);
+    runLookups("SplayTree", splay, trace);
+
+    SplayTree<int,int> semi(1, true);
+    fill(semi, n);
+    runLookups("SplayTree semi-splay", semi, trace);
+
+    SplayTree<int,int> periodic(8);
+    fill(periodic, n);
+    runLookups("SplayTree every 8th", periodic, trace);
+
+    for(size_t slots = 4096; slots <= 65536; slots *= 16) {
+        CachedAVLTree<int,int> cached(slots);
+        fill(cached, n);
+        string name = "CachedAVLTree, " + to_string(slots) + " slots";
+        runLookups(name.c_str(), cached, trace);
+        cout << "    hit rate " << setprecision(1) << 100.0 * cached.hits() / (cached.hits() + cached.misses()) << "%" << endl;
+    }
+}
+
+// Every round inserts a fresh key and expires the oldest one, TTL style.
+// deleteRatio of the remaining operations are extra removes of random keys.
+template<typename Tree>
+static void runChurn(const char* name, int n, int ops, double deleteRatio)
+{
+    Tree tree;
+    for(int i = 0; i < n; i++) tree.insert(make_pair(i, i));
+    mt19937 rng(5);
+    uniform_real_distribution<double> coin(0.0, 1.0);
+    int oldest = 0, next = n;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(int i = 0; i < ops; i++) {
+        if(coin(rng) < deleteRatio) {
+            tree.remove(oldest + rng() % (next - oldest));
+        }
+        else {
+            tree.insert(make_pair(next, i));
+            next++;
+            tree.remove(oldest);
+            oldest++;
+        }
+    }
+    report(name, start, ops);
+}
+
+static void benchChurn(int n, int ops)
+{
+    cout << "TTL expiry (insert newest + remove oldest), n=" << n << ", ops=" << ops << endl;
+    runChurn<AVLTree<int,int> >("AVLTree", n, ops, 0.0);
+    runChurn<RedBlackTree<int,int> >("RedBlackTree", n, ops, 0.0);
+    cout << "Delete-heavy (50% random removes), n=" << n << ", ops=" << ops << endl;
+    runChurn<AVLTree<int,int> >("AVLTree", n, ops, 0.5);
+    runChurn<RedBlackTree<int,int> >("RedBlackTree", n, ops, 0.5);
+}
+
+// Expires the oldest half of the keys, first one at a time, then as one range.
+static void benchExpire(int n)
+{
+    cout << "Expire oldest half, n=" << n << endl;
+    {
+        AVLTree<int,int> tree;
+        for(int i = 0; i < n; i++) tree.insert(make_pair(i, i));
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(int i = 0; i < n / 2; i++) tree.remove(i);
+        report("AVLTree remove(key)", start, n / 2);
+    }
+    {
+        AVLTree<int,int> tree;
+        for(int i = 0; i < n; i++) tree.insert(make_pair(i, i));
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        AVLTree<int,int>::iterator it = tree.begin();
+        while(it != tree.end() && it->first < n / 2) it = tree.erase(it);
+        report("AVLTree erase(iterator)", start, n / 2);
+    }
+    {
+        AVLTree<int,int> tree;
+        for(int i = 0; i < n; i++) tree.insert(make_pair(i, i));
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        tree.erase(tree.begin(), tree.find(n / 2));
+        report("AVLTree erase(first, last)", start, n / 2);
+    }
+    {
+        AVLTree<int,int> tree;
+        for(int i = 0; i < n; i++) tree.insert(make_pair(i, i));
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        tree.erase_if([n](const pair<const int,int>& item) { return item.second < n / 2; });
+        report("AVLTree erase_if", start, n / 2);
+    }
+}
+
+// Copying a tree by cloning its shape versus re-inserting every item.
+static void benchClone(int n)
+{
+    cout << "Copy a tree, n=" << n << endl;
+    AVLTree<int,int> source;
+    fill(source, n);
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        AVLTree<int,int> copy;
+        for(AVLTree<int,int>::iterator it = source.begin(); it != source.end(); ++it) copy.insert(*it);
+        report("re-insert", start, n);
+    }
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        AVLTree<int,int> copy(source);
+        report("copy constructor", start, n);
+    }
+    unsigned int threads = thread::hardware_concurrency();
+    if(threads > 1) {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        AVLTree<int,int> copy;
+        copy.assign(source, threads);
+        report("parallel assign", start, n);
+    }
+}
+
+// Sums over random key windows covering about a tenth of the tree.
+static void benchRangeSum(int n, int queries)
+{
+    cout << "Range sums over n/10 keys, n=" << n << ", queries=" << queries << endl;
+    AggregateAVLTree<int,long> tree;
+    for(int i = 0; i < n; i++) tree.insert(make_pair(i, (long)i));
+    mt19937 rng(9);
+    vector<int> starts(queries);
+    for(int i = 0; i < queries; i++) starts[i] = rng() % n;
+    long check = 0;
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(int i = 0; i < queries; i++) {
+            AggregateAVLTree<int,long>::iterator it = tree.find(starts[i]);
+            for(; it != tree.end() && it->first < starts[i] + n / 10; ++it) check += it->second;
+        }
+        report("iterate", start, queries);
+    }
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(int i = 0; i < queries; i++) check -= tree.aggregate(starts[i], starts[i] + n / 10);
+        report("aggregate(lo, hi)", start, queries);
+    }
+    if(check != 0) cout << "  (sums differ!)" << endl;
+}
+
+static void countItem(const IntervalTree<int,int>::Item&) { }
+
+// Stabbing queries over short random intervals.
+static void benchIntervals(int n, int queries)
+{
+    cout << "Interval overlap queries, n=" << n << ", queries=" << queries << endl;
+    IntervalTree<int,int> tree;
+    mt19937 rng(11);
+    for(int i = 0; i < n; i++) {
+        int low = rng() % (n * 10);
+        tree.insert(low, low + rng() % 100, i);
+    }
+    vector<pair<int,int> > ranges(queries);
+    for(int i = 0; i < queries; i++) {
+        int low = rng() % (n * 10);
+        ranges[i] = make_pair(low, low + 50);
+    }
+    // the scan is slow, so it only runs a few of the queries
+    int scans = min(queries, 10);
+    size_t found = 0;
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(int i = 0; i < scans; i++) {
+            for(IntervalTree<int,int>::iterator it = tree.begin(); it != tree.end(); ++it) {
+                if(it->first.first <= ranges[i].second && ranges[i].first <= it->first.second) found++;
+            }
+        }
+        report("full scan", start, scans);
+    }
+    for(int i = 0; i < scans; i++) found -= tree.overlaps(ranges[i].first, ranges[i].second, countItem);
+    if(found != 0) cout << "  (results differ!)" << endl;
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(int i = 0; i < queries; i++) found += tree.overlaps(ranges[i].first, ranges[i].second, countItem);
+        report("overlaps", start, queries);
+    }
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        found -= tree.overlapsBatch(ranges, [](size_t, const IntervalTree<int,int>::Item&) { });
+        report("overlapsBatch", start, queries);
+    }
+    if(found != 0) cout << "  (results differ!)" << endl;
+}
+
+// One AVLTree behind one lock, as the baseline for the sharded map.
+class LockedAVLMap
+{
+public:
+    void insert(const pair<const int,int>& item) { lock_guard<mutex> guard(lock_); tree_.insert(item); }
+    bool find(int key, int& value) const
+    {
+        lock_guard<mutex> guard(lock_);
+        AVLTree<int,int>::iterator it = tree_.find(key);
+        if(it == tree_.end()) return false;
+        value = it->second;
+        return true;
+    }
+private:
+    mutable mutex lock_;
+    AVLTree<int,int> tree_;
+};
+
+// Every thread does a 50/50 mix of inserts and lookups on uniform keys.
+template<typename Map>
+static void runConcurrent(const char* name, Map& map, int n, int ops, unsigned int threads)
+{
+    vector<thread> workers;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(unsigned int t = 0; t < threads; t++) {
+        workers.push_back(thread([&map, n, ops, threads, t]() {
+            mt19937 rng(t);
+            int value;
+            for(int i = 0; i < ops / (int)threads; i++) {
+                int key = rng() % n;
+                if(i % 2) map.insert(make_pair(key, i));
+                else map.find(key, value);
+            }
+        }));
+    }
+    for(size_t t = 0; t < workers.size(); t++) workers[t].join();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "  " << left << setw(20) << name << right << setw(3) << threads << " threads"
+         << setw(12) << fixed << setprecision(2) << ops / seconds / 1e6 << " Mops/s" << endl;
+}
+
+static void benchSharded(int n, int ops)
+{
+    cout << "Concurrent insert/find mix, n=" << n << ", ops=" << ops << endl;
+    unsigned int maxThreads = max(1u, thread::hardware_concurrency());
+    for(unsigned int threads = 1; threads <= maxThreads; threads *= 2) {
+        LockedAVLMap locked;
+        runConcurrent("single lock", locked, n, ops, threads);
+        vector<int> bounds;
+        for(int i = 1; i < 64; i++) bounds.push_back((long)n * i / 64);
+        ShardedAVLMap<int,int> sharded(bounds);
+        runConcurrent("ShardedAVLMap x64", sharded, n, ops, threads);
+    }
+}
+
+static long addValue(long sum, const pair<const int,int>& item) { return sum + item.second; }
+static long addSums(long a, long b) { return a + b; }
+
+// Full-tree sum on one thread with the iterator versus parallel_reduce.
+static void benchParallelScan(int n)
+{
+    cout << "Full scan sum, n=" << n << endl;
+    AVLTree<int,int> tree;
+    fill(tree, n);
+    long check = 0;
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(AVLTree<int,int>::iterator it = tree.begin(); it != tree.end(); ++it) check += it->second;
+        report("iterator", start, n);
+    }
+    unsigned int maxThreads = max(1u, thread::hardware_concurrency());
+    for(unsigned int threads = 1; threads <= maxThreads; threads *= 2) {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        long sum = parallel_reduce(tree, 0L, addValue, addSums, threads);
+        string name = "parallel_reduce, " + to_string(threads) + " threads";
+        report(name.c_str(), start, n);
+        if(sum != check) cout << "  (sums differ!)" << endl;
+    }
+}
+
+static void deleteInt(void* p) { delete static_cast<int*>(p); }
+
+// Every thread enters and leaves a guard per op and frees an object every
+// eighth op, either right away or through the epoch domain.
+static void runReclaim(const char* name, int ops, unsigned int threads, bool epoch)
+{
+    EpochDomain domain;
+    vector<thread> workers;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(unsigned int t = 0; t < threads; t++) {
+        workers.push_back(thread([&domain, ops, threads, epoch]() {
+            for(int i = 0; i < ops / (int)threads; i++) {
+                if(epoch) {
+                    EpochDomain::Guard guard(domain);
+                    if(i % 8 == 0) domain.retire(new int(i), deleteInt);
+                }
+                else if(i % 8 == 0) {
+                    delete new int(i);
+                }
+            }
+        }));
+    }
+    for(size_t t = 0; t < workers.size(); t++) workers[t].join();
+    string label = string(name) + ", " + to_string(threads) + " threads";
+    report(label.c_str(), start, ops);
+}
+
+static void benchReclaim(int ops)
+{
+    cout << "Epoch reclamation overhead, ops=" << ops << endl;
+    for(unsigned int threads = 1; threads <= 64; threads *= 4) {
+        runReclaim("delete", ops, threads, false);
+        runReclaim("guard + retire", ops, threads, true);
+    }
+}
+
+// Loading a saved tree with deserialize versus inserting every item.
+static void benchSerialize(int n)
+{
+    cout << "Save and load a tree, n=" << n << endl;
+    AVLTree<int,int> source;
+    fill(source, n);
+    stringstream stream;
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        source.serialize(stream);
+        report("serialize", start, n);
+    }
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        AVLTree<int,int> copy;
+        for(AVLTree<int,int>::iterator it = source.begin(); it != source.end(); ++it) copy.insert(*it);
+        report("re-insert", start, n);
+    }
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        AVLTree<int,int> copy;
+        copy.deserialize(stream);
+        report("deserialize", start, n);
+    }
+}
+
+static void incrementCount(int& count) { count++; }
+
+// Counting Zipf keys: find + operator[] or insert, versus one upsert.
+static void benchCounters(int n, int ops)
+{
+    cout << "Zipf(0.99) counters, n=" << n << ", ops=" << ops << endl;
+    vector<int> trace = zipfTrace(n, ops, 0.99);
+    {
+        AVLTree<int,int> counts;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(size_t i = 0; i < trace.size(); i++) {
+            if(counts.find(trace[i]) != counts.end()) counts[trace[i]]++;
+            else counts.insert(make_pair(trace[i], 1));
+        }
+        report("find + operator[] / insert", start, ops);
+    }
+    {
+        AVLTree<int,int> counts;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(size_t i = 0; i < trace.size(); i++) counts.upsert(trace[i], 1, incrementCount);
+        report("upsert", start, ops);
+    }
+}
+
+// Applying a sorted batch of inserts and removes item by item versus
+// with applySorted.
+static void benchApplySorted(int n, int batchSize)
+{
+    cout << "Sorted batch of " << batchSize << " mutations into n=" << n << endl;
+    mt19937 rng(5);
+    vector<int> keys(batchSize);
+    for(int i = 0; i < batchSize; i++) keys[i] = rng() % (2 * n);
+    sort(keys.begin(), keys.end());
+    vector<AVLTree<int,int>::mutation> batch;
+    for(int i = 0; i < batchSize; i++) {
+        if(i % 4 == 0) batch.push_back(AVLTree<int,int>::mutation(keys[i]));
+        else batch.push_back(AVLTree<int,int>::mutation(keys[i], i));
+    }
+    {
+        AVLTree<int,int> tree;
+        fill(tree, n);
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(size_t i = 0; i < batch.size(); i++) {
+            if(batch[i].erase) tree.remove(batch[i].key);
+            else tree.insert(make_pair(batch[i].key, batch[i].value));
+        }
+        report("insert/remove", start, batchSize);
+    }
+    unsigned int maxThreads = max(1u, thread::hardware_concurrency());
+    for(unsigned int threads = 1; threads <= maxThreads; threads *= 2) {
+        AVLTree<int,int> tree;
+        fill(tree, n);
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        tree.applySorted(batch.begin(), batch.end(), threads);
+        string name = "applySorted, " + to_string(threads) + " threads";
+        report(name.c_str(), start, batchSize);
+    }
+}
+
+// Durable inserts from several threads, which group commit batches into
+// shared fdatasync calls. Files go to the current directory.
+static void benchDurable(int ops)
+{
+    cout << "Durable inserts with group commit, ops=" << ops << endl;
+    for(unsigned int threads = 1; threads <= 64; threads *= 4) {
+        remove("bench-durable.wal");
+        remove("bench-durable.snapshot");
+        DurableAVLTree<int,int> tree("bench-durable");
+        vector<thread> workers;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(unsigned int t = 0; t < threads; t++) {
+            workers.push_back(thread([&tree, ops, threads, t]() {
+                for(int i = 0; i < ops / (int)threads; i++) tree.insert(make_pair(i * (int)threads + (int)t, i));
+            }));
+        }
+        for(size_t t = 0; t < workers.size(); t++) workers[t].join();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << "  " << setw(3) << threads << " threads" << setw(14) << fixed << setprecision(0)
+             << ops / seconds << " ops/s" << endl;
+    }
+    remove("bench-durable.wal");
+    remove("bench-durable.snapshot");
+}
+
+// Lookups where most keys are missing, with and without a Bloom filter
+// in front of the tree. The tree holds the even keys and the misses are
+// odd, so they spread over the whole tree.
+static void benchFilteredMisses(int n, int ops)
+{
+    cout << "Lookups with 70% misses, n=" << n << ", ops=" << ops << endl;
+    vector<int> keys(n);
+    for(int i = 0; i < n; i++) keys[i] = 2 * i;
+    shuffle(keys.begin(), keys.end(), mt19937(1));
+    AVLTree<int,int> plain;
+    FilteredTree<int,int> filtered(n);
+    for(int i = 0; i < n; i++) {
+        plain.insert(make_pair(keys[i], i));
+        filtered.insert(make_pair(keys[i], i));
+    }
+    mt19937 rng(6);
+    vector<int> trace(ops);
+    for(int i = 0; i < ops; i++) trace[i] = 2 * (int)(rng() % n) + (rng() % 10 < 7 ? 1 : 0);
+
+    long found = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(size_t i = 0; i < trace.size(); i++) {
+        if(plain.find(trace[i]) != plain.end()) found++;
+    }
+    report("AVL find", start, ops);
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < trace.size(); i++) {
+        if(filtered.find(trace[i]) != filtered.end()) found--;
+    }
+    report("filtered AVL find", start, ops);
+    if(found != 0) cout << "  (results differ!)" << endl;
+    cout << "  filter answered " << filtered.shortCircuits() << " of " << filtered.lookups() << " lookups" << endl;
+}
+
+// Inserts, random lookups and removes on 64-bit keys and values, pointer
+// nodes with parent links versus the parent-free 32-bit index arena.
+static void benchCompact(int n, int ops)
+{
+    cout << "Compact nodes, uint64 -> uint64, n=" << n << ", ops=" << ops << endl;
+    mt19937 rng(7);
+    vector<int> trace(ops);
+    for(int i = 0; i < ops; i++) trace[i] = rng() % n;
+    AVLTree<uint64_t,uint64_t> plain;
+    CompactAVLTree<uint64_t,uint64_t> compact;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    fill(plain, n);
+    report("AVL insert", start, n);
+    start = chrono::steady_clock::now();
+    fill(compact, n);
+    report("compact AVL insert", start, n);
+    cout << "  AVLNode" << setw(29) << sizeof(AVLNode<uint64_t,uint64_t>) << " bytes/node + malloc" << endl;
+    cout << "  compact arena" << setw(23) << fixed << setprecision(1)
+         << (double)compact.memoryUsage() / n << " bytes/item" << endl;
+
+    uint64_t sum = 0;
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < trace.size(); i++) sum += plain.find(trace[i])->second;
+    report("AVL find", start, ops);
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < trace.size(); i++) sum -= compact.find(trace[i])->second;
+    report("compact AVL find", start, ops);
+    if(sum != 0) cout << "  (results differ!)" << endl;
+
+    start = chrono::steady_clock::now();
+    for(int i = 0; i < n && i < ops; i += 2) plain.remove(trace[i]);
+    report("AVL remove", start, (min(n, ops) + 1) / 2);
+    start = chrono::steady_clock::now();
+    for(int i = 0; i < n && i < ops; i += 2) compact.remove(trace[i]);
+    report("compact AVL remove", start, (min(n, ops) + 1) / 2);
+}
+
+// Bursts of ascending and of random inserts into a strict AVL tree versus
+// a relaxed one, which defers its rotations to rebalance().
+static void benchRelaxed(int n)
+{
+    cout << "Insert bursts, relaxed balance, n=" << n << endl;
+    vector<int> keys(n);
+    for(int i = 0; i < n; i++) keys[i] = i;
+    for(int shuffled = 0; shuffled < 2; shuffled++) {
+        const char* order = shuffled ? "random" : "ascending";
+        if(shuffled) shuffle(keys.begin(), keys.end(), mt19937(8));
+        {
+            AVLTree<int,int> tree;
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            for(int i = 0; i < n; i++) tree.insert(make_pair(keys[i], i));
+            string name = string("AVL, ") + order;
+            report(name.c_str(), start, n);
+        }
+        for(unsigned int slack = 1; slack <= 2; slack++) {
+            RelaxedAVLTree<int,int> tree(slack);
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            for(int i = 0; i < n; i++) tree.insert(make_pair(keys[i], i));
+            string name = string("relaxed ") + to_string(slack) + ", " + order;
+            report(name.c_str(), start, n);
+            start = chrono::steady_clock::now();
+            tree.rebalance();
+            report("  then rebalance()", start, n);
+        }
+    }
+}
+
+// A TTL window: every step inserts a new key and expires the oldest one.
+// Lazy removes only mark the node; the tombstones are cleared by the
+// automatic rebuild, or by a small compact() after every step.
+static void benchTombstones(int n, int ops)
+{
+    cout << "TTL window, lazy deletes, n=" << n << endl;
+    vector<int> keys(n + ops);
+    for(int i = 0; i < n + ops; i++) keys[i] = i;
+    shuffle(keys.begin(), keys.end(), mt19937(9));
+    {
+        AVLTree<int,int> tree;
+        for(int i = 0; i < n; i++) tree.insert(make_pair(keys[i], i));
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(int i = 0; i < ops; i++) tree.remove(keys[i]);
+        report("AVLTree remove", start, ops);
+    }
+    {
+        TombstoneAVLTree<int,int> tree(1.0);
+        for(int i = 0; i < n; i++) tree.insert(make_pair(keys[i], i));
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(int i = 0; i < ops; i++) tree.remove(keys[i]);
+        report("lazy remove", start, ops);
+    }
+    {
+        AVLTree<int,int> tree;
+        for(int i = 0; i < n; i++) tree.insert(make_pair(keys[i], i));
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(int i = 0; i < ops; i++) {
+            tree.insert(make_pair(keys[n + i], i));
+            tree.remove(keys[i]);
+        }
+        report("AVLTree window step", start, ops);
+    }
+    {
+        TombstoneAVLTree<int,int> tree;
+        for(int i = 0; i < n; i++) tree.insert(make_pair(keys[i], i));
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(int i = 0; i < ops; i++) {
+            tree.insert(make_pair(keys[n + i], i));
+            tree.remove(keys[i]);
+        }
+        report("lazy step, rebuilds", start, ops);
+    }
+    {
+        TombstoneAVLTree<int,int> tree(1.0);
+        for(int i = 0; i < n; i++) tree.insert(make_pair(keys[i], i));
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(int i = 0; i < ops; i++) {
+            tree.insert(make_pair(keys[n + i], i));
+            tree.remove(keys[i]);
+            tree.compact(1);
+        }
+        report("lazy step, compact(1)", start, ops);
+    }
+}
+
+// Scans and random finds in a compact tree whose arena order is the
+// random insertion order, then after moving the nodes into each layout.
+template<typename Tree>
+static void runLayout(const char* name, Tree& tree, const vector<int>& trace)
+{
+    uint64_t sum = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(typename Tree::iterator it = tree.begin(); it != tree.end(); ++it) sum += it->second;
+    string scan = string(name) + " scan";
+    report(scan.c_str(), start, tree.size());
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < trace.size(); i++) sum += tree.find(trace[i])->second;
+    string find = string(name) + " find";
+    report(find.c_str(), start, trace.size());
+    if(sum == 0) cout << "  (nothing found!)" << endl;
+}
+
+static void benchRelayout(int n, int ops)
+{
+    cout << "Node layout, compact AVL, n=" << n << ", ops=" << ops << endl;
+    mt19937 rng(12);
+    vector<int> trace(ops);
+    for(int i = 0; i < ops; i++) trace[i] = rng() % n;
+    CompactAVLTree<uint64_t,uint64_t> tree;
+    fill(tree, n);
+    runLayout("as inserted", tree, trace);
+
+    // costs are per node moved or put in place
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    while(tree.defragment(1000)) { }
+    report("defragment(1000)", start, n);
+    runLayout("defragmented", tree, trace);
+
+    static const char* names[] = { "in-order", "breadth-first", "van Emde Boas" };
+    for(int layout = CompactAVLTree<uint64_t,uint64_t>::IN_ORDER; layout <= CompactAVLTree<uint64_t,uint64_t>::VAN_EMDE_BOAS; layout++) {
+        start = chrono::steady_clock::now();
+        tree.relayout(static_cast<CompactAVLTree<uint64_t,uint64_t>::Layout>(layout));
+        string name = string("relayout ") + names[layout];
+        report(name.c_str(), start, n);
+        runLayout(names[layout], tree, trace);
+    }
+}
+
+// Random finds one after another against findEach with growing numbers
+// of searches in flight.
+static void benchInterleaved(int n, int ops)
+{
+    cout << "Interleaved lookups, n=" << n << ", ops=" << ops << endl;
+    mt19937 rng(13);
+    vector<int> trace(ops);
+    for(int i = 0; i < ops; i++) trace[i] = rng() % n;
+    AVLTree<int,int> tree;
+    fill(tree, n);
+
+    uint64_t sum = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(int i = 0; i < ops; i++) sum += tree.find(trace[i])->second;
+    report("find", start, ops);
+    for(unsigned int group = 1; group <= 32; group *= 2) {
+        start = chrono::steady_clock::now();
+        tree.findEach(trace.begin(), trace.end(),
+                      [&sum](const int&, AVLTree<int,int>::iterator it) { sum += it->second; }, group);
+        string name = "findEach, group " + to_string(group);
+        report(name.c_str(), start, ops);
+    }
+    if(sum == 0) cout << "  (nothing found!)" << endl;
+}
+
+// Duplicate keys held in a vector per key and in std::multimap, against
+// counted multi-tree nodes, with every key repeated dups times. The
+// vectors live in a std::map since AVLTree needs printable values.
+static void benchDuplicates(int n, int dups)
+{
+    cout << "Duplicate keys, n=" << n << ", dups=" << dups << endl;
+    vector<int> keys(n);
+    for(int i = 0; i < n; i++) keys[i] = i / dups;
+    shuffle(keys.begin(), keys.end(), mt19937(14));
+    uint64_t sum = 0;
+    {
+        map<int,vector<int> > tree;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(int i = 0; i < n; i++) tree[keys[i]].push_back(i);
+        report("map of vectors insert", start, n);
+        start = chrono::steady_clock::now();
+        for(int i = 0; i < n; i++) sum += tree.find(keys[i])->second.size();
+        report("map of vectors count", start, n);
+    }
+    {
+        multimap<int,int> tree;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(int i = 0; i < n; i++) tree.insert(make_pair(keys[i], i));
+        report("std::multimap insert", start, n);
+        start = chrono::steady_clock::now();
+        for(int i = 0; i < n; i++) sum += tree.count(keys[i]);
+        report("std::multimap count", start, n);
+    }
+    {
+        AVLMultiTree<int,int> tree;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(int i = 0; i < n; i++) tree.insert(make_pair(keys[i], i));
+        report("AVLMultiTree insert", start, n);
+        start = chrono::steady_clock::now();
+        for(int i = 0; i < n; i++) sum += tree.count(keys[i]);
+        report("AVLMultiTree count", start, n);
+    }
+    if(sum == 0) cout << "  (nothing found!)" << endl;
+}
+
+// Sequential inserts through the general path, through AppendAVLTree's
+// insert, which spots the appends itself, and through pushBack.
+static void benchAppend(int n)
+{
+    cout << "Sequential appends, n=" << n << endl;
+    {
+        AVLTree<int,int> tree;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(int i = 0; i < n; i++) tree.insert(make_pair(i, i));
+        report("AVLTree insert", start, n);
+    }
+    {
+        AppendAVLTree<int,int> tree;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(int i = 0; i < n; i++) tree.insert(make_pair(i, i));
+        report("AppendAVLTree insert", start, n);
+    }
+    {
+        AppendAVLTree<int,int> tree;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(int i = 0; i < n; i++) tree.pushBack(make_pair(i, i));
+        report("AppendAVLTree pushBack", start, n);
+    }
+}
+
+// Counts data TLB read misses of this thread through perf_event_open.
+// valid() is false where the kernel or the sandbox does not allow it.
+class DtlbMisses
+{
+public:
+    DtlbMisses() : fd_(-1)
+    {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd_ = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+    ~DtlbMisses() { if(fd_ >= 0) close(fd_); }
+    bool valid() const { return fd_ >= 0; }
+    void start() { if(valid()) { ioctl(fd_, PERF_EVENT_IOC_RESET, 0); ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0); } }
+    long long stop()
+    {
+        long long count = 0;
+        if(!valid()) return -1;
+        ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+        if(read(fd_, &count, sizeof(count)) != sizeof(count)) return -1;
+        return count;
+    }
+private:
+    int fd_;
+};
+
+// Random finds in a compact tree whose arena is on 4K pages versus one
+// that asked for huge pages, with the dTLB misses per lookup.
+static void benchHugePages(int n, int ops)
+{
+    static const char* backings[] = { "heap", "4K pages", "transparent huge pages", "hugetlbfs" };
+    cout << "Huge page arena, compact AVL finds, n=" << n << ", ops=" << ops << endl;
+    mt19937 rng(11);
+    vector<int> trace(ops);
+    for(int i = 0; i < ops; i++) trace[i] = rng() % n;
+    for(int huge = 0; huge < 2; huge++) {
+        CompactAVLTree<uint64_t,uint64_t> tree(huge != 0);
+        fill(tree, n);
+        DtlbMisses misses;
+        uint64_t sum = 0;
+        misses.start();
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(size_t i = 0; i < trace.size(); i++) sum += tree.find(trace[i])->second;
+        string name = huge ? "huge page arena" : "default arena";
+        report(name.c_str(), start, ops);
+        long long count = misses.stop();
+        cout << "    backed by " << backings[tree.backing()] << ", dTLB misses/find ";
+        if(count < 0) cout << "unavailable";
+        else cout << setprecision(2) << (double)count / ops;
+        cout << endl;
+        if(sum == 0) cout << "  (nothing found!)" << endl;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int n = argc > 1 ? atoi(argv[1]) : 100000;
+    int ops = argc > 2 ? atoi(argv[2]) : 1000000;
+
+    benchZipfLookups(n, ops);
+    benchChurn(n, ops);
+    benchExpire(n);
+    benchClone(n);
+    benchRangeSum(n, 1000);
+    benchIntervals(n, 1000);
+    benchSharded(n, ops);
+    benchParallelScan(n);
+    benchReclaim(ops);
+    benchSerialize(n);
+    benchCounters(n, ops);
+    benchApplySorted(n, min(n, 100000));
+    benchFilteredMisses(n, ops);
+    benchCompact(n, ops);
+    benchRelaxed(n);
+    benchTombstones(n, min(n, ops));
+    benchHugePages(n, ops);
+    benchRelayout(n, ops);
+    benchInterleaved(n, ops);
+    benchDuplicates(n, 4);
+    benchAppend(max(n, 10000000));
+    benchDurable(min(ops, 20000));
+    return 0;
+}
@@ -1,10 +1,1828 @@
 #include <iostream>
 #include <map>
+#include <string>
+#include <sstream>
+#include <cstdio>
+#include <random>
+#include <limits>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <stdexcept>
+#include <system_error>
+#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
 #include "bst.h"
 #include "avlbst.h"
+#include "splaybst.h"
+#include "rbbst.h"
+#include "aggavlbst.h"
+#include "intervalbst.h"
+#include "shardedavl.h"
+#include "parallelbst.h"
+#include "epochavl.h"
+#include "durableavl.h"
+#include "filteredbst.h"
+#include "compactavl.h"
+#include "relaxedavl.h"
+#include "tombstoneavl.h"
+#include "cachedavl.h"
+#include "multiavl.h"
+#include "appendavl.h"
 
 using namespace std;
 
+static int failures = 0;
+
+/**
+ * Records one expectation of a test. Failures are printed and make the
+ * program exit with a non-zero status.
+ */
+static void check(bool ok, const char* test, const char* what)
+{
+    if(!ok) {
+        failures++;
+        cout << "FAILED " << test << ": " << what << endl;
+    }
+}
+
+/**
+ * True if [first, last) holds exactly the items of expected, in order.
+ */
+template<typename Iterator, typename Key, typename Value>
+static bool sameItems(Iterator first, Iterator last, const std::map<Key,Value>& expected)
+{
+    typename std::map<Key,Value>::const_iterator want = expected.begin();
+    for(; first != last; ++first, ++want) {
+        if(want == expected.end() || first->first != want->first || first->second != want->second) {
+            return false;
+        }
+    }
+    return want == expected.end();
+}
+
+/**
+ * Applies ops random inserts, removes and finds with keys below keyRange
+ * to tree and to a std::map, checking every find and the final contents.
+ */
+template<typename Tree>
+static void randomOps(Tree& tree, std::map<int,int>& expected, const char* test, unsigned int seed, int ops, int keyRange)
+{
+    std::mt19937 rng(seed);
+    for(int i = 0; i < ops; i++) {
+        int key = rng() % keyRange;
+        int op = rng() % 4;
+        if(op == 0) {
+            tree.insert(std::make_pair(key, i));
+            expected[key] = i;
+        }
+        else if(op == 1) {
+            tree.remove(key);
+            expected.erase(key);
+        }
+        else {
+            std::map<int,int>::iterator want = expected.find(key);
+            if(want == expected.end()) {
+                check(tree.find(key) == tree.end(), test, "find of a missing key returns end()");
+            }
+            else {
+                check(tree.find(key) != tree.end() && tree.find(key)->first == key && tree.find(key)->second == want->second,
+                      test, "find returns the item with the key");
+            }
+        }
+    }
+    check(sameItems(tree.begin(), tree.end(), expected), test, "contents match std::map");
+}
+
+/**
+ * True if the subtree under node has correct AVL balances; sets height.
+ */
+template<typename Key, typename Value>
+static bool avlShape(const AVLNode<Key,Value>* node, int& height)
+{
+    if(node == NULL) {
+        height = 0;
+        return true;
+    }
+    int left = 0, right = 0;
+    bool ok = avlShape(node->getLeft(), left) && avlShape(node->getRight(), right);
+    height = std::max(left, right) + 1;
+    return ok && node->getBalance() == right - left && right - left >= -1 && right - left <= 1;
+}
+
+/**
+ * Like avlShape, but lets balances reach limit instead of 1.
+ */
+template<typename Key, typename Value>
+static bool relaxedShape(const AVLNode<Key,Value>* node, int limit, int& height)
+{
+    if(node == NULL) {
+        height = 0;
+        return true;
+    }
+    int left = 0, right = 0;
+    bool ok = relaxedShape(node->getLeft(), limit, left) && relaxedShape(node->getRight(), limit, right);
+    height = std::max(left, right) + 1;
+    return ok && node->getBalance() == right - left && right - left >= -limit && right - left <= limit;
+}
+
+/**
+ * Exposes the root of an AVL tree so tests can check its shape.
+ */
+template<typename Tree>
+class Inspected : public Tree
+{
+public:
+    using Tree::Tree;
+    bool isAVL() const
+    {
+        int height = 0;
+        return avlShape(static_cast<const AVLNode<int,int>*>(this->root_), height);
+    }
+    bool isRelaxedAVL(int limit) const
+    {
+        int height = 0;
+        return relaxedShape(static_cast<const AVLNode<int,int>*>(this->root_), limit, height);
+    }
+    int rootKey() const
+    {
+        return this->root_->getKey();
+    }
+};
+
+/**
+ * Every splay period, with and without semi-splaying, and clearing and
+ * destroying a tree that sequential inserts made a path.
+ */
+static void testSplay()
+{
+    for(unsigned int period = 1; period <= 3; period++) {
+        for(int semi = 0; semi < 2; semi++) {
+            SplayTree<int,int> tree(period, semi != 0);
+            std::map<int,int> expected;
+            randomOps(tree, expected, "splay", period * 2 + semi, 2000, 200);
+        }
+    }
+
+    // sequential inserts leave a path as deep as the tree is large
+    SplayTree<int,int> path;
+    for(int key = 0; key < 500000; key++) {
+        path.insert(std::make_pair(key, key));
+    }
+    path.clear();
+    check(path.empty(), "splay", "clearing a path of 500000 nodes");
+    for(int key = 0; key < 500000; key++) {
+        path.insert(std::make_pair(key, key));
+    }
+}
+
+/**
+ * The red-black rules must hold after every update, removes included.
+ */
+static void testRedBlack()
+{
+    RedBlackTree<int,int> tree;
+    std::map<int,int> expected;
+    for(int round = 0; round < 20; round++) {
+        randomOps(tree, expected, "red-black", round, 200, 100);
+        check(tree.isValidRedBlack(), "red-black", "tree is a valid red-black tree");
+    }
+}
+
+/**
+ * extract, insert(node_type&&) and merge, between trees with the same
+ * node type and between trees whose node types differ.
+ */
+static void testNodeHandles()
+{
+    AVLTree<int,int> hot, cold;
+    std::map<int,int> hotItems, coldItems;
+    for(int i = 0; i < 40; i++) {
+        hot.insert(std::make_pair(i, i));
+        hotItems[i] = i;
+        if(i % 3 == 0) {
+            cold.insert(std::make_pair(i, -i));
+            coldItems[i] = -i;
+        }
+    }
+    AVLTree<int,int>::node_type handle = hot.extract(7);
+    check(!handle.empty() && handle.key() == 7 && handle.mapped() == 7, "node handles", "extract returns the node");
+    check(cold.insert(std::move(handle)) && handle.empty(), "node handles", "insert takes a new key");
+    hotItems.erase(7);
+    coldItems[7] = 7;
+    handle = hot.extract(9);
+    check(!cold.insert(std::move(handle)) && !handle.empty(), "node handles", "insert leaves a duplicate key in the handle");
+    hotItems.erase(9);
+    cold.merge(hot);
+    for(std::map<int,int>::iterator it = hotItems.begin(); it != hotItems.end(); ) {
+        if(coldItems.insert(*it).second) {
+            hotItems.erase(it++);
+        }
+        else {
+            ++it;
+        }
+    }
+    check(sameItems(cold.begin(), cold.end(), coldItems), "node handles", "merge moves the new keys");
+    check(sameItems(hot.begin(), hot.end(), hotItems), "node handles", "merge leaves duplicate keys behind");
+
+    // nodes of another type are copied, so the target's bookkeeping holds
+    AVLTree<int,int> plain;
+    for(int i = 0; i < 10; i++) {
+        plain.insert(std::make_pair(i, i));
+    }
+    TombstoneAVLTree<int,int> lazy(1.0);
+    lazy.insert(std::make_pair(20, 20));
+    lazy.merge(plain);
+    lazy.insert(plain.extract(0));
+    AVLTree<int,int>::node_type extra = plain.extract(5);
+    check(plain.empty() && extra.empty(), "node handles", "merge empties a source of another node type");
+    lazy.remove(3);
+    check(lazy.size() == 10 && lazy.deadCount() == 1 && lazy.find(3) == lazy.end(), "node handles",
+          "copied nodes are counted by the tombstone tree");
+    AggregateAVLTree<int,int> sums;
+    AVLTree<int,int> source;
+    for(int i = 1; i <= 10; i++) {
+        source.insert(std::make_pair(i, i));
+    }
+    sums.insert(source.extract(10));
+    sums.merge(source);
+    check(sums.aggregate() == 55 && sums.aggregate(1, 5) == 10, "node handles", "copied nodes keep aggregates current");
+}
+
+/**
+ * erase(pos), erase(first, last) and erase_if against std::map, on AVL
+ * and plain trees.
+ */
+template<typename Tree>
+static void eraseOps(const char* test)
+{
+    std::mt19937 rng(29);
+    for(int round = 0; round < 50; round++) {
+        Tree tree;
+        std::map<int,int> expected;
+        for(int i = 0; i < 100; i++) {
+            int key = rng() % 150;
+            tree.insert(std::make_pair(key, i));
+            expected[key] = i;
+        }
+        int key = rng() % 150;
+        typename Tree::iterator pos = tree.find(key);
+        if(pos != tree.end()) {
+            typename Tree::iterator next = tree.erase(pos);
+            std::map<int,int>::iterator want = expected.erase(expected.find(key));
+            check(want == expected.end() ? next == tree.end() : (next != tree.end() && next->first == want->first),
+                  test, "erase(pos) returns the next item");
+        }
+        int lo = rng() % 150, hi = lo + rng() % 50;
+        typename Tree::iterator first = tree.begin();
+        while(first != tree.end() && first->first < lo) ++first;
+        typename Tree::iterator last = first;
+        while(last != tree.end() && last->first < hi) ++last;
+        tree.erase(first, last);
+        expected.erase(expected.lower_bound(lo), expected.lower_bound(hi));
+        int mod = 2 + rng() % 3;
+        size_t removed = tree.erase_if([mod](const std::pair<const int,int>& item) { return item.second % mod == 0; });
+        size_t expectedRemoved = 0;
+        for(std::map<int,int>::iterator it = expected.begin(); it != expected.end(); ) {
+            if(it->second % mod == 0) {
+                expected.erase(it++);
+                expectedRemoved++;
+            }
+            else {
+                ++it;
+            }
+        }
+        check(removed == expectedRemoved, test, "erase_if counts what it removed");
+        check(sameItems(tree.begin(), tree.end(), expected), test, "contents match std::map");
+    }
+}
+
+static void testErase()
+{
+    eraseOps<AVLTree<int,int> >("erase, AVL");
+    eraseOps<BinarySearchTree<int,int> >("erase, BST");
+}
+
+/**
+ * split and join between trees of the same node type, and refused
+ * between trees whose node types differ, leaving both trees alone.
+ */
+static void testSplitJoin()
+{
+    Inspected<AVLTree<int,int> > tree;
+    std::map<int,int> expected;
+    randomOps(tree, expected, "split/join", 33, 3000, 1000);
+    Inspected<AVLTree<int,int> > greater;
+    tree.split(500, greater);
+    std::map<int,int> greaterItems(expected.lower_bound(500), expected.end());
+    std::map<int,int> lesserItems(expected.begin(), expected.lower_bound(500));
+    check(sameItems(tree.begin(), tree.end(), lesserItems) && sameItems(greater.begin(), greater.end(), greaterItems) &&
+          tree.isAVL() && greater.isAVL(), "split/join", "split cuts the items at the key");
+    tree.join(greater);
+    check(sameItems(tree.begin(), tree.end(), expected) && greater.empty() && tree.isAVL(), "split/join", "join puts them back");
+
+    AVLTree<int,int> plain;
+    plain.insert(std::make_pair(2000, 1));
+    AVLMultiTree<int,int> multi;
+    multi.insert(std::make_pair(1, 1));
+    multi.insert(std::make_pair(1, 2));
+    TombstoneAVLTree<int,int> tombs(1.0);
+    for(int key = 0; key < 10; key++) {
+        tombs.insert(std::make_pair(key, key));
+    }
+    tombs.remove(7);
+    AggregateAVLTree<int,int> sums;
+    sums.insert(std::make_pair(3000, 5));
+
+    int refused = 0;
+    try {
+        multi.join(plain);
+    }
+    catch(std::invalid_argument&) {
+        refused++;
+    }
+    try {
+        tree.join(sums);
+    }
+    catch(std::invalid_argument&) {
+        refused++;
+    }
+    AVLTree<int,int> empty;
+    try {
+        tombs.split(5, empty);
+    }
+    catch(std::invalid_argument&) {
+        refused++;
+    }
+    AVLMultiTree<int,int> emptyMulti;
+    try {
+        tree.split(500, emptyMulti);
+    }
+    catch(std::invalid_argument&) {
+        refused++;
+    }
+    check(refused == 4, "split/join", "split and join refuse another node type");
+    check(multi.count(1) == 2 && plain.find(2000) != plain.end() && sums.find(3000) != sums.end() &&
+          tombs.size() == 9 && tombs.deadCount() == 1 && empty.empty() && emptyMulti.empty() &&
+          sameItems(tree.begin(), tree.end(), expected), "split/join", "a refused split or join leaves both trees alone");
+}
+
+/**
+ * A value whose copies start throwing once copiesLeft runs out, and
+ * which counts how many of it are alive.
+ */
+struct Fragile
+{
+    static std::atomic<int> copiesLeft;
+    static std::atomic<int> live;
+    int value;
+    Fragile(int v) : value(v) { live++; }
+    Fragile(const Fragile& other) : value(other.value)
+    {
+        if(--copiesLeft < 0) {
+            throw std::runtime_error("copy failed");
+        }
+        live++;
+    }
+    ~Fragile() { live--; }
+};
+std::atomic<int> Fragile::copiesLeft(1 << 30);
+std::atomic<int> Fragile::live(0);
+
+static std::ostream& operator<<(std::ostream& out, const Fragile& fragile)
+{
+    return out << fragile.value;
+}
+
+/**
+ * Copies are deep and keep the node type, moves leave the source empty
+ * swap exchanges contents, and a copy that throws
+ * part way frees what it made and leaves the target alone.
+ */
+static void testCopyMove()
+{
+    AVLTree<int,int> tree;
+    std::map<int,int> expected;
+    randomOps(tree, expected, "copy/move", 30, 500, 200);
+    AVLTree<int,int> copied(tree);
+    copied.insert(std::make_pair(1000, 1));
+    check(sameItems(tree.begin(), tree.end(), expected), "copy/move", "a copy does not share nodes");
+    AVLTree<int,int> assigned;
+    assigned.assign(tree, 4);
+    check(sameItems(assigned.begin(), assigned.end(), expected), "copy/move", "parallel assign copies every item");
+    AVLTree<int,int> moved(std::move(assigned));
+    check(assigned.empty() && sameItems(moved.begin(), moved.end(), expected), "copy/move", "move leaves the source empty");
+    AVLTree<int,int> other;
+    other.insert(std::make_pair(-1, -1));
+    other.swap(moved);
+    check(moved.begin()->first == -1 && sameItems(other.begin(), other.end(), expected), "copy/move", "swap exchanges contents");
+    moved = other;
+    other = std::move(copied);
+    check(sameItems(moved.begin(), moved.end(), expected) && other.find(1000) != other.end() && copied.empty(),
+          "copy/move", "assignment copies and moves");
+
+    RedBlackTree<int,int> colored;
+    std::map<int,int> coloredItems;
+    randomOps(colored, coloredItems, "copy/move", 31, 500, 200);
+    RedBlackTree<int,int> coloredCopy(colored);
+    coloredCopy.remove(coloredItems.begin()->first);
+    check(coloredCopy.isValidRedBlack() && sameItems(colored.begin(), colored.end(), coloredItems),
+          "copy/move", "copies keep the node type");
+
+    AVLTree<int,Fragile> fragile;
+    for(int key = 0; key < 20000; key++) {
+        fragile.insert(std::make_pair(key, Fragile(key)));
+    }
+    int before = Fragile::live;
+    for(int budget = 0; budget < 20000; budget += 2500) {
+        for(unsigned int threads = 1; threads <= 4; threads *= 2) {
+            AVLTree<int,Fragile> target;
+            target.insert(std::make_pair(-1, Fragile(-1)));
+            Fragile::copiesLeft = budget;
+            bool thrown = false;
+            try {
+                target.assign(fragile, threads);
+            }
+            catch(std::runtime_error&) {
+                thrown = true;
+            }
+            Fragile::copiesLeft = 1 << 30;
+            check(thrown && target.begin()->first == -1 && ++target.begin() == target.end(),
+                  "copy/move", "a throwing copy leaves the target alone");
+        }
+    }
+    check(Fragile::live == before, "copy/move", "a throwing copy frees every partial copy");
+}
+
+/**
+ * Range sums, minima and maxima against sums over std::map, after
+ * random inserts, removes, updates and upserts.
+ */
+static void testAggregates()
+{
+    AggregateAVLTree<int,int> sums;
+    AggregateAVLTree<int,int,MinMonoid<int> > mins;
+    AggregateAVLTree<int,int,MaxMonoid<int> > maxes;
+    std::map<int,int> expected;
+    std::mt19937 rng(31);
+    for(int i = 0; i < 3000; i++) {
+        int key = rng() % 300;
+        int value = rng() % 1000 - 500;
+        int op = rng() % 4;
+        if(op == 0) {
+            sums.insert(std::make_pair(key, value));
+            mins.insert(std::make_pair(key, value));
+            maxes.insert(std::make_pair(key, value));
+            expected[key] = value;
+        }
+        else if(op == 1) {
+            sums.remove(key);
+            mins.remove(key);
+            maxes.remove(key);
+            expected.erase(key);
+        }
+        else if(op == 2) {
+            sums.update(key, [value](int& v) { v = value; });
+            mins.update(key, [value](int& v) { v = value; });
+            maxes.update(key, [value](int& v) { v = value; });
+            if(expected.count(key)) {
+                expected[key] = value;
+            }
+        }
+        else {
+            sums.upsert(key, value, [](int& v) { v++; });
+            mins.upsert(key, value, [](int& v) { v++; });
+            maxes.upsert(key, value, [](int& v) { v++; });
+            if(expected.count(key)) {
+                expected[key]++;
+            }
+            else {
+                expected[key] = value;
+            }
+        }
+        int lo = rng() % 300, hi = lo + rng() % 100;
+        int sum = 0, least = std::numeric_limits<int>::max(), most = std::numeric_limits<int>::lowest();
+        for(std::map<int,int>::iterator it = expected.lower_bound(lo); it != expected.lower_bound(hi); ++it) {
+            sum += it->second;
+            least = std::min(least, it->second);
+            most = std::max(most, it->second);
+        }
+        check(sums.aggregate(lo, hi) == sum, "aggregates", "range sum");
+        check(mins.aggregate(lo, hi) == least, "aggregates", "range minimum");
+        check(maxes.aggregate(lo, hi) == most, "aggregates", "range maximum");
+    }
+    const AggregateAVLTree<int,int>& readOnly = sums;
+    check(expected.empty() || readOnly[expected.begin()->first] == expected.begin()->second,
+          "aggregates", "const operator[] reads values");
+}
+
+/**
+ * Stabbing, overlap and batched overlap queries against a brute-force
+ * scan, and rejection of intervals whose low is above their high.
+ */
+static void testIntervals()
+{
+    typedef std::pair<int,int> Interval;
+    IntervalTree<int,int> tree;
+    std::map<Interval,int> expected;
+    std::mt19937 rng(32);
+    for(int i = 0; i < 400; i++) {
+        int low = rng() % 1000;
+        Interval interval(low, low + rng() % 100);
+        if(rng() % 4 == 0) {
+            tree.remove(interval.first, interval.second);
+            expected.erase(interval);
+        }
+        else {
+            tree.insert(interval.first, interval.second, i);
+            expected[interval] = i;
+        }
+    }
+    std::vector<Interval> queries;
+    for(int i = 0; i < 100; i++) {
+        int low = rng() % 1100;
+        queries.push_back(Interval(low, low + rng() % 50));
+    }
+    std::vector<std::vector<Interval> > batchFound(queries.size());
+    tree.overlapsBatch(queries, [&batchFound](size_t index, const IntervalTree<int,int>::Item& item) {
+        batchFound[index].push_back(item.first);
+    });
+    for(size_t q = 0; q < queries.size(); q++) {
+        std::vector<Interval> want, found, stabbed, wantStabbed;
+        for(std::map<Interval,int>::iterator it = expected.begin(); it != expected.end(); ++it) {
+            if(!(it->first.second < queries[q].first) && !(queries[q].second < it->first.first)) {
+                want.push_back(it->first);
+            }
+            if(it->first.first <= queries[q].first && queries[q].first <= it->first.second) {
+                wantStabbed.push_back(it->first);
+            }
+        }
+        size_t count = tree.overlaps(queries[q].first, queries[q].second,
+            [&found](const IntervalTree<int,int>::Item& item) { found.push_back(item.first); });
+        tree.stab(queries[q].first, [&stabbed](const IntervalTree<int,int>::Item& item) { stabbed.push_back(item.first); });
+        check(found == want && count == want.size(), "intervals", "overlaps reports every overlapping interval in order");
+        check(stabbed == wantStabbed, "intervals", "stab reports every interval containing the point");
+        check(batchFound[q] == want, "intervals", "overlapsBatch answers each query");
+    }
+    bool rejected = false;
+    try {
+        tree.insert(5, 4, 0);
+    }
+    catch(std::invalid_argument&) {
+        rejected = true;
+    }
+    check(rejected, "intervals", "insert rejects low above high");
+    rejected = false;
+    try {
+        tree.upsert(Interval(9, 1), 0, [](int&) { });
+    }
+    catch(std::invalid_argument&) {
+        rejected = true;
+    }
+    check(rejected && tree.find(Interval(9, 1)) == tree.end(), "intervals", "upsert rejects low above high");
+}
+
+/**
+ * Sharded map against std::map with shards split, merged and rebalanced
+ * along the way, then writers racing a thread that keeps resharding.
+ */
+static void testSharded()
+{
+    std::vector<int> bounds;
+    bounds.push_back(250);
+    bounds.push_back(500);
+    ShardedAVLMap<int,int> sharded(bounds);
+    std::map<int,int> expected;
+    std::mt19937 rng(33);
+    for(int i = 0; i < 3000; i++) {
+        int key = rng() % 1000;
+        int op = rng() % 10;
+        if(op < 4) {
+            sharded.insert(std::make_pair(key, i));
+            expected[key] = i;
+        }
+        else if(op < 6) {
+            sharded.remove(key);
+            expected.erase(key);
+        }
+        else if(op < 9) {
+            int value = -1;
+            bool found = sharded.find(key, value);
+            check(found == (expected.count(key) == 1) && (!found || value == expected[key]),
+                  "sharded", "find matches std::map");
+        }
+        else if(rng() % 2 == 0) {
+            sharded.splitShard(rng() % sharded.shardCount());
+        }
+        else if(sharded.shardCount() > 1) {
+            sharded.mergeShards(rng() % (sharded.shardCount() - 1));
+        }
+    }
+    sharded.rebalanceShards(1.5);
+    std::map<int,int> visited;
+    bool ordered = true;
+    sharded.forEach([&visited, &ordered](const std::pair<const int,int>& item) {
+        ordered = ordered && (visited.empty() || visited.rbegin()->first < item.first);
+        visited.insert(item);
+    });
+    check(ordered && visited == expected, "sharded", "forEach visits every item in key order");
+
+    ShardedAVLMap<int,int> racing(bounds);
+    std::vector<std::thread> writers;
+    for(int t = 0; t < 4; t++) {
+        writers.push_back(std::thread([&racing, t]() {
+            for(int i = t; i < 4000; i += 4) {
+                racing.insert(std::make_pair(i, i));
+            }
+        }));
+    }
+    for(int i = 0; i < 50; i++) {
+        racing.splitShard(i % racing.shardCount());
+        if(racing.shardCount() > 2) {
+            racing.mergeShards(0);
+        }
+    }
+    for(size_t t = 0; t < writers.size(); t++) {
+        writers[t].join();
+    }
+    size_t count = 0;
+    racing.forEach([&count](const std::pair<const int,int>&) { count++; });
+    int value = 0;
+    check(count == 4000 && racing.find(3999, value), "sharded", "concurrent inserts survive resharding");
+}
+
+/**
+ * Parallel traversals against a sequential walk, with a string
+ * concatenation to catch pieces combined out of key order.
+ */
+static void testParallel()
+{
+    AVLTree<int,int> empty;
+    check(parallel_reduce(empty, 7, [](int sum, const std::pair<const int,int>& item) { return sum + item.second; },
+                          [](int a, int b) { return a + b; }, 4) == 7,
+          "parallel", "reducing an empty tree gives identity");
+
+    for(int round = 0; round < 3; round++) {
+        AVLTree<int,int> scanned;
+        std::map<int,int> expected;
+        std::mt19937 rng(34 + round);
+        for(int i = 0; i < 2000 * (round + 1); i++) {
+            int key = rng() % 100000;
+            scanned.insert(std::make_pair(key, key % 97));
+            expected[key] = key % 97;
+        }
+        long long sum = 0;
+        std::string digits;
+        for(std::map<int,int>::const_iterator it = expected.begin(); it != expected.end(); ++it) {
+            sum += it->second;
+            digits += char('0' + it->first % 10);
+        }
+
+        std::mutex lock;
+        std::map<int,int> visited;
+        parallel_for_each(scanned, [&lock, &visited](const std::pair<const int,int>& item) {
+            std::lock_guard<std::mutex> held(lock);
+            visited.insert(item);
+        }, 4);
+        check(visited == expected, "parallel", "parallel_for_each visits every item once");
+
+        long long parallelSum = parallel_reduce(scanned, 0LL,
+            [](long long total, const std::pair<const int,int>& item) { return total + item.second; },
+            [](long long a, long long b) { return a + b; }, 4);
+        check(parallelSum == sum, "parallel", "parallel_reduce matches a sequential sum");
+
+        std::string parallelDigits = parallel_transform_reduce(scanned, std::string(),
+            [](const std::string& a, const std::string& b) { return a + b; },
+            [](const std::pair<const int,int>& item) { return std::string(1, '0' + item.first % 10); }, 4);
+        check(parallelDigits == digits, "parallel", "parallel_transform_reduce keeps key order");
+    }
+}
+
+static std::atomic<int> epochFreed(0);
+
+static void countFree(void* object)
+{
+    delete static_cast<int*>(object);
+    epochFreed++;
+}
+
+/**
+ * Epoch reclamation: nothing retired is freed while another thread sits
+ * in a guard, everything is once it leaves, and an EpochAVLTree still
+ * agrees with std::map while its nodes go through the domain.
+ */
+static void testEpoch()
+{
+    EpochDomain domain(1000000, 1000000);
+    std::atomic<bool> entered(false);
+    std::atomic<bool> leave(false);
+    std::thread reader([&domain, &entered, &leave]() {
+        EpochDomain::Guard guard(domain);
+        entered = true;
+        while(!leave) {
+            std::this_thread::yield();
+        }
+    });
+    while(!entered) {
+        std::this_thread::yield();
+    }
+    for(int i = 0; i < 10; i++) {
+        domain.retire(new int(i), countFree);
+    }
+    for(int i = 0; i < 5; i++) {
+        domain.tryAdvance();
+    }
+    domain.collect();
+    check(epochFreed == 0 && domain.pending() == 10, "epoch", "a guard on another thread holds back reclamation");
+    leave = true;
+    reader.join();
+    for(int i = 0; i < 3; i++) {
+        domain.tryAdvance();
+    }
+    domain.collect();
+    check(epochFreed == 10 && domain.pending() == 0, "epoch", "retired objects are freed once the guard is gone");
+
+    EpochDomain treeDomain;
+    EpochAVLTree<int,int> retiring(treeDomain);
+    std::map<int,int> expected;
+    {
+        EpochDomain::Guard guard(treeDomain);
+        randomOps(retiring, expected, "epoch", 35, 3000, 300);
+    }
+    for(int i = 0; i < 3; i++) {
+        treeDomain.tryAdvance();
+    }
+    treeDomain.collect();
+    check(sameItems(retiring.begin(), retiring.end(), expected), "epoch", "tree matches std::map");
+    check(treeDomain.pending() == 0, "epoch", "removed nodes are freed after the guard");
+}
+
+/**
+ * Serialize round trips against std::map, the tree staying usable after
+ * loading, and bad streams rejected without touching the tree.
+ */
+static void testSerialize()
+{
+    for(int size = 0; size < 300; size += 37) {
+        AVLTree<int,int> saved;
+        std::map<int,int> expected;
+        std::mt19937 rng(36 + size);
+        for(int i = 0; i < size; i++) {
+            int key = rng() % 1000;
+            saved.insert(std::make_pair(key, i));
+            expected[key] = i;
+        }
+        std::stringstream stream;
+        saved.serialize(stream);
+        AVLTree<int,int> loaded;
+        loaded.insert(std::make_pair(-1, -1));
+        loaded.deserialize(stream);
+        check(sameItems(loaded.begin(), loaded.end(), expected), "serialize", "round trip matches std::map");
+        randomOps(loaded, expected, "serialize", size, 1000, 1000);
+    }
+
+    AVLTree<std::string,std::string> words;
+    std::map<std::string,std::string> expectedWords;
+    const char* names[] = { "pear", "", "apple", "fig", "a longer key that spills past one byte of length" };
+    for(int i = 0; i < 5; i++) {
+        words.insert(std::make_pair(std::string(names[i]), std::string(names[4 - i])));
+        expectedWords[names[i]] = names[4 - i];
+    }
+    std::stringstream wordStream;
+    words.serialize(wordStream);
+    AVLTree<std::string,std::string> loadedWords;
+    loadedWords.deserialize(wordStream);
+    check(sameItems(loadedWords.begin(), loadedWords.end(), expectedWords), "serialize", "string items round trip");
+
+    std::stringstream full;
+    words.serialize(full);
+    std::string bytes = full.str();
+    std::string bad[] = { std::string("XYZ\1\0", 5), std::string("BST\2\0", 5), bytes.substr(0, bytes.size() - 3) };
+    for(int i = 0; i < 3; i++) {
+        std::stringstream badStream(bad[i]);
+        bool threw = false;
+        try {
+            loadedWords.deserialize(badStream);
+        }
+        catch(const std::runtime_error&) {
+            threw = true;
+        }
+        check(threw, "serialize", "a bad stream throws");
+        check(sameItems(loadedWords.begin(), loadedWords.end(), expectedWords), "serialize", "a bad stream leaves the tree unchanged");
+    }
+
+    // well-formed items whose keys go down or repeat
+    std::string items[2];
+    for(int i = 0; i < 2; i++) {
+        AVLTree<int,int> single;
+        single.insert(std::make_pair(i == 0 ? 1 : 5, i));
+        std::stringstream one;
+        single.serialize(one);
+        items[i] = one.str().substr(5);
+    }
+    std::string unsorted[] = { std::string("BST\1\2", 5) + items[1] + items[0],
+                               std::string("BST\1\2", 5) + items[1] + items[1],
+                               std::string("BST\1\3", 5) + items[0] + items[1] + items[0] };
+    AVLTree<int,int> kept;
+    kept.insert(std::make_pair(7, 7));
+    for(int i = 0; i < 3; i++) {
+        std::stringstream badStream(unsorted[i]);
+        bool threw = false;
+        try {
+            kept.deserialize(badStream);
+        }
+        catch(const std::runtime_error&) {
+            threw = true;
+        }
+        check(threw && kept.find(7) != kept.end() && kept.find(5) == kept.end(), "serialize", "keys out of order throw");
+    }
+    std::stringstream sorted(std::string("BST\1\2", 5) + items[0] + items[1]);
+    kept.deserialize(sorted);
+    check(kept.find(1) != kept.end() && kept.find(5) != kept.end() && kept.find(7) == kept.end(), "serialize", "hand-built sorted stream loads");
+}
+
+/**
+ * A durable tree whose log can be pointed at /dev/full to make writes fail.
+ */
+class BrokenLogTree : public DurableAVLTree<int,int>
+{
+public:
+    BrokenLogTree(const std::string& path) : DurableAVLTree<int,int>(path) { }
+    void breakLog()
+    {
+        int full = ::open("/dev/full", O_WRONLY);
+        ::dup2(full, fd_);
+        ::close(full);
+    }
+};
+
+/**
+ * True if every key below keyRange is in tree exactly when it is in
+ * expected, with the same value.
+ */
+template<typename Tree>
+static bool sameLookups(const Tree& tree, const std::map<int,int>& expected, int keyRange)
+{
+    for(int key = 0; key < keyRange; key++) {
+        int value = -1;
+        bool found = tree.find(key, value);
+        std::map<int,int>::const_iterator want = expected.find(key);
+        if(found != (want != expected.end()) || (found && value != want->second)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void removeDurableFiles(const char* path)
+{
+    std::remove((std::string(path) + ".wal").c_str());
+    std::remove((std::string(path) + ".snapshot").c_str());
+}
+
+/**
+ * The write-ahead log: reopening replays it on top of the snapshot
+ * (including automatic checkpoints and a torn last record), concurrent
+ * writers all land, and a failed write fails the tree for good.
+ */
+static void testDurable()
+{
+    const char* path = "bst-test-durable";
+    removeDurableFiles(path);
+    std::map<int,int> expected;
+    {
+        DurableAVLTree<int,int> durable(path, 512);
+        std::mt19937 rng(37);
+        for(int i = 0; i < 600; i++) {
+            int key = rng() % 200;
+            if(rng() % 3 == 0) {
+                durable.remove(key);
+                expected.erase(key);
+            }
+            else {
+                durable.insert(std::make_pair(key, i));
+                expected[key] = i;
+            }
+            if(i == 300) {
+                durable.checkpoint();
+            }
+        }
+        check(sameLookups(durable, expected, 200), "durable", "tree matches std::map");
+    }
+    {
+        std::ofstream torn((std::string(path) + ".wal").c_str(), std::ios::binary | std::ios::app);
+        torn.write("\x09\x01\x02", 3);
+    }
+    {
+        DurableAVLTree<int,int> reopened(path);
+        check(sameLookups(reopened, expected, 200), "durable", "reopening replays the log over the snapshot");
+        reopened.insert(std::make_pair(500, 1));
+        expected[500] = 1;
+    }
+    {
+        DurableAVLTree<int,int> reopened(path);
+        check(sameLookups(reopened, expected, 501), "durable", "a torn record is cut off and the log stays usable");
+        std::vector<std::thread> writers;
+        for(int t = 0; t < 4; t++) {
+            writers.push_back(std::thread([&reopened, t]() {
+                for(int i = 0; i < 50; i++) {
+                    reopened.insert(std::make_pair(1000 + i * 4 + t, t));
+                }
+            }));
+        }
+        for(size_t t = 0; t < writers.size(); t++) {
+            writers[t].join();
+        }
+        for(int i = 0; i < 200; i++) {
+            expected[1000 + i] = i % 4;
+        }
+    }
+    {
+        BrokenLogTree broken(path);
+        check(sameLookups(broken, expected, 1200), "durable", "concurrent group commits all survive reopening");
+        broken.breakLog();
+        bool threw = false;
+        try {
+            broken.insert(std::make_pair(1, 1));
+        }
+        catch(const std::system_error&) {
+            threw = true;
+        }
+        check(threw, "durable", "a failed log write throws");
+        int failedCalls = 0;
+        try {
+            broken.remove(2);
+        }
+        catch(const std::runtime_error&) {
+            failedCalls++;
+        }
+        try {
+            broken.checkpoint();
+        }
+        catch(const std::runtime_error&) {
+            failedCalls++;
+        }
+        check(failedCalls == 2, "durable", "a failed tree refuses later writes and checkpoints");
+    }
+    {
+        DurableAVLTree<int,int> reopened(path);
+        check(sameLookups(reopened, expected, 1200), "durable", "reopening after a failure gets back what was durable");
+    }
+    removeDurableFiles(path);
+}
+
+/**
+ * update, upsert and operator[] against the same calls on a std::map,
+ * then further random updates to make sure the tree was built properly.
+ */
+template<typename Tree>
+static void updateOps(const char* test, unsigned int seed)
+{
+    Tree tree;
+    std::map<int,int> expected;
+    std::mt19937 rng(seed);
+    for(int i = 0; i < 3000; i++) {
+        int key = rng() % 300;
+        int op = rng() % 3;
+        if(op == 0) {
+            bool updated = tree.update(key, [i](int& value) { value = value * 2 + i; });
+            std::map<int,int>::iterator want = expected.find(key);
+            check(updated == (want != expected.end()), test, "update reports whether the key was there");
+            if(want != expected.end()) {
+                want->second = want->second * 2 + i;
+            }
+        }
+        else if(op == 1) {
+            bool created = tree.upsert(key, i, [](int& value) { value++; });
+            check(created == (expected.count(key) == 0), test, "upsert reports whether it inserted");
+            if(created) {
+                expected[key] = i;
+            }
+            else {
+                expected[key]++;
+            }
+        }
+        else {
+            tree[key] += 1;
+            expected[key] += 1;
+        }
+    }
+    check(sameItems(tree.begin(), tree.end(), expected), test, "contents match std::map");
+    randomOps(tree, expected, test, seed + 1, 2000, 300);
+}
+
+static void testUpdate()
+{
+    updateOps<BinarySearchTree<int,int> >("update bst", 38);
+    updateOps<AVLTree<int,int> >("update avl", 39);
+    updateOps<SplayTree<int,int> >("update splay", 40);
+    updateOps<RedBlackTree<int,int> >("update red-black", 41);
+}
+
+/**
+ * Applies random sorted batches, with repeated keys and removes, to tree
+ * and to a std::map, checking contents and balance after each one.
+ */
+template<typename Tree>
+static void batchOps(Tree& tree, std::map<int,int>& expected, const char* test, unsigned int seed,
+                     int batches, int batchSize, int keyRange, unsigned int threads)
+{
+    typedef typename Tree::mutation mutation;
+    std::mt19937 rng(seed);
+    for(int round = 0; round < batches; round++) {
+        std::vector<int> keys;
+        for(int i = 0; i < batchSize; i++) {
+            keys.push_back(rng() % keyRange);
+        }
+        std::sort(keys.begin(), keys.end());
+        std::vector<mutation> batch;
+        for(size_t i = 0; i < keys.size(); i++) {
+            if(rng() % 3 == 0) {
+                batch.push_back(mutation(keys[i]));
+                expected.erase(keys[i]);
+            }
+            else {
+                batch.push_back(mutation(keys[i], round * batchSize + int(i)));
+                expected[keys[i]] = round * batchSize + int(i);
+            }
+        }
+        tree.applySorted(batch.begin(), batch.end(), threads);
+        check(sameItems(tree.begin(), tree.end(), expected), test, "batch result matches std::map");
+        check(tree.isAVL(), test, "tree is balanced after a batch");
+    }
+}
+
+/**
+ * applySorted on one and several threads, on trees whose hooks allow
+ * helper threads and on ones whose hooks keep it on the calling thread.
+ */
+static void testApplySorted()
+{
+    for(unsigned int threads = 1; threads <= 4; threads *= 4) {
+        Inspected<AVLTree<int,int> > small;
+        std::map<int,int> expected;
+        batchOps(small, expected, "applySorted", 42 + threads, 50, 20, 200, threads);
+        Inspected<AVLTree<int,int> > large;
+        expected.clear();
+        batchOps(large, expected, "applySorted parallel", 43 + threads, 4, 40000, 200000, threads);
+        Inspected<RelaxedAVLTree<int,int> > relaxed;
+        expected.clear();
+        batchOps(relaxed, expected, "applySorted relaxed", 44 + threads, 3, 30000, 100000, threads);
+        Inspected<AppendAVLTree<int,int> > append;
+        expected.clear();
+        batchOps(append, expected, "applySorted append", 45 + threads, 3, 30000, 100000, threads);
+        append.pushBack(std::make_pair(1000000, 1));
+        expected[1000000] = 1;
+        check(sameItems(append.begin(), append.end(), expected), "applySorted append", "pushBack after a batch");
+        // a node type of its own keeps the batch on this thread by default
+        Inspected<AggregateAVLTree<int,int,MaxMonoid<int> > > maxes;
+        expected.clear();
+        batchOps(maxes, expected, "applySorted aggregate", 46 + threads, 3, 30000, 100000, threads);
+        int largest = std::numeric_limits<int>::min();
+        for(std::map<int,int>::iterator it = expected.begin(); it != expected.end(); ++it) {
+            largest = std::max(largest, it->second);
+        }
+        check(maxes.aggregate() == largest, "applySorted aggregate", "maxima hold after a batch");
+    }
+
+    AVLTree<int,int> unsorted;
+    std::vector<AVLTree<int,int>::mutation> batch;
+    batch.push_back(AVLTree<int,int>::mutation(2, 2));
+    batch.push_back(AVLTree<int,int>::mutation(1, 1));
+    bool threw = false;
+    try {
+        unsorted.applySorted(batch.begin(), batch.end());
+    }
+    catch(const std::invalid_argument&) {
+        threw = true;
+    }
+    check(threw && unsorted.empty(), "applySorted", "an unsorted batch throws and changes nothing");
+}
+
+/**
+ * Random inserts and removes through a filtered tree that has to grow
+ * several times. A Bloom filter may never answer no for a key that is
+ * there, removes included, and size must follow std::map.
+ */
+template<typename Tree>
+static void filteredOps(const char* test, unsigned int seed)
+{
+    FilteredTree<int,int,Tree> filtered(8);
+    std::map<int,int> expected;
+    std::mt19937 rng(seed);
+    for(int i = 0; i < 4000; i++) {
+        int key = rng() % 600;
+        if(rng() % 3 == 0) {
+            filtered.remove(key);
+            expected.erase(key);
+        }
+        else {
+            filtered.insert(std::make_pair(key, i));
+            expected[key] = i;
+        }
+        check(filtered.size() == expected.size(), test, "size follows std::map");
+    }
+    check(sameItems(filtered.begin(), filtered.end(), expected), test, "contents match std::map");
+    bool noFalseNegatives = true;
+    for(int key = 0; key < 600; key++) {
+        bool found = filtered.find(key) != filtered.end();
+        noFalseNegatives = noFalseNegatives && found == (expected.count(key) == 1);
+    }
+    check(noFalseNegatives, test, "every present key is found and no removed one is");
+    size_t skipped = filtered.shortCircuits();
+    for(int key = 1000; key < 2000; key++) {
+        filtered.find(key);
+    }
+    check(filtered.shortCircuits() - skipped > 900, test, "the filter answers most misses");
+    filtered.clear();
+    check(filtered.empty() && filtered.begin() == filtered.end(), test, "clear empties the tree");
+}
+
+static void testFiltered()
+{
+    filteredOps<AVLTree<int,int> >("filtered avl", 40);
+    filteredOps<BinarySearchTree<int,int> >("filtered bst", 41);
+}
+
+/**
+ * CompactAVLTree against std::map, with string values so slots are
+ * constructed and destroyed properly, and references that survive the
+ * arena growing.
+ */
+static void testCompact()
+{
+    CompactAVLTree<int,int> compact;
+    std::map<int,int> expected;
+    for(int round = 0; round < 10; round++) {
+        randomOps(compact, expected, "compact", 410 + round, 2000, 500);
+        check(compact.isBalanced(), "compact", "tree is balanced");
+        check(compact.size() == expected.size(), "compact", "size follows std::map");
+    }
+
+    CompactAVLTree<int,std::string> words;
+    std::map<int,std::string> expectedWords;
+    std::mt19937 rng(41);
+    for(int i = 0; i < 5000; i++) {
+        int key = rng() % 700;
+        if(rng() % 3 == 0) {
+            words.remove(key);
+            expectedWords.erase(key);
+        }
+        else {
+            std::string value(20 + key % 50, char('a' + key % 26));
+            words.insert(std::make_pair(key, value));
+            expectedWords[key] = value;
+        }
+    }
+    check(sameItems(words.begin(), words.end(), expectedWords), "compact", "string values match std::map");
+    words.clear();
+    check(words.empty() && words.begin() == words.end(), "compact", "clear empties the tree");
+
+    CompactAVLTree<int,int> growing;
+    growing.insert(std::make_pair(-1, 7));
+    int* pinned = &growing.find(-1)->second;
+    for(int i = 0; i < 200000; i++) {
+        growing.insert(std::make_pair(i, i));
+    }
+    check(&growing.find(-1)->second == pinned && *pinned == 7, "compact", "items do not move when the arena grows");
+}
+
+/**
+ * The top-down insert and remove on the orders that make the longest
+ * paths: sorted runs up and down, and removing everything from either
+ * end and from the middle out.
+ */
+static void testTopDown()
+{
+    const int n = 100000;
+    for(int order = 0; order < 3; order++) {
+        CompactAVLTree<int,int> tree;
+        for(int i = 0; i < n; i++) {
+            int key = order == 0 ? i : order == 1 ? n - 1 - i : (i % 2 == 0 ? i / 2 : n - 1 - i / 2);
+            tree.insert(std::make_pair(key, key));
+        }
+        check(tree.size() == size_t(n) && tree.isBalanced(), "top-down", "sorted inserts stay balanced");
+        int expectedKey = 0;
+        bool inOrder = true;
+        for(CompactAVLTree<int,int>::iterator it = tree.begin(); it != tree.end(); ++it) {
+            inOrder = inOrder && it->first == expectedKey && it->second == expectedKey;
+            expectedKey++;
+        }
+        check(inOrder && expectedKey == n, "top-down", "iteration visits every key in order");
+        bool balanced = true;
+        for(int i = 0; i < n; i++) {
+            int key = order == 0 ? i : order == 1 ? n - 1 - i : (i % 2 == 0 ? n / 2 + i / 2 : n / 2 - 1 - i / 2);
+            tree.remove(key);
+            if(i % 9973 == 0) {
+                balanced = balanced && tree.isBalanced() && tree.find(key) == tree.end();
+            }
+        }
+        check(balanced && tree.empty(), "top-down", "removing every key keeps balance and empties the tree");
+        tree.remove(5);
+        check(tree.empty(), "top-down", "removing from an empty tree does nothing");
+    }
+}
+
+/**
+ * RelaxedAVLTree for several slacks: balances stay exact and within
+ * 1 + slack between rebalances, and rebalancing all at once or one
+ * rotation at a time ends in a strict AVL tree with nothing pending.
+ */
+static void testRelaxed()
+{
+    for(unsigned int slack = 0; slack <= 3; slack++) {
+        Inspected<RelaxedAVLTree<int,int> > relaxed(slack);
+        std::map<int,int> expected;
+        std::mt19937 rng(43 + slack);
+        for(int round = 0; round < 20; round++) {
+            randomOps(relaxed, expected, "relaxed", rng(), 500, 400);
+            check(relaxed.isRelaxedAVL(1 + int(relaxed.slack())), "relaxed", "balances stay exact and within the slack");
+            check(relaxed.rebalance(rng() % 8) == relaxed.pending(), "relaxed", "rebalance returns the paths left");
+        }
+        if(slack % 2 == 0) {
+            relaxed.rebalance();
+        }
+        else {
+            for(int steps = 0; steps < 1000000 && relaxed.pending() != 0; steps++) {
+                relaxed.rebalance(1);
+            }
+        }
+        check(relaxed.pending() == 0 && relaxed.isAVL(), "relaxed", "rebalancing runs out of work and leaves a strict AVL tree");
+        AVLTree<int,int> greater;
+        relaxed.split(200, greater);
+        relaxed.join(greater);
+        check(sameItems(relaxed.begin(), relaxed.end(), expected) && relaxed.isAVL(), "relaxed", "split and join keep every item");
+    }
+}
+
+/**
+ * A tombstone tree that reports how many keys its graveyard holds.
+ */
+class GraveyardProbe : public Inspected<TombstoneAVLTree<int,int> >
+{
+public:
+    GraveyardProbe(double rebuildThreshold) : Inspected<TombstoneAVLTree<int,int> >(rebuildThreshold) { }
+    size_t queued() const { return graveyard_.size(); }
+};
+
+/**
+ * TombstoneAVLTree against std::map with compactions in between, and a
+ * graveyard that stays in proportion to the tombstones however often the
+ * same keys are removed, revived or extracted.
+ */
+static void testTombstones()
+{
+    for(int automatic = 0; automatic < 2; automatic++) {
+        GraveyardProbe lazy(automatic ? 0.5 : 1.0);
+        std::map<int,int> expected;
+        std::mt19937 rng(44 + automatic);
+        bool bounded = true;
+        for(int round = 0; round < 30; round++) {
+            randomOps(lazy, expected, "tombstones", rng(), 300, 200);
+            check(lazy.size() == expected.size(), "tombstones", "size counts live items");
+            lazy.compact(rng() % 20);
+            bounded = bounded && lazy.queued() <= 2 * lazy.deadCount() + 16;
+        }
+        check(bounded, "tombstones", "the graveyard stays in proportion to the tombstones");
+        check(lazy.compact(SIZE_MAX) == 0 && lazy.deadCount() == 0 && lazy.queued() == 0,
+              "tombstones", "compact can clear every tombstone");
+        check(sameItems(lazy.begin(), lazy.end(), expected) && lazy.isAVL(), "tombstones", "compacting keeps the live items");
+    }
+
+    GraveyardProbe churn(1.0);
+    churn.insert(std::make_pair(1, 1));
+    churn.insert(std::make_pair(2, 2));
+    for(int i = 0; i < 100000; i++) {
+        churn.remove(1);
+        churn.insert(std::make_pair(1, i));
+        churn.extract(2);
+        churn.insert(std::make_pair(2, i));
+        churn.remove(2);
+        churn.insert(std::make_pair(2, i));
+    }
+    check(churn.queued() <= 18, "tombstones", "removing and reviving the same keys does not grow the graveyard");
+    check(churn.size() == 2 && churn.find(1)->second == 99999 && churn.find(2)->second == 99999,
+          "tombstones", "revived keys hold their last value");
+    churn.remove(1);
+    churn.rebuild();
+    check(churn.deadCount() == 0 && churn.queued() == 0 && churn.size() == 1 && churn.isAVL(),
+          "tombstones", "rebuild drops every tombstone");
+}
+
+/**
+ * Fills a cached tree with keys in [lo, hi) and looks each up twice, so
+ * every one of them is sitting in the cache.
+ */
+static void warmCache(CachedAVLTree<int,int>& cached, int lo, int hi)
+{
+    for(int key = lo; key < hi; key++) {
+        cached.insert(std::make_pair(key, key));
+    }
+    for(int key = lo; key < hi; key++) {
+        cached.find(key);
+        cached.find(key);
+    }
+}
+
+/**
+ * CachedAVLTree against std::map with a cache small enough to collide,
+ * then every way of taking cached nodes away that another tree or a base
+ * class reference can start. A stale slot would return a node that is
+ * gone; the address sanitizer build also catches the read.
+ */
+static void testCache()
+{
+    CachedAVLTree<int,int> small(16);
+    std::map<int,int> expected;
+    for(int round = 0; round < 10; round++) {
+        randomOps(small, expected, "cache", 45 + round, 1000, 64);
+    }
+    check(small.hits() > 0 && small.cacheSlots() == 16, "cache", "repeated finds hit the cache");
+
+    CachedAVLTree<int,int> cached;
+    AVLTree<int,int> plain;
+    warmCache(cached, 0, 10);
+    plain.merge(cached);
+    plain.remove(3);
+    check(cached.find(3) == cached.end() && cached.empty(), "cache", "a plain tree merging the cached one");
+
+    warmCache(cached, 100, 110);
+    plain.join(cached);
+    plain.remove(105);
+    check(cached.find(105) == cached.end(), "cache", "a plain tree joining the cached one");
+
+    warmCache(cached, 200, 210);
+    AVLTree<int,int>& base = cached;
+    AVLTree<int,int> greater;
+    base.split(205, greater);
+    greater.remove(207);
+    check(cached.find(207) == cached.end() && cached.find(204) != cached.end(), "cache", "split through a base reference");
+    base.join(greater);
+
+    base.extract(208);
+    check(cached.find(208) == cached.end(), "cache", "extract through a base reference");
+
+    AVLTree<int,int> other;
+    other.insert(std::make_pair(1, 1));
+    base.swap(other);
+    other.remove(201);
+    check(cached.find(201) == cached.end() && cached.find(1) != cached.end(), "cache", "swap through a base reference");
+
+    warmCache(cached, 300, 20000);
+    std::vector<AVLTree<int,int>::mutation> batch;
+    for(int key = 300; key < 20000; key++) {
+        batch.push_back(key % 2 ? AVLTree<int,int>::mutation(key) : AVLTree<int,int>::mutation(key, -key));
+    }
+    cached.applySorted(batch.begin(), batch.end(), 4);
+    check(cached.find(301) == cached.end() && cached.find(302) != cached.end() && cached.find(302)->second == -302,
+          "cache", "a batch on several threads");
+
+    const CachedAVLTree<int,int>& reader = cached;
+    size_t hits = cached.hits();
+    size_t misses = cached.misses();
+    std::atomic<int> found(0);
+    std::vector<std::thread> readers;
+    for(int t = 0; t < 4; t++) {
+        readers.push_back(std::thread([&]() {
+            for(int key = 300; key < 20000; key++) {
+                if(reader.find(key) != reader.end()) {
+                    found++;
+                }
+            }
+        }));
+    }
+    for(size_t t = 0; t < readers.size(); t++) {
+        readers[t].join();
+    }
+    check(found == 4 * (20000 - 300) / 2 && cached.hits() == hits && cached.misses() == misses,
+          "cache", "readers through a const reference leave the cache alone");
+}
+
+/**
+ * Looks up random keys, present and missing, through findEach in groups
+ * of every size up to 9, and checks each is reported once with what
+ * std::map has for it.
+ */
+template<typename Tree>
+static void lookupOps(Tree& tree, const std::map<int,int>& expected, const char* test, unsigned int seed, int keyRange)
+{
+    std::mt19937 rng(seed);
+    bool right = true;
+    for(unsigned int group = 0; group <= 9; group++) {
+        std::vector<int> keys;
+        for(int i = 0; i < 500; i++) {
+            keys.push_back(rng() % keyRange);
+        }
+        std::map<int,int> reported;
+        tree.findEach(keys.begin(), keys.end(), [&](const int& key, typename Tree::iterator it) {
+            reported[key]++;
+            std::map<int,int>::const_iterator want = expected.find(key);
+            if(want == expected.end() ? it != tree.end() : it == tree.end() || it->first != key || it->second != want->second) {
+                right = false;
+            }
+        }, group);
+        std::map<int,int> asked;
+        for(size_t i = 0; i < keys.size(); i++) {
+            asked[keys[i]]++;
+        }
+        right = right && reported == asked;
+    }
+    check(right, test, "findEach reports every key with its item, or end()");
+}
+
+/**
+ * findEach on plain, tombstoned, splayed and cached trees.
+ */
+static void testFindEach()
+{
+    AVLTree<int,int> plain;
+    std::map<int,int> expected;
+    randomOps(plain, expected, "findEach", 48, 5000, 2000);
+    lookupOps(plain, expected, "findEach", 480, 2000);
+
+    TombstoneAVLTree<int,int> tombs(1.0);
+    expected.clear();
+    randomOps(tombs, expected, "findEach tombstones", 481, 5000, 2000);
+    check(tombs.deadCount() > 0, "findEach tombstones", "the tree holds dead keys");
+    lookupOps(tombs, expected, "findEach tombstones", 482, 2000);
+
+    Inspected<SplayTree<int,int> > splay;
+    expected.clear();
+    randomOps(splay, expected, "findEach splay", 483, 5000, 2000);
+    lookupOps(splay, expected, "findEach splay", 484, 2000);
+    int present = expected.begin()->first;
+    splay.findEach(&present, &present + 1, [](const int&, SplayTree<int,int>::iterator) { });
+    check(splay.rootKey() == present, "findEach splay", "a found key is splayed to the root");
+
+    CachedAVLTree<int,int> cached(4096);
+    expected.clear();
+    randomOps(cached, expected, "findEach cache", 485, 5000, 2000);
+    size_t hits = cached.hits();
+    size_t misses = cached.misses();
+    lookupOps(cached, expected, "findEach cache", 486, 2000);
+    check(cached.misses() > misses, "findEach cache", "misses are counted");
+    check(cached.hits() > hits, "findEach cache", "keys found once hit the cache the next time");
+    lookupOps(cached, expected, "findEach cache", 486, 2000);
+    for(std::map<int,int>::iterator it = expected.begin(); it != expected.end(); ++it) {
+        cached.remove(it->first);
+    }
+    expected.clear();
+    lookupOps(cached, expected, "findEach cache", 487, 2000);
+}
+
+/**
+ * Whether a multi tree holds exactly the items of a std::multimap, in
+ * the same order.
+ */
+static bool sameMulti(const AVLMultiTree<int,int>& tree, const std::multimap<int,int>& expected)
+{
+    return std::distance(tree.begin(), tree.end()) == (std::ptrdiff_t)expected.size() &&
+           std::equal(tree.begin(), tree.end(), expected.begin());
+}
+
+/**
+ * AVLMultiTree against std::multimap: inserts of repeated keys, erasing
+ * single items anywhere in a key's range, removing whole keys, update,
+ * upsert, merge and serialization.
+ */
+static void testMulti()
+{
+    Inspected<AVLMultiTree<int,int> > tree;
+    std::multimap<int,int> expected;
+    std::mt19937 rng(49);
+    bool counts = true;
+    for(int i = 0; i < 20000; i++) {
+        int key = rng() % 300;
+        int op = rng() % 10;
+        if(op < 6) {
+            tree.insert(std::make_pair(key, i));
+            expected.insert(std::make_pair(key, i));
+        }
+        else if(op < 9) {
+            size_t n = tree.count(key);
+            if(n > 0) {
+                size_t skip = rng() % n;
+                AVLMultiTree<int,int>::iterator it = tree.find(key);
+                std::multimap<int,int>::iterator want = expected.find(key);
+                for(size_t j = 0; j < skip; j++) {
+                    ++it;
+                    ++want;
+                }
+                AVLMultiTree<int,int>::iterator next = tree.erase(it);
+                std::multimap<int,int>::iterator wantNext = expected.erase(want);
+                counts = counts && (next == tree.end() ? wantNext == expected.end() : *next == *wantNext);
+            }
+        }
+        else {
+            tree.remove(key);
+            expected.erase(key);
+        }
+        counts = counts && tree.count(key) == expected.count(key);
+    }
+    check(counts, "multi", "count and erase(pos) agree with std::multimap");
+    check(sameMulti(tree, expected) && tree.isAVL(), "multi", "random inserts and erases keep every item in order");
+
+    std::pair<AVLMultiTree<int,int>::iterator, AVLMultiTree<int,int>::iterator> range = tree.equal_range(expected.begin()->first);
+    check(std::distance(range.first, range.second) == (std::ptrdiff_t)expected.count(expected.begin()->first) &&
+          tree.equal_range(-1).first == tree.end(), "multi", "equal_range");
+
+    int key = expected.begin()->first;
+    tree.update(key, [](int& value) { value = -value; });
+    for(std::multimap<int,int>::iterator it = expected.lower_bound(key); it != expected.upper_bound(key); ++it) {
+        it->second = -it->second;
+    }
+    check(tree.upsert(-5, 7, [](int& value) { value++; }) && !tree.upsert(-5, 0, [](int& value) { value++; }), "multi", "upsert reports new keys");
+    expected.insert(std::make_pair(-5, 8));
+    check(sameMulti(tree, expected), "multi", "update and upsert change every value of a key");
+
+    AVLMultiTree<int,int> other;
+    AVLTree<int,int> plain;
+    for(int i = 0; i < 400; i += 3) {
+        other.insert(std::make_pair(i, 1000 + i));
+        other.insert(std::make_pair(i, 2000 + i));
+        plain.insert(std::make_pair(i + 1, 3000 + i));
+    }
+    std::multimap<int,int> merged(expected);
+    for(AVLMultiTree<int,int>::iterator it = other.begin(); it != other.end(); ++it) {
+        merged.insert(*it);
+    }
+    for(AVLTree<int,int>::iterator it = plain.begin(); it != plain.end(); ++it) {
+        merged.insert(*it);
+    }
+    tree.merge(other);
+    tree.merge(plain);
+    check(sameMulti(tree, merged) && tree.isAVL() && other.empty() && plain.empty(), "multi", "merge keeps every value of both trees");
+
+    std::stringstream stream;
+    tree.serialize(stream);
+    AVLMultiTree<int,int> restored;
+    restored.deserialize(stream);
+    check(sameMulti(restored, merged), "multi", "serialize round trip keeps duplicates");
+    std::stringstream again;
+    tree.serialize(again);
+    bool refused = false;
+    try {
+        plain.deserialize(again);
+    }
+    catch(std::runtime_error&) {
+        refused = true;
+    }
+    check(refused && plain.empty(), "multi", "a tree without duplicates refuses the stream");
+
+    AVLMultiTree<std::string,std::string> strings;
+    strings.insert(std::make_pair(std::string("a"), std::string("x")));
+    strings.insert(std::make_pair(std::string("a"), std::string("y")));
+    check(strings.begin()->second == "x" && (++strings.begin())->second == "y" && strings.count("a") == 2, "multi", "operator-> and operator*");
+
+    {
+        AVLMultiTree<int,Fragile> fragile;
+        for(int i = 0; i < 12; i++) {
+            fragile.insert(std::make_pair(1, Fragile(i)));
+        }
+        AVLMultiTree<int,Fragile>::iterator it = fragile.find(1);
+        std::advance(it, 5);
+        it = fragile.erase(fragile.erase(it));
+        bool order = it->second.value == 7 && fragile.count(1) == 10;
+        it = fragile.begin();
+        for(int i = 0; i < 12; i++) {
+            if(i != 5 && i != 6) {
+                order = order && it->second.value == i;
+                ++it;
+            }
+        }
+        check(order && it == fragile.end(), "multi", "values without a default constructor spill past the node and keep their order");
+        Fragile::copiesLeft = 6;
+        bool thrown = false;
+        try {
+            AVLMultiTree<int,Fragile> copy(fragile);
+        }
+        catch(std::runtime_error&) {
+            thrown = true;
+        }
+        Fragile::copiesLeft = 1 << 30;
+        check(thrown && Fragile::live == 10, "multi", "a copy that throws part way through a key frees its values");
+    }
+    check(Fragile::live == 0, "multi", "every inline and spilled value is destroyed with the tree");
+}
+
+/**
+ * Fills an append tree with keys lo, lo + step, ... below hi through
+ * pushBack, and expected with the same items.
+ */
+static void pushRange(AppendAVLTree<int,int>& tree, std::map<int,int>& expected, int lo, int hi, int step)
+{
+    for(int key = lo; key < hi; key += step) {
+        tree.pushBack(std::make_pair(key, -key));
+        expected[key] = -key;
+    }
+}
+
+/**
+ * AppendAVLTree against std::map: appends mixed with random updates,
+ * refused out of order appends, and appends after other trees and base
+ * class references took its nodes away.
+ */
+static void testAppend()
+{
+    Inspected<AppendAVLTree<int,int> > series;
+    std::map<int,int> expected;
+    for(int round = 0; round < 20; round++) {
+        pushRange(series, expected, round * 1000, round * 1000 + 500, 1);
+        randomOps(series, expected, "append", 50 + round, 300, (round + 1) * 1000);
+    }
+    check(series.isAVL(), "append", "appends mixed with random updates stay balanced");
+
+    bool refused = false;
+    try {
+        series.pushBack(std::make_pair(expected.begin()->first, 0));
+    }
+    catch(std::invalid_argument&) {
+        refused = true;
+    }
+    check(refused && sameItems(series.begin(), series.end(), expected), "append", "out of order pushBack is refused");
+
+    AVLTree<int,int> plain;
+    plain.merge(series);
+    expected.clear();
+    pushRange(series, expected, 0, 100, 1);
+    check(sameItems(series.begin(), series.end(), expected) && series.isAVL(), "append", "appends after a plain tree merged this one");
+
+    plain.clear();
+    plain.insert(std::make_pair(-1, 1));
+    plain.join(series);
+    expected.clear();
+    pushRange(series, expected, 0, 100, 1);
+    check(sameItems(series.begin(), series.end(), expected) && series.isAVL(), "append", "appends after a plain tree joined this one");
+
+    AVLTree<int,int>& base = series;
+    base.extract(99);
+    base.erase(base.find(90), base.end());
+    expected.erase(expected.find(90), expected.end());
+    pushRange(series, expected, 95, 98, 1);
+    check(sameItems(series.begin(), series.end(), expected) && series.isAVL(), "append", "appends after extract and erase through a base reference");
+
+    AVLTree<int,int> greater;
+    base.split(50, greater);
+    expected.erase(expected.find(50), expected.end());
+    pushRange(series, expected, 60, 70, 1);
+    check(sameItems(series.begin(), series.end(), expected) && series.isAVL(), "append", "appends after a split through a base reference");
+
+    std::vector<AVLTree<int,int>::mutation> batch;
+    for(int key = 0; key < 20000; key++) {
+        batch.push_back(AVLTree<int,int>::mutation(key, key));
+        expected[key] = key;
+    }
+    base.applySorted(batch.begin(), batch.end(), 4);
+    refused = false;
+    try {
+        series.pushBack(std::make_pair(19999, 0));
+    }
+    catch(std::invalid_argument&) {
+        refused = true;
+    }
+    pushRange(series, expected, 20000, 20010, 1);
+    check(refused && sameItems(series.begin(), series.end(), expected) && series.isAVL(), "append", "appends after a batch on several threads");
+}
+
+/**
+ * HugePageArena with and without huge pages: blocks are aligned and
+ * distinct, heap blocks are handed back one by one, regions all at once,
+ * and a CompactAVLTree on either arena matches std::map and gives its
+ * memory back on clear.
+ */
+static void testArena()
+{
+    for(int huge = 0; huge < 2; huge++) {
+        HugePageArena arena(huge != 0, 1 << 20);
+        std::vector<char*> blocks;
+        bool aligned = true;
+        for(int i = 0; i < 1000; i++) {
+            char* block = static_cast<char*>(arena.allocate(100));
+            aligned = aligned && reinterpret_cast<uintptr_t>(block) % HugePageArena::ALIGN == 0;
+            std::fill(block, block + 100, char(i));
+            blocks.push_back(block);
+        }
+        bool intact = true;
+        for(size_t i = 0; i < blocks.size(); i++) {
+            intact = intact && blocks[i][0] == char(i) && blocks[i][99] == char(i);
+        }
+        check(aligned && intact, "arena", "blocks are aligned and do not overlap");
+        check(arena.reserved() >= 1000 * 128, "arena", "reserved covers every block");
+        for(size_t i = 0; i < blocks.size(); i++) {
+            arena.deallocate(blocks[i], 100);
+        }
+        if(!huge) {
+            check(arena.reserved() == 0, "arena", "heap blocks are freed one by one");
+        }
+        arena.release();
+        check(arena.reserved() == 0, "arena", "release gives every region back");
+
+        CompactAVLTree<int,int> compact(huge != 0);
+        std::map<int,int> expected;
+        randomOps(compact, expected, "arena", 46 + huge, 200000, 100000);
+        check(compact.isBalanced() && compact.memoryUsage() > 0, "arena", "a compact tree on the arena");
+        compact.clear();
+        check(compact.memoryUsage() == 0 && compact.empty(), "arena", "clear gives the arena's memory back");
+        compact.insert(std::make_pair(1, 1));
+        check(compact.find(1) != compact.end() && compact.size() == 1, "arena", "the tree is usable after clear");
+    }
+}
+
+/**
+ * A compact tree that lists the arena slots of its nodes, in key order
+ * and in breadth-first order.
+ */
+class LayoutProbe : public CompactAVLTree<int,int>
+{
+public:
+    std::vector<index_type> inOrder() const
+    {
+        std::vector<index_type> slots;
+        walk(root_, slots);
+        return slots;
+    }
+    std::vector<index_type> breadthFirst() const
+    {
+        std::vector<index_type> slots;
+        if(root_ != 0) {
+            slots.push_back(root_);
+        }
+        for(size_t i = 0; i < slots.size(); i++) {
+            if(node(slots[i]).left != 0) slots.push_back(node(slots[i]).left);
+            if(right(slots[i]) != 0) slots.push_back(right(slots[i]));
+        }
+        return slots;
+    }
+private:
+    void walk(index_type index, std::vector<index_type>& slots) const
+    {
+        if(index != 0) {
+            walk(node(index).left, slots);
+            slots.push_back(index);
+            walk(right(index), slots);
+        }
+    }
+};
+
+/**
+ * True if slots holds exactly 1 to slots.size(), in that order if sorted
+ * is set and in any order otherwise.
+ */
+static bool packedSlots(std::vector<uint32_t> slots, bool sorted)
+{
+    if(!sorted) {
+        std::sort(slots.begin(), slots.end());
+    }
+    for(size_t i = 0; i < slots.size(); i++) {
+        if(slots[i] != i + 1) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * relayout in every order leaves the nodes packed in that order, and
+ * defragment, spread out between updates, keeps the tree intact and ends
+ * with the nodes in key order.
+ */
+static void testLayout()
+{
+    LayoutProbe tree;
+    std::map<int,int> expected;
+    randomOps(tree, expected, "layout", 47, 20000, 5000);
+
+    tree.relayout(LayoutProbe::IN_ORDER);
+    check(packedSlots(tree.inOrder(), true), "layout", "in-order relayout packs nodes in key order");
+    tree.relayout(LayoutProbe::BREADTH_FIRST);
+    check(packedSlots(tree.breadthFirst(), true), "layout", "breadth-first relayout packs nodes level by level");
+    tree.relayout(LayoutProbe::VAN_EMDE_BOAS);
+    check(packedSlots(tree.inOrder(), false) && tree.breadthFirst()[0] == 1, "layout", "van Emde Boas relayout packs nodes, root first");
+    check(sameItems(tree.begin(), tree.end(), expected) && tree.isBalanced(), "layout", "relayout keeps every item");
+
+    std::mt19937 rng(470);
+    for(int round = 0; round < 200; round++) {
+        tree.defragment(rng() % 50);
+        int key = rng() % 5000;
+        if(rng() % 2) {
+            tree.insert(std::make_pair(key, round));
+            expected[key] = round;
+        }
+        else {
+            tree.remove(key);
+            expected.erase(key);
+        }
+    }
+    check(sameItems(tree.begin(), tree.end(), expected) && tree.isBalanced(), "layout", "defragment between updates keeps every item");
+    // finish the pass the updates interrupted, then make a clean one
+    while(tree.defragment(64)) { }
+    while(tree.defragment(64)) { }
+    std::vector<uint32_t> slots = tree.inOrder();
+    check(std::is_sorted(slots.begin(), slots.end()), "layout", "a full defragment pass leaves nodes in key order");
+}
 
 int main(int argc, char *argv[])
 {
@@ -44,5 +1862,37 @@ int main(int argc, char *argv[])
     cout << "Erasing b" << endl;
     at.remove('b');
 
+    testSplay();
+    testRedBlack();
+    testNodeHandles();
+    testSplitJoin();
+    testErase();
+    testCopyMove();
+    testAggregates();
+    testIntervals();
+    testSharded();
+    testParallel();
+    testEpoch();
+    testSerialize();
+    testDurable();
+    testUpdate();
+    testApplySorted();
+    testFiltered();
+    testCompact();
+    testTopDown();
+    testRelaxed();
+    testTombstones();
+    testCache();
+    testArena();
+    testLayout();
+    testFindEach();
+    testMulti();
+    testAppend();
+
+    if(failures > 0) {
+        cout << "\n" << failures << " checks FAILED" << endl;
+        return 1;
+    }
+    cout << "\nAll checks passed" << endl;
     return 0;
 }
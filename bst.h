@@ -6,6 +6,10 @@
 #include <cstdlib>
 #include <utility>
 #include<cmath>
+#include <thread>
+#include <future>
+#include <vector>
+#include "serialize.h"
 
 /**
  * A templated class for a Node in a search tree.
@@ -30,6 +34,7 @@ public:
     virtual Node<Key, Value>* getParent() const;
     virtual Node<Key, Value>* getLeft() const;
     virtual Node<Key, Value>* getRight() const;
+    virtual Node<Key, Value>* clone() const;
 
     void setParent(Node<Key, Value>* parent);
     void setLeft(Node<Key, Value>* left);
@@ -145,6 +150,16 @@ Node<Key, Value>* Node<Key, Value>::getRight() const
     return right_;
 }
 
+/**
+* Returns a detached copy of this node's item. Derived nodes override
+* this to carry over their bookkeeping so a tree can be copied as is.
+*/
+template<typename Key, typename Value>
+Node<Key, Value>* Node<Key, Value>::clone() const
+{
+    return new Node<Key, Value>(item_.first, item_.second, NULL);
+}
+
 /**
 * A setter for setting the parent of a node.
 */
@@ -195,7 +210,15 @@ class BinarySearchTree
 {
 public:
     BinarySearchTree(); //TODO
+    BinarySearchTree(const BinarySearchTree<Key, Value>& other);
+    BinarySearchTree(BinarySearchTree<Key, Value>&& other);
     virtual ~BinarySearchTree(); //TODO
+    BinarySearchTree<Key, Value>& operator=(const BinarySearchTree<Key, Value>& other);
+    BinarySearchTree<Key, Value>& operator=(BinarySearchTree<Key, Value>&& other);
+    void swap(BinarySearchTree<Key, Value>& other);
+    void assign(const BinarySearchTree<Key, Value>& other, unsigned int threads);
+    void serialize(std::ostream& out) const;
+    void deserialize(std::istream& in);
     virtual void insert(const std::pair<const Key, Value>& keyValuePair); //TODO
     virtual void remove(const Key& key); //TODO
     void clear(); //TODO
@@ -228,16 +251,53 @@ public:
         Node<Key, Value> *current_;
     };
 
+    /**
+    * A contiguous, in-order slice of the tree that can be cut at subtree
+    * roots. A range over a whole subtree splits into its left subtree,
+    * the root on its own and its right subtree, so repeated splits hand
+    * out disjoint pieces that are as balanced as the tree itself.
+    */
+    class range_type
+    {
+    public:
+        range_type();
+
+        iterator begin() const;
+        iterator end() const;
+        bool empty() const;
+        bool divisible() const;
+        void split(range_type& left, range_type& middle, range_type& right) const;
+
+    protected:
+        friend class BinarySearchTree<Key, Value>;
+        range_type(Node<Key, Value>* root, Node<Key, Value>* first, Node<Key, Value>* last);
+        Node<Key, Value>* root_;
+        Node<Key, Value>* first_;
+        Node<Key, Value>* last_;
+    };
+
 public:
     iterator begin() const;
     iterator end() const;
+    range_type range() const;
     iterator find(const Key& key) const;
+    template<typename KeyIterator, typename Function>
+    void findEach(KeyIterator first, KeyIterator last, Function fn, unsigned int group = 8) const;
+    iterator erase(iterator pos);
+    virtual iterator erase(iterator first, iterator last);
+    template<typename Predicate>
+    size_t erase_if(Predicate pred);
+    template<typename Function>
+    bool update(const Key& key, Function fn);
+    template<typename Function>
+    bool upsert(const Key& key, const Value& init, Function fn);
     Value& operator[](const Key& key);
     Value const & operator[](const Key& key) const;
 
 protected:
     // Mandatory helper functions
     Node<Key, Value>* internalFind(const Key& k) const; // TODO
+    static void prefetchNode(const Node<Key, Value>* node);
     Node<Key, Value> *getSmallestNode() const;  // TODO
     static Node<Key, Value>* predecessor(Node<Key, Value>* current); // TODO
     // Note:  static means these functions don't have a "this" pointer
@@ -246,10 +306,23 @@ protected:
     // Provided helper functions
     virtual void printRoot (Node<Key, Value> *r) const;
     virtual void nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2) ;
+    virtual void removeNode(Node<Key, Value>* target);
+    virtual Node<Key, Value>* findOrCreate(const Key& key, const Value& init, bool& created);
+    virtual void valueChanged(Node<Key, Value>* node);
+    virtual void nodesMoved();
+    void rotateLeft(Node<Key, Value>* parent);
+    void rotateRight(Node<Key, Value>* parent);
 
     // Add helper functions here
     static Node<Key, Value>* successor(Node<Key, Value>* current);
-    void clearHelper(Node<Key, Value>* node);
+    static Node<Key, Value>* iteratorNode(const iterator& it);
+    static iterator nodeIterator(Node<Key, Value>* node);
+    static void clearHelper(Node<Key, Value>* node);
+    static Node<Key, Value>* cloneTree(const Node<Key, Value>* node);
+    static Node<Key, Value>* cloneTree(const Node<Key, Value>* node, unsigned int threads);
+    Node<Key, Value>* buildTree(std::istream& in, std::string& buffer, uint64_t size, const Key*& previous);
+    virtual Node<Key, Value>* buildNode(const Key& key, const Value& value,
+        Node<Key, Value>* left, uint64_t leftSize, Node<Key, Value>* right, uint64_t rightSize);
     int pathLength(Node<Key, Value>* node) const; 
 
 protected:
@@ -344,6 +417,25 @@ BinarySearchTree<Key, Value>::iterator::operator++()
     return *this;
 }
 
+/**
+* Lets derived trees get at the node behind an iterator, since
+* only BinarySearchTree is a friend of the iterator class.
+*/
+template<class Key, class Value>
+Node<Key, Value>* BinarySearchTree<Key, Value>::iteratorNode(const iterator& it)
+{
+    return it.current_;
+}
+
+/**
+* The other way round: an iterator at a node a derived tree found itself.
+*/
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator BinarySearchTree<Key, Value>::nodeIterator(Node<Key, Value>* node)
+{
+    return iterator(node);
+}
+
 template<class Key, class Value>
 Node<Key, Value>* BinarySearchTree<Key, Value>::successor(Node<Key, Value>* current)
 { 
@@ -375,6 +467,76 @@ End implementations for the BinarySearchTree::iterator class.
 -------------------------------------------------------------
 */
 
+/**
+* root is the subtree the range covers, or NULL if the range is a single
+* node that cannot be split any further. Iteration runs from first up to
+* (not including) last.
+*/
+template<class Key, class Value>
+BinarySearchTree<Key, Value>::range_type::range_type(Node<Key, Value>* root, Node<Key, Value>* first, Node<Key, Value>* last) :
+    root_(root), first_(first), last_(last)
+{
+
+}
+
+template<class Key, class Value>
+BinarySearchTree<Key, Value>::range_type::range_type() :
+    root_(NULL), first_(NULL), last_(NULL)
+{
+
+}
+
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::range_type::begin() const
+{
+    return iterator(first_);
+}
+
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::range_type::end() const
+{
+    return iterator(last_);
+}
+
+template<class Key, class Value>
+bool BinarySearchTree<Key, Value>::range_type::empty() const
+{
+    return first_ == last_;
+}
+
+/**
+* A range can be split if it covers a subtree with more than one node.
+*/
+template<class Key, class Value>
+bool BinarySearchTree<Key, Value>::range_type::divisible() const
+{
+    return root_ != NULL && (root_->getLeft() != NULL || root_->getRight() != NULL);
+}
+
+/**
+* Cuts a divisible range at its subtree root. left and right cover the
+* root's subtrees (either may be empty) and middle holds just the root.
+* Together they visit exactly the items of this range, in order.
+*/
+template<class Key, class Value>
+void BinarySearchTree<Key, Value>::range_type::split(range_type& left, range_type& middle, range_type& right) const
+{
+    Node<Key, Value>* rightFirst = last_;
+    if(root_->getRight() != NULL)
+    {
+        rightFirst = root_->getRight();
+        while(rightFirst->getLeft() != NULL)
+        {
+            rightFirst = rightFirst->getLeft();
+        }
+    }
+    left = range_type(root_->getLeft(), first_, root_);
+    middle = range_type(NULL, root_, rightFirst);
+    right = range_type(root_->getRight(), rightFirst, last_);
+}
+
 /*
 -----------------------------------------------------
 Begin implementations for the BinarySearchTree class.
@@ -390,12 +552,88 @@ BinarySearchTree<Key, Value>::BinarySearchTree()
     root_ = NULL; 
 }
 
+/**
+* Copy constructor. Clones the other tree's shape node for node
+* (including any balance information) instead of re-inserting.
+*/
+template<class Key, class Value>
+BinarySearchTree<Key, Value>::BinarySearchTree(const BinarySearchTree<Key, Value>& other)
+{
+    root_ = cloneTree(other.root_);
+}
+
+/**
+* Move constructor, which steals the other tree's nodes in O(1).
+*/
+template<class Key, class Value>
+BinarySearchTree<Key, Value>::BinarySearchTree(BinarySearchTree<Key, Value>&& other)
+{
+    root_ = other.root_;
+    other.root_ = NULL;
+    other.nodesMoved();
+}
+
 template<typename Key, typename Value>
 BinarySearchTree<Key, Value>::~BinarySearchTree()
 {
     clearHelper(root_);
 }
 
+template<class Key, class Value>
+BinarySearchTree<Key, Value>&
+BinarySearchTree<Key, Value>::operator=(const BinarySearchTree<Key, Value>& other)
+{
+    if (this != &other)
+    {
+        Node<Key, Value>* copy = cloneTree(other.root_);
+        clear();
+        root_ = copy;
+    }
+    return *this;
+}
+
+template<class Key, class Value>
+BinarySearchTree<Key, Value>&
+BinarySearchTree<Key, Value>::operator=(BinarySearchTree<Key, Value>&& other)
+{
+    if (this != &other)
+    {
+        clear();
+        root_ = other.root_;
+        other.root_ = NULL;
+        other.nodesMoved();
+    }
+    return *this;
+}
+
+/**
+* Exchanges the contents of two trees in O(1).
+*/
+template<class Key, class Value>
+void BinarySearchTree<Key, Value>::swap(BinarySearchTree<Key, Value>& other)
+{
+    Node<Key, Value>* temp = root_;
+    root_ = other.root_;
+    other.root_ = temp;
+    nodesMoved();
+    other.nodesMoved();
+}
+
+/**
+* Replaces the contents with a copy of other, cloning disjoint
+* subtrees on up to the given number of threads.
+*/
+template<class Key, class Value>
+void BinarySearchTree<Key, Value>::assign(const BinarySearchTree<Key, Value>& other, unsigned int threads)
+{
+    if (this != &other)
+    {
+        Node<Key, Value>* copy = cloneTree(other.root_, threads);
+        clear();
+        root_ = copy;
+    }
+}
+
 /**
  * Returns true if tree is empty
 */
@@ -423,6 +661,16 @@ BinarySearchTree<Key, Value>::begin() const
     return begin;
 }
 
+/**
+* Returns a splittable range over the whole tree.
+*/
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::range_type
+BinarySearchTree<Key, Value>::range() const
+{
+    return range_type(root_, getSmallestNode(), NULL);
+}
+
 /**
 * Returns an iterator whose value means INVALID
 */
@@ -448,15 +696,171 @@ BinarySearchTree<Key, Value>::find(const Key & k) const
 }
 
 /**
- * @precondition The key exists in the map
- * Returns the value associated with the key
+ * Looks up every key in [first, last) and calls fn(key, iterator) for
+ * each, with the end iterator for keys that are not in the tree. Up to
+ * group searches are in flight at once: each takes one step down the
+ * tree, prefetches the child it moved to and yields to the next, so the
+ * cache misses of different searches overlap instead of queueing up.
+ * Results arrive in the order the searches finish, not in input order.
+ * The tree is not changed; SplayTree, TombstoneAVLTree and CachedAVLTree
+ * redefine this to splay, skip dead keys and use the cache as find does.
+ */
+template<class Key, class Value>
+template<typename KeyIterator, typename Function>
+void BinarySearchTree<Key, Value>::findEach(KeyIterator first, KeyIterator last, Function fn, unsigned int group) const
+{
+    struct Search
+    {
+        Node<Key, Value>* node;
+        KeyIterator key;
+    };
+    if(group == 0)
+    {
+        group = 1;
+    }
+    std::vector<Search> searches;
+    searches.reserve(group);
+    while(first != last && searches.size() < group)
+    {
+        Search search = { root_, first++ };
+        prefetchNode(search.node);
+        searches.push_back(search);
+    }
+    size_t i = 0;
+    while(!searches.empty())
+    {
+        if(i >= searches.size())
+        {
+            i = 0;
+        }
+        Search& search = searches[i];
+        Node<Key, Value>* node = search.node;
+        const Key& key = *search.key;
+        if(node != NULL && !(node->getKey() == key))
+        {
+            search.node = key < node->getKey() ? node->getLeft() : node->getRight();
+            prefetchNode(search.node);
+            i++;
+            continue;
+        }
+        // finished: report it and start the next key in its place
+        fn(key, iterator(node));
+        if(first != last)
+        {
+            search.node = root_;
+            search.key = first++;
+            prefetchNode(search.node);
+            i++;
+        }
+        else
+        {
+            search = searches.back();
+            searches.pop_back();
+        }
+    }
+}
+
+/**
+ * Returns the value associated with the key, inserting a default
+ * constructed value first if the key is not in the map (like std::map).
  */
 template<class Key, class Value>
 Value& BinarySearchTree<Key, Value>::operator[](const Key& key)
+{
+    bool created = false;
+    return findOrCreate(key, Value(), created)->getValue();
+}
+
+/**
+ * Calls fn(value) on the value stored under key, in place, and returns
+ * true; returns false if the key is not in the map.
+ */
+template<class Key, class Value>
+template<typename Function>
+bool BinarySearchTree<Key, Value>::update(const Key& key, Function fn)
 {
     Node<Key, Value> *curr = internalFind(key);
-    if(curr == NULL) throw std::out_of_range("Invalid key");
-    return curr->getValue();
+    if(curr == NULL) return false;
+    fn(curr->getValue());
+    valueChanged(curr);
+    return true;
+}
+
+/**
+ * Inserts init under key if the key is new, otherwise calls fn(value) on
+ * the stored value. Either way the tree is searched only once. Returns
+ * true if a new item was inserted.
+ */
+template<class Key, class Value>
+template<typename Function>
+bool BinarySearchTree<Key, Value>::upsert(const Key& key, const Value& init, Function fn)
+{
+    bool created = false;
+    Node<Key, Value> *curr = findOrCreate(key, init, created);
+    if(!created)
+    {
+        fn(curr->getValue());
+        valueChanged(curr);
+    }
+    return created;
+}
+
+/**
+ * Returns the node holding key, or links a new node holding init where
+ * the search ended. Balanced trees override this to create their own
+ * node type and rebalance, which they only need to do when created is set.
+ */
+template<class Key, class Value>
+Node<Key, Value>* BinarySearchTree<Key, Value>::findOrCreate(const Key& key, const Value& init, bool& created)
+{
+    Node<Key, Value>* parent = NULL;
+    Node<Key, Value>* current = root_;
+    while (current != NULL)
+    {
+        if (key < current->getKey())
+        {
+            parent = current;
+            current = current->getLeft();
+        }
+        else if (current->getKey() < key)
+        {
+            parent = current;
+            current = current->getRight();
+        }
+        else
+        {
+            created = false;
+            return current;
+        }
+    }
+    current = new Node<Key, Value>(key, init, parent);
+    if (parent == NULL) root_ = current;
+    else if (key < parent->getKey()) parent->setLeft(current);
+    else parent->setRight(current);
+    created = true;
+    return current;
+}
+
+/**
+ * Called after a value was changed in place through update or upsert.
+ * Does nothing here; trees that keep data derived from values override it.
+ */
+template<class Key, class Value>
+void BinarySearchTree<Key, Value>::valueChanged(Node<Key, Value>*)
+{
+
+}
+
+/**
+ * Called after nodes were freed, built or handed between trees
+ * wholesale (clear, assignment, swap, split, join, batches), bypassing
+ * the per-node hooks. Does nothing here; trees that remember individual
+ * nodes override it to forget them.
+ */
+template<class Key, class Value>
+void BinarySearchTree<Key, Value>::nodesMoved()
+{
+
 }
 template<class Key, class Value>
 Value const & BinarySearchTree<Key, Value>::operator[](const Key& key) const
@@ -536,6 +940,16 @@ void BinarySearchTree<Key, Value>::remove(const Key& key)
     {
         return;
     }
+    removeNode(target);
+}
+
+/**
+* Unlinks and frees a node that is known to be in the tree.
+* Derived trees override this to keep their balance information.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::removeNode(Node<Key, Value>* target)
+{
     if (target->getLeft() && target->getRight())
     {
         Node<Key, Value>* pred = predecessor(target);
@@ -597,6 +1011,72 @@ BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
     return NULL;
 }
 
+/**
+* Removes the item at pos without looking its key up again and
+* returns an iterator to the item that followed it.
+*/
+template<typename Key, typename Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::erase(iterator pos)
+{
+    if (pos.current_ == NULL)
+    {
+        return end();
+    }
+    // nodeSwap moves nodes rather than items, so the successor survives the removal
+    Node<Key, Value>* next = successor(pos.current_);
+    removeNode(pos.current_);
+    return iterator(next);
+}
+
+/**
+* Removes every item in [first, last) and returns last.
+*/
+template<typename Key, typename Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::erase(iterator first, iterator last)
+{
+    while (first != last)
+    {
+        first = erase(first);
+    }
+    return last;
+}
+
+/**
+* Removes every item for which pred(item) is true and returns how many
+* were removed. Runs of adjacent matches are handed to erase(first, last)
+* so balanced trees can drop them in one batch.
+*/
+template<typename Key, typename Value>
+template<typename Predicate>
+size_t BinarySearchTree<Key, Value>::erase_if(Predicate pred)
+{
+    size_t removed = 0;
+    iterator it = begin();
+    while (it != end())
+    {
+        iterator runStart = it;
+        size_t runLength = 0;
+        while (it != end() && pred(*it))
+        {
+            ++it;
+            runLength++;
+        }
+        if (runLength > 0)
+        {
+            it = (runLength == 1) ? erase(runStart) : erase(runStart, it);
+            removed += runLength;
+        }
+        // it is now either end() or an item that already failed pred
+        if (it != end())
+        {
+            ++it;
+        }
+    }
+    return removed;
+}
+
 /**
 * A method to remove all contents of the tree and
 * reset the values in the tree for use again.
@@ -606,6 +1086,7 @@ void BinarySearchTree<Key, Value>::clear()
 {
     clearHelper(root_);
     root_ = NULL; 
+    nodesMoved();
 }
 
 
@@ -617,6 +1098,10 @@ Node<Key, Value>*
 BinarySearchTree<Key, Value>::getSmallestNode() const
 {
     Node<Key, Value>* finder = root_;
+    if (finder == NULL)
+    {
+        return NULL;
+    }
     while (finder->getLeft() != NULL)
     {
         finder = finder->getLeft();
@@ -651,6 +1136,20 @@ Node<Key, Value>* BinarySearchTree<Key, Value>::internalFind(const Key& key) con
   return NULL;
 }
 
+/**
+ * Hints that node is about to be read, so it is on its way into the cache
+ * while other work goes on.
+ */
+template<class Key, class Value>
+void BinarySearchTree<Key, Value>::prefetchNode(const Node<Key, Value>* node)
+{
+#if defined(__GNUC__)
+    __builtin_prefetch(node);
+#else
+    (void)node;
+#endif
+}
+
 /**
  * Return true iff the BST is balanced.
  */
@@ -699,16 +1198,262 @@ int BinarySearchTree<Key, Value>::pathLength(Node<Key, Value>* node) const
 template<typename Key, typename Value>
 void BinarySearchTree<Key, Value>::clearHelper(Node<Key, Value>* node)
 {
-    if (node != NULL)
+    // rotate left children up until there are none, so no stack is
+    // needed however deep the tree is (a splay tree can be a path)
+    while (node != NULL)
     {
-        clearHelper(node->getLeft());
-        clearHelper(node->getRight()); 
-        delete node; 
+        Node<Key, Value>* left = node->getLeft();
+        if (left != NULL)
+        {
+            node->setLeft(left->getRight());
+            left->setRight(node);
+            node = left;
+        }
+        else
+        {
+            Node<Key, Value>* right = node->getRight();
+            delete node;
+            node = right;
+        }
     }
-    else 
+}
+
+/**
+* Copies the subtree rooted at node in a single iterative pass, walking
+* the source and the copy in lock step through their parent pointers.
+*/
+template<typename Key, typename Value>
+Node<Key, Value>* BinarySearchTree<Key, Value>::cloneTree(const Node<Key, Value>* node)
+{
+    if (node == NULL)
     {
-        return; 
+        return NULL;
+    }
+    Node<Key, Value>* copyRoot = node->clone();
+    const Node<Key, Value>* source = node;
+    Node<Key, Value>* copy = copyRoot;
+    try
+    {
+        while (source != NULL)
+        {
+            if (source->getLeft() != NULL && copy->getLeft() == NULL)
+            {
+                copy->setLeft(source->getLeft()->clone());
+                copy->getLeft()->setParent(copy);
+                source = source->getLeft();
+                copy = copy->getLeft();
+            }
+            else if (source->getRight() != NULL && copy->getRight() == NULL)
+            {
+                copy->setRight(source->getRight()->clone());
+                copy->getRight()->setParent(copy);
+                source = source->getRight();
+                copy = copy->getRight();
+            }
+            else if (source == node)
+            {
+                break;
+            }
+            else
+            {
+                source = source->getParent();
+                copy = copy->getParent();
+            }
+        }
+    }
+    catch (...)
+    {
+        // a throwing clone leaves the copy so far consistent, so free it
+        clearHelper(copyRoot);
+        throw;
     }
+    return copyRoot;
+}
+
+/**
+* Clones the two subtrees of node on separate threads until the
+* thread budget runs out, then falls back to the iterative copy. If
+* either half throws, the other is waited for and every partial copy is
+* freed before the exception is passed on.
+*/
+template<typename Key, typename Value>
+Node<Key, Value>* BinarySearchTree<Key, Value>::cloneTree(const Node<Key, Value>* node, unsigned int threads)
+{
+    if (node == NULL || threads <= 1)
+    {
+        return cloneTree(node);
+    }
+    Node<Key, Value>* copy = node->clone();
+    Node<Key, Value>* leftCopy = NULL;
+    Node<Key, Value>* rightCopy = NULL;
+    try
+    {
+        std::future<Node<Key, Value>*> left = std::async(std::launch::async, [node, threads]() {
+            return cloneTree(node->getLeft(), threads / 2);
+        });
+        try
+        {
+            rightCopy = cloneTree(node->getRight(), threads - threads / 2);
+        }
+        catch (...)
+        {
+            try
+            {
+                clearHelper(left.get());
+            }
+            catch (...)
+            {
+            }
+            throw;
+        }
+        leftCopy = left.get();
+    }
+    catch (...)
+    {
+        clearHelper(rightCopy);
+        delete copy;
+        throw;
+    }
+
+    copy->setLeft(leftCopy);
+    copy->setRight(rightCopy);
+    if (leftCopy != NULL) leftCopy->setParent(copy);
+    if (rightCopy != NULL) rightCopy->setParent(copy);
+    return copy;
+}
+
+/**
+* Writes the tree as a versioned binary stream: a magic string, the
+* format version and the item count, then every key and value in key
+* order, each behind a varint length. Only one item is encoded at a time.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::serialize(std::ostream& out) const
+{
+    uint64_t count = 0;
+    for (iterator it = begin(); it != end(); ++it)
+    {
+        count++;
+    }
+    std::string buffer("BST", 3);
+    buffer += static_cast<char>(1);
+    writeVarint(buffer, count);
+
+    std::string item;
+    for (iterator it = begin(); it != end(); ++it)
+    {
+        item.clear();
+        SerializeTraits<Key>::write(item, it->first);
+        writeVarint(buffer, item.size());
+        buffer += item;
+        item.clear();
+        SerializeTraits<Value>::write(item, it->second);
+        writeVarint(buffer, item.size());
+        buffer += item;
+        if (buffer.size() >= 65536)
+        {
+            out.write(buffer.data(), buffer.size());
+            buffer.clear();
+        }
+    }
+    out.write(buffer.data(), buffer.size());
+    if (!out)
+    {
+        throw std::runtime_error("failed to write tree stream");
+    }
+}
+
+/**
+* Replaces the contents of the tree with a stream written by serialize.
+* Since the keys arrive sorted, the tree is built bottom-up in O(n) with
+* only O(log n) items held at once. On a bad stream, including one whose
+* keys are not strictly increasing, this throws and leaves the tree
+* unchanged.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::deserialize(std::istream& in)
+{
+    char header[4];
+    uint64_t count = 0;
+    if (!in.read(header, 4) || std::string(header, 3) != "BST")
+    {
+        throw std::runtime_error("not a tree stream");
+    }
+    if (header[3] != 1)
+    {
+        throw std::runtime_error("unsupported tree stream version");
+    }
+    if (!readVarint(in, count))
+    {
+        throw std::runtime_error("truncated tree stream");
+    }
+    std::string buffer;
+    const Key* previous = NULL;
+    Node<Key, Value>* built = buildTree(in, buffer, count, previous);
+    clear();
+    root_ = built;
+}
+
+/**
+* Builds a subtree from the next size items of the stream, with the
+* middle item at the root so both sides differ in size by at most one.
+* previous points at the last key read, which each new key must exceed.
+*/
+template<typename Key, typename Value>
+Node<Key, Value>* BinarySearchTree<Key, Value>::buildTree(std::istream& in, std::string& buffer, uint64_t size,
+                                                          const Key*& previous)
+{
+    if (size == 0)
+    {
+        return NULL;
+    }
+    uint64_t leftSize = (size - 1) / 2;
+    uint64_t rightSize = size - 1 - leftSize;
+    Node<Key, Value>* left = buildTree(in, buffer, leftSize, previous);
+    Node<Key, Value>* right = NULL;
+    try
+    {
+        Key key;
+        Value value;
+        readItem(in, buffer, key);
+        readItem(in, buffer, value);
+        if (previous != NULL && !(*previous < key))
+        {
+            throw std::runtime_error("tree stream keys are not increasing");
+        }
+        previous = &key;
+        right = buildTree(in, buffer, rightSize, previous);
+        Node<Key, Value>* node = buildNode(key, value, left, leftSize, right, rightSize);
+        // key goes out of scope; the node holds its own copy
+        if (previous == &key)
+        {
+            previous = &node->getKey();
+        }
+        return node;
+    }
+    catch (...)
+    {
+        clearHelper(left);
+        clearHelper(right);
+        throw;
+    }
+}
+
+/**
+* Creates a node for buildTree and links its already built children.
+* Trees with their own node type override this; the subtree sizes let
+* them set up their balance information.
+*/
+template<typename Key, typename Value>
+Node<Key, Value>* BinarySearchTree<Key, Value>::buildNode(const Key& key, const Value& value,
+    Node<Key, Value>* left, uint64_t, Node<Key, Value>* right, uint64_t)
+{
+    Node<Key, Value>* node = new Node<Key, Value>(key, value, NULL);
+    node->setLeft(left);
+    node->setRight(right);
+    if (left != NULL) left->setParent(node);
+    if (right != NULL) right->setParent(node);
+    return node;
 }
 
 template<typename Key, typename Value>
@@ -795,6 +1540,69 @@ void BinarySearchTree<Key, Value>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value
 
 }
 
+/**
+* Rotates the right child of parent up into parent's place. Only links are
+* changed, so derived trees fix up their own bookkeeping (balance, color, ...).
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::rotateLeft(Node<Key, Value>* parent)
+{
+    Node<Key, Value>* current = parent->getRight();
+    Node<Key, Value>* grandParent = parent->getParent();
+    if(grandParent == NULL)
+    {
+        root_ = current;
+    }
+    else if(grandParent->getLeft() == parent)
+    {
+        grandParent->setLeft(current);
+    }
+    else
+    {
+        grandParent->setRight(current);
+    }
+    parent->setRight(current->getLeft());
+    if(current->getLeft() != NULL)
+    {
+        current->getLeft()->setParent(parent);
+    }
+    parent->setParent(current);
+
+    current->setParent(grandParent);
+    current->setLeft(parent);
+}
+
+/**
+* Mirror image of rotateLeft.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::rotateRight(Node<Key, Value>* parent)
+{
+    Node<Key, Value>* current = parent->getLeft();
+    Node<Key, Value>* grandParent = parent->getParent();
+    if(grandParent == NULL)
+    {
+        root_ = current;
+    }
+    else if(grandParent->getLeft() == parent)
+    {
+        grandParent->setLeft(current);
+    }
+    else
+    {
+        grandParent->setRight(current);
+    }
+    parent->setLeft(current->getRight());
+    if(current->getRight() != NULL)
+    {
+        current->getRight()->setParent(parent);
+    }
+    parent->setParent(current);
+
+    current->setParent(grandParent);
+    current->setRight(parent);
+}
+
 /**
  * Lastly, we are providing you with a print function,
    BinarySearchTree::printRoot().
@@ -806,6 +1614,15 @@ void BinarySearchTree<Key, Value>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value
    We hope it will make debugging easier!
   */
 
+/**
+* Non-member swap so that std algorithms pick up the O(1) version.
+*/
+template<typename Key, typename Value>
+void swap(BinarySearchTree<Key, Value>& a, BinarySearchTree<Key, Value>& b)
+{
+    a.swap(b);
+}
+
 // include print function (in its own file because it's fairly long)
 #include "print_bst.h"
 
@@ -0,0 +1,272 @@
+#ifndef CACHEDAVL_H
+#define CACHEDAVL_H
+
+#include <iostream>
+#include <exception>
+#include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <utility>
+#include <functional>
+#include "avlbst.h"
+#include "hashmix.h"
+
+/**
+* An AVLTree with a small direct-mapped cache in front of find: the hash
+* of a key picks one slot, which remembers the node last found through
+* it. A hit costs one hash and one key comparison instead of a descent,
+* which pays off when lookups keep returning to a few thousand hot keys.
+*
+* Slots hold node pointers, so a node leaves the cache when it is
+* unlinked or destroyed, and everything that hands nodes to another tree
+* or frees them wholesale (clear, assignment, swap, split, join, batches,
+* deserialize) empties the cache by moving to a new generation. Both go
+* through the base class hooks, so this holds whichever tree starts the
+* operation and whether it is called through a base class reference.
+* Slots stay valid across nodeSwap and rotations, since those move nodes
+* rather than the items inside them.
+*
+* A lookup through the cache writes to it, so find and findEach use it
+* only on a non-const tree, which is not safe for concurrent readers.
+* Threads that share a tree for reading should go through a const
+* reference, where find and findEach search the tree as usual.
+*/
+template <class Key, class Value, class Hash = std::hash<Key> >
+class CachedAVLTree : public AVLTree<Key, Value>
+{
+public:
+    CachedAVLTree(size_t cacheSlots = 4096);
+    CachedAVLTree(const CachedAVLTree<Key, Value, Hash>& other);
+    CachedAVLTree(CachedAVLTree<Key, Value, Hash>&& other);
+    CachedAVLTree<Key, Value, Hash>& operator=(const CachedAVLTree<Key, Value, Hash>& other);
+    CachedAVLTree<Key, Value, Hash>& operator=(CachedAVLTree<Key, Value, Hash>&& other);
+
+    // Non-const since a lookup fills the cache; the const forms search
+    // the tree without touching it.
+    using BinarySearchTree<Key, Value>::find;
+    typename BinarySearchTree<Key, Value>::iterator find(const Key& key);
+    using BinarySearchTree<Key, Value>::findEach;
+    template<typename KeyIterator, typename Function>
+    void findEach(KeyIterator first, KeyIterator last, Function fn, unsigned int group = 8);
+
+    size_t hits() const;
+    size_t misses() const;
+    size_t cacheSlots() const;
+    void invalidate();
+
+protected:
+    struct Slot
+    {
+        Slot() : node(nullptr), generation(0) { }
+        Node<Key, Value>* node;
+        uint32_t generation;
+    };
+
+    virtual void unlinkNode(AVLNode<Key, Value>* node);
+    virtual void destroyNode(AVLNode<Key, Value>* node);
+    virtual void nodesMoved();
+
+    Slot& slotOf(const Key& key);
+    void forget(Node<Key, Value>* node);
+
+    std::vector<Slot> slots_;
+    uint32_t generation_;
+    Hash hash_;
+    size_t hits_;
+    size_t misses_;
+};
+
+/**
+* cacheSlots is rounded up to a power of two.
+*/
+template<class Key, class Value, class Hash>
+CachedAVLTree<Key, Value, Hash>::CachedAVLTree(size_t cacheSlots) :
+    generation_(1), hits_(0), misses_(0)
+{
+    size_t size = 1;
+    while(size < cacheSlots)
+    {
+      size <<= 1;
+    }
+    slots_.resize(size);
+}
+
+/*
+ * Copies and moves start with an empty cache of the same size; the moved
+ * from tree empties its own through nodesMoved.
+ */
+template<class Key, class Value, class Hash>
+CachedAVLTree<Key, Value, Hash>::CachedAVLTree(const CachedAVLTree<Key, Value, Hash>& other) :
+    AVLTree<Key, Value>(other), slots_(other.slots_.size()), generation_(1), hash_(other.hash_), hits_(0), misses_(0)
+{
+
+}
+
+template<class Key, class Value, class Hash>
+CachedAVLTree<Key, Value, Hash>::CachedAVLTree(CachedAVLTree<Key, Value, Hash>&& other) :
+    AVLTree<Key, Value>(std::move(other)), slots_(other.slots_.size()), generation_(1), hash_(other.hash_), hits_(0), misses_(0)
+{
+
+}
+
+/*
+ * Assignment keeps this tree's slots; the other tree's point at nodes this
+ * one does not own. The base class empties both caches through nodesMoved.
+ */
+template<class Key, class Value, class Hash>
+CachedAVLTree<Key, Value, Hash>& CachedAVLTree<Key, Value, Hash>::operator=(const CachedAVLTree<Key, Value, Hash>& other)
+{
+    AVLTree<Key, Value>::operator=(other);
+    return *this;
+}
+
+template<class Key, class Value, class Hash>
+CachedAVLTree<Key, Value, Hash>& CachedAVLTree<Key, Value, Hash>::operator=(CachedAVLTree<Key, Value, Hash>&& other)
+{
+    AVLTree<Key, Value>::operator=(std::move(other));
+    return *this;
+}
+
+/**
+* Checks the key's slot first and only descends the tree on a miss,
+* after which the slot remembers the node found. Keys that are not in
+* the tree are not cached.
+*/
+template<class Key, class Value, class Hash>
+typename BinarySearchTree<Key, Value>::iterator CachedAVLTree<Key, Value, Hash>::find(const Key& key)
+{
+    Slot& slot = slotOf(key);
+    if(slot.generation == generation_ && slot.node != nullptr && slot.node->getKey() == key)
+    {
+      hits_++;
+      return this->nodeIterator(slot.node);
+    }
+    misses_++;
+    Node<Key, Value>* node = this->internalFind(key);
+    if(node != nullptr)
+    {
+      slot.node = node;
+      slot.generation = generation_;
+    }
+    return this->nodeIterator(node);
+}
+
+/**
+* The batched lookup of BinarySearchTree::findEach behind the cache: hits
+* are reported straight away, and only the keys that miss are searched
+* for together, filling their slots as find does.
+*/
+template<class Key, class Value, class Hash>
+template<typename KeyIterator, typename Function>
+void CachedAVLTree<Key, Value, Hash>::findEach(KeyIterator first, KeyIterator last, Function fn, unsigned int group)
+{
+    std::vector<Key> missed;
+    for(; first != last; ++first)
+    {
+      const Key& key = *first;
+      Slot& slot = slotOf(key);
+      if(slot.generation == generation_ && slot.node != nullptr && slot.node->getKey() == key)
+      {
+        hits_++;
+        fn(key, this->nodeIterator(slot.node));
+      }
+      else
+      {
+        missed.push_back(key);
+      }
+    }
+    misses_ += missed.size();
+    AVLTree<Key, Value>::findEach(missed.begin(), missed.end(),
+        [&](const Key& key, typename BinarySearchTree<Key, Value>::iterator it) {
+          Node<Key, Value>* node = this->iteratorNode(it);
+          if(node != nullptr)
+          {
+            Slot& slot = slotOf(key);
+            slot.node = node;
+            slot.generation = generation_;
+          }
+          fn(key, it);
+        }, group);
+}
+
+/**
+* How many finds were answered from the cache, and how many searched
+* the tree.
+*/
+template<class Key, class Value, class Hash>
+size_t CachedAVLTree<Key, Value, Hash>::hits() const
+{
+    return hits_;
+}
+
+template<class Key, class Value, class Hash>
+size_t CachedAVLTree<Key, Value, Hash>::misses() const
+{
+    return misses_;
+}
+
+template<class Key, class Value, class Hash>
+size_t CachedAVLTree<Key, Value, Hash>::cacheSlots() const
+{
+    return slots_.size();
+}
+
+/**
+* Empties the cache in O(1) by starting a new generation. Only when the
+* generation counter wraps are the slots actually cleared.
+*/
+template<class Key, class Value, class Hash>
+void CachedAVLTree<Key, Value, Hash>::invalidate()
+{
+    if(++generation_ == 0)
+    {
+      slots_.assign(slots_.size(), Slot());
+      generation_ = 1;
+    }
+}
+
+template<class Key, class Value, class Hash>
+void CachedAVLTree<Key, Value, Hash>::unlinkNode(AVLNode<Key, Value>* node)
+{
+    forget(node);
+    AVLTree<Key, Value>::unlinkNode(node);
+}
+
+template<class Key, class Value, class Hash>
+void CachedAVLTree<Key, Value, Hash>::destroyNode(AVLNode<Key, Value>* node)
+{
+    forget(node);
+    AVLTree<Key, Value>::destroyNode(node);
+}
+
+template<class Key, class Value, class Hash>
+void CachedAVLTree<Key, Value, Hash>::nodesMoved()
+{
+    invalidate();
+}
+
+template<class Key, class Value, class Hash>
+typename CachedAVLTree<Key, Value, Hash>::Slot& CachedAVLTree<Key, Value, Hash>::slotOf(const Key& key)
+{
+    return slots_[mixHash(static_cast<uint64_t>(hash_(key))) & (slots_.size() - 1)];
+}
+
+/*
+ * Clears the node's slot if it still points at the node.
+ */
+template<class Key, class Value, class Hash>
+void CachedAVLTree<Key, Value, Hash>::forget(Node<Key, Value>* node)
+{
+    if(node == nullptr)
+    {
+      return;
+    }
+    Slot& slot = slotOf(node->getKey());
+    if(slot.node == node)
+    {
+      slot.node = nullptr;
+    }
+}
+
+#endif
@@ -0,0 +1,929 @@
+#ifndef COMPACTAVL_H
+#define COMPACTAVL_H
+
+#include <iostream>
+#include <exception>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include "hugepages.h"
+
+/**
+* An AVL tree whose nodes live in an arena and link to each other by
+* 32-bit index instead of by pointer. A node holds the item inline, a
+* left index and one word with the right index in its upper 29 bits and
+* the balance in the lower 3, with no vtable and no parent link. That is
+* 8 bytes of overhead per item instead of the 40 of an AVLNode, so an
+* AVLNode<uint64_t, uint64_t> of 56 bytes becomes a 24-byte node.
+*
+* Without parent links, insert and remove are top-down: insert notes the
+* deepest node on its way down that can absorb the new height and fixes
+* balances from there only, remove keeps the slots it passed through in a
+* fixed path array and retraces along it. Iterators carry their own stack
+* of the ancestors still to visit.
+*
+* The arena grows in chunks of 65536 nodes that never move, so references
+* to items stay valid until the item is removed, and growing never copies
+* the tree. Removed nodes go on a free list threaded through their left
+* index and are reused before the arena grows. Index 0 is the null link.
+* A tree holds at most 2^29 - 1 items, so no path is longer than 42.
+*/
+template <class Key, class Value>
+class CompactAVLTree
+{
+public:
+    typedef uint32_t index_type;
+    enum { MAX_HEIGHT = 48 };
+    enum Layout { IN_ORDER, BREADTH_FIRST, VAN_EMDE_BOAS };
+
+    explicit CompactAVLTree(bool hugePages = false);
+    ~CompactAVLTree();
+
+    class iterator
+    {
+    public:
+        iterator();
+
+        std::pair<const Key, Value>& operator*() const;
+        std::pair<const Key, Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+
+    protected:
+        friend class CompactAVLTree<Key, Value>;
+        iterator(const CompactAVLTree<Key, Value>* tree);
+        void pushLeftmost(index_type index);
+        index_type current() const;
+
+        // the current node on top of the ancestors it is in the left subtree of
+        const CompactAVLTree<Key, Value>* tree_;
+        index_type stack_[MAX_HEIGHT];
+        unsigned int depth_;
+    };
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    iterator find(const Key& key) const;
+    iterator begin() const;
+    iterator end() const;
+    bool empty() const;
+    size_t size() const;
+    bool isBalanced() const;
+    size_t memoryUsage() const;
+    HugePageArena::Backing backing() const;
+    void relayout(Layout order = VAN_EMDE_BOAS);
+    bool defragment(size_t budget);
+
+protected:
+    struct Node
+    {
+        Node(const Key& key, const Value& value) : item(key, value), left(0), rightBalance(2) { }
+        std::pair<const Key, Value> item;
+        index_type left;
+        index_type rightBalance;
+    };
+
+    enum { CHUNK_BITS = 16, CHUNK = 1 << CHUNK_BITS, MAX_NODES = (1u << 29) - 1 };
+    // rightBalance of a free slot; no live node has a balance field of 7
+    enum { FREE = 7 };
+
+    Node& node(index_type index) const;
+    index_type right(index_type index) const;
+    void setRight(index_type index, index_type right);
+    int balance(index_type index) const;
+    void setBalance(index_type index, int balance);
+    void setChild(index_type parent, bool isRight, index_type child);
+
+    index_type allocate(const Key& key, const Value& value);
+    void release(index_type index);
+    index_type rotateLeft(index_type index);
+    index_type rotateRight(index_type index);
+    index_type rebalance(index_type index);
+    int checkHeight(index_type index) const;
+
+    bool isFree(index_type index) const;
+    int height(index_type index) const;
+    void vanEmdeBoas(index_type index, int height, std::vector<index_type>& order) const;
+    void subtreeRoots(index_type index, int depth, std::vector<index_type>& roots) const;
+    index_type parentOf(index_type index) const;
+    index_type after(index_type index) const;
+    void swapSlots(index_type a, index_type b);
+    void relabel(index_type index, index_type a, index_type b);
+    void moveNode(Node& from, void* to);
+
+    HugePageArena arena_;
+    std::vector<Node*> chunks_;
+    index_type root_;
+    index_type free_;
+    index_type next_;
+    size_t size_;
+    // defragment's progress: the slot it fills next and the last one it filled
+    index_type defragSlot_;
+    index_type defragLast_;
+
+private:
+    CompactAVLTree(const CompactAVLTree<Key, Value>&);
+    CompactAVLTree<Key, Value>& operator=(const CompactAVLTree<Key, Value>&);
+};
+
+/*
+--------------------------------------------------------------
+Begin implementations for the CompactAVLTree::iterator class.
+---------------------------------------------------------------
+*/
+
+template<class Key, class Value>
+CompactAVLTree<Key, Value>::iterator::iterator() : tree_(NULL), depth_(0)
+{
+
+}
+
+template<class Key, class Value>
+CompactAVLTree<Key, Value>::iterator::iterator(const CompactAVLTree<Key, Value>* tree) :
+    tree_(tree), depth_(0)
+{
+
+}
+
+template<class Key, class Value>
+std::pair<const Key, Value>& CompactAVLTree<Key, Value>::iterator::operator*() const
+{
+    return tree_->node(current()).item;
+}
+
+template<class Key, class Value>
+std::pair<const Key, Value>* CompactAVLTree<Key, Value>::iterator::operator->() const
+{
+    return &tree_->node(current()).item;
+}
+
+template<class Key, class Value>
+bool CompactAVLTree<Key, Value>::iterator::operator==(const iterator& rhs) const
+{
+    return current() == rhs.current();
+}
+
+template<class Key, class Value>
+bool CompactAVLTree<Key, Value>::iterator::operator!=(const iterator& rhs) const
+{
+    return current() != rhs.current();
+}
+
+/**
+* The next node is the leftmost one of the right subtree, or else the
+* nearest ancestor whose left subtree we just finished.
+*/
+template<class Key, class Value>
+typename CompactAVLTree<Key, Value>::iterator& CompactAVLTree<Key, Value>::iterator::operator++()
+{
+    index_type done = stack_[--depth_];
+    pushLeftmost(tree_->right(done));
+    return *this;
+}
+
+template<class Key, class Value>
+void CompactAVLTree<Key, Value>::iterator::pushLeftmost(index_type index)
+{
+    for(; index != 0; index = tree_->node(index).left)
+    {
+        stack_[depth_++] = index;
+    }
+}
+
+template<class Key, class Value>
+typename CompactAVLTree<Key, Value>::index_type CompactAVLTree<Key, Value>::iterator::current() const
+{
+    return depth_ == 0 ? 0 : stack_[depth_ - 1];
+}
+
+/*
+-------------------------------------------------------------
+End implementations for the CompactAVLTree::iterator class.
+-------------------------------------------------------------
+*/
+
+template<class Key, class Value>
+CompactAVLTree<Key, Value>::CompactAVLTree(bool hugePages) :
+    arena_(hugePages), root_(0), free_(0), next_(1), size_(0), defragSlot_(1), defragLast_(0)
+{
+
+}
+
+template<class Key, class Value>
+CompactAVLTree<Key, Value>::~CompactAVLTree()
+{
+    clear();
+}
+
+/**
+* Overwrites the value if key is already present. Only the subtree below
+* the deepest unbalanced node on the path can change height, so balances
+* are adjusted from there down and at most that node is rotated.
+*/
+template<class Key, class Value>
+void CompactAVLTree<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    const Key& key = keyValuePair.first;
+    index_type path[MAX_HEIGHT];
+    bool wentRight[MAX_HEIGHT];
+    unsigned int depth = 0;
+    unsigned int safe = 0;
+    for(index_type current = root_; current != 0; depth++)
+    {
+        Node& n = node(current);
+        if(balance(current) != 0)
+        {
+            safe = depth;
+        }
+        path[depth] = current;
+        if(key < n.item.first)
+        {
+            wentRight[depth] = false;
+            current = n.left;
+        }
+        else if(n.item.first < key)
+        {
+            wentRight[depth] = true;
+            current = right(current);
+        }
+        else
+        {
+            n.item.second = keyValuePair.second;
+            return;
+        }
+    }
+
+    index_type fresh = allocate(key, keyValuePair.second);
+    if(depth == 0)
+    {
+        root_ = fresh;
+        return;
+    }
+    setChild(path[depth - 1], wentRight[depth - 1], fresh);
+    for(unsigned int i = safe; i < depth; i++)
+    {
+        setBalance(path[i], balance(path[i]) + (wentRight[i] ? 1 : -1));
+    }
+    int b = balance(path[safe]);
+    if(b == 2 || b == -2)
+    {
+        index_type top = rebalance(path[safe]);
+        setChild(safe == 0 ? 0 : path[safe - 1], safe == 0 ? false : wentRight[safe - 1], top);
+    }
+}
+
+/**
+* A node with two children is replaced by its predecessor, which is
+* relinked into its place; items never move between nodes. The path down
+* to the node actually unlinked is kept for the climb back up.
+*/
+template<class Key, class Value>
+void CompactAVLTree<Key, Value>::remove(const Key& key)
+{
+    index_type path[MAX_HEIGHT];
+    bool wentRight[MAX_HEIGHT];
+    unsigned int depth = 0;
+    index_type target = root_;
+    while(target != 0)
+    {
+        const Node& n = node(target);
+        if(key < n.item.first)
+        {
+            wentRight[depth] = false;
+        }
+        else if(n.item.first < key)
+        {
+            wentRight[depth] = true;
+        }
+        else
+        {
+            break;
+        }
+        path[depth++] = target;
+        target = wentRight[depth - 1] ? right(target) : n.left;
+    }
+    if(target == 0)
+    {
+        return;
+    }
+    unsigned int at = depth;
+    index_type above = at == 0 ? 0 : path[at - 1];
+    bool side = at == 0 ? false : wentRight[at - 1];
+
+    if(node(target).left == 0 || right(target) == 0)
+    {
+        setChild(above, side, node(target).left != 0 ? node(target).left : right(target));
+    }
+    else
+    {
+        path[depth] = target;
+        wentRight[depth++] = false;
+        index_type pred = node(target).left;
+        while(right(pred) != 0)
+        {
+            path[depth] = pred;
+            wentRight[depth++] = true;
+            pred = right(pred);
+        }
+        setChild(path[depth - 1], wentRight[depth - 1], node(pred).left);
+        node(pred).left = node(target).left;
+        setRight(pred, right(target));
+        setBalance(pred, balance(target));
+        setChild(above, side, pred);
+        path[at] = pred;
+    }
+    release(target);
+
+    while(depth-- > 0)
+    {
+        index_type current = path[depth];
+        int b = balance(current) + (wentRight[depth] ? -1 : 1);
+        setBalance(current, b);
+        if(b == 1 || b == -1)
+        {
+            return;
+        }
+        if(b == 2 || b == -2)
+        {
+            bool stillTall = balance(b > 0 ? right(current) : node(current).left) == 0;
+            index_type top = rebalance(current);
+            setChild(depth == 0 ? 0 : path[depth - 1], depth == 0 ? false : wentRight[depth - 1], top);
+            if(stillTall)
+            {
+                return;
+            }
+        }
+    }
+}
+
+/**
+* Frees every node and the arena itself.
+*/
+template<class Key, class Value>
+void CompactAVLTree<Key, Value>::clear()
+{
+    // mark the free nodes so only live ones are destroyed
+    std::vector<bool> dead(next_, false);
+    for(index_type index = free_; index != 0; index = node(index).left)
+    {
+        dead[index] = true;
+    }
+    for(index_type index = 1; index < next_; index++)
+    {
+        if(!dead[index])
+        {
+            node(index).~Node();
+        }
+    }
+    for(size_t i = 0; i < chunks_.size(); i++)
+    {
+        arena_.deallocate(chunks_[i], CHUNK * sizeof(Node));
+    }
+    arena_.release();
+    chunks_.clear();
+    root_ = 0;
+    free_ = 0;
+    next_ = 1;
+    size_ = 0;
+    defragSlot_ = 1;
+    defragLast_ = 0;
+}
+
+/**
+* The returned iterator holds the nodes on the path where the search went
+* left, which are exactly the ones still ahead of it.
+*/
+template<class Key, class Value>
+typename CompactAVLTree<Key, Value>::iterator CompactAVLTree<Key, Value>::find(const Key& key) const
+{
+    iterator it(this);
+    index_type current = root_;
+    while(current != 0)
+    {
+        const Node& n = node(current);
+        if(key < n.item.first)
+        {
+            it.stack_[it.depth_++] = current;
+            current = n.left;
+        }
+        else if(n.item.first < key)
+        {
+            current = right(current);
+        }
+        else
+        {
+            it.stack_[it.depth_++] = current;
+            return it;
+        }
+    }
+    return end();
+}
+
+template<class Key, class Value>
+typename CompactAVLTree<Key, Value>::iterator CompactAVLTree<Key, Value>::begin() const
+{
+    iterator it(this);
+    it.pushLeftmost(root_);
+    return it;
+}
+
+template<class Key, class Value>
+typename CompactAVLTree<Key, Value>::iterator CompactAVLTree<Key, Value>::end() const
+{
+    return iterator(this);
+}
+
+template<class Key, class Value>
+bool CompactAVLTree<Key, Value>::empty() const
+{
+    return root_ == 0;
+}
+
+template<class Key, class Value>
+size_t CompactAVLTree<Key, Value>::size() const
+{
+    return size_;
+}
+
+/**
+* Checks the AVL property against the stored balances. Linear time.
+*/
+template<class Key, class Value>
+bool CompactAVLTree<Key, Value>::isBalanced() const
+{
+    return checkHeight(root_) >= 0;
+}
+
+/**
+* Bytes held by the arena, including free and not yet used slots.
+*/
+template<class Key, class Value>
+size_t CompactAVLTree<Key, Value>::memoryUsage() const
+{
+    return arena_.reserved() + chunks_.size() * sizeof(Node*);
+}
+
+/**
+* How the arena's latest chunk is backed; HEAP unless huge pages were
+* asked for.
+*/
+template<class Key, class Value>
+HugePageArena::Backing CompactAVLTree<Key, Value>::backing() const
+{
+    return arena_.backing();
+}
+
+/**
+* Moves every node so that the arena holds them in the given order, then
+* renumbers the links. In-order suits scans; breadth-first and van Emde
+* Boas put the top of the tree, which every search passes through,
+* together, and van Emde Boas also keeps each small subtree in a few
+* cache lines all the way down. Free slots are squeezed out, so the live
+* nodes end up in slots 1 to size(). Linear time; the only extra memory
+* is two indexes per slot. Iterators are invalidated.
+*/
+template<class Key, class Value>
+void CompactAVLTree<Key, Value>::relayout(Layout layout)
+{
+    // order[i] is the slot of the node that belongs in slot i
+    std::vector<index_type> order(1, 0);
+    order.reserve(size_ + 1);
+    if(layout == IN_ORDER)
+    {
+        for(iterator it = begin(); it != end(); ++it)
+        {
+            order.push_back(it.current());
+        }
+    }
+    else if(layout == BREADTH_FIRST && root_ != 0)
+    {
+        order.push_back(root_);
+        for(size_t i = 1; i < order.size(); i++)
+        {
+            if(node(order[i]).left != 0) order.push_back(node(order[i]).left);
+            if(right(order[i]) != 0) order.push_back(right(order[i]));
+        }
+    }
+    else
+    {
+        vanEmdeBoas(root_, height(root_), order);
+    }
+
+    index_type count = static_cast<index_type>(size_);
+    std::vector<index_type> renumber(next_, 0);
+    for(index_type i = 1; i <= count; i++)
+    {
+        renumber[order[i]] = i;
+    }
+    std::vector<bool> placed(count + 1, false);
+    // A free slot among the first count starts a chain of moves that ends
+    // at a slot past them, which is left free.
+    for(index_type hole = 1; hole <= count; hole++)
+    {
+        for(index_type to = hole; to <= count && isFree(to); )
+        {
+            index_type from = order[to];
+            moveNode(node(from), &node(to));
+            placed[to] = true;
+            new (&node(from).rightBalance) index_type(FREE);
+            to = from;
+        }
+    }
+    // everything else is a cycle among live slots, rotated through a spare node
+    typename std::aligned_storage<sizeof(Node), alignof(Node)>::type spare;
+    for(index_type start = 1; start <= count; start++)
+    {
+        if(placed[start] || order[start] == start)
+        {
+            continue;
+        }
+        moveNode(node(start), &spare);
+        index_type to = start;
+        while(order[to] != start)
+        {
+            moveNode(node(order[to]), &node(to));
+            placed[to] = true;
+            to = order[to];
+        }
+        moveNode(*reinterpret_cast<Node*>(&spare), &node(to));
+        placed[to] = true;
+    }
+    for(index_type index = 1; index <= count; index++)
+    {
+        node(index).left = renumber[node(index).left];
+        setRight(index, renumber[right(index)]);
+    }
+    root_ = renumber[root_];
+    free_ = 0;
+    next_ = count + 1;
+    defragSlot_ = 1;
+    defragLast_ = 0;
+}
+
+/**
+* Does up to budget steps of an in-order relayout that can be spread out
+* between other operations. Each step finds the node that comes after the
+* last one placed and swaps it into the next live slot, which costs two
+* or three searches. Inserts and removes in between are fine; nodes they
+* add behind the pass are simply left where they are until the next one.
+* Returns false once a pass has gone through the whole tree, after which
+* the next call starts a new one. Iterators are invalidated.
+*/
+template<class Key, class Value>
+bool CompactAVLTree<Key, Value>::defragment(size_t budget)
+{
+    if(defragLast_ != 0 && (defragLast_ >= next_ || isFree(defragLast_)))
+    {
+        // the last node placed has been removed since, so the pass starts over
+        defragSlot_ = 1;
+        defragLast_ = 0;
+    }
+    for(size_t done = 0; done < budget; done++)
+    {
+        index_type slot = defragSlot_;
+        while(slot < next_ && isFree(slot))
+        {
+            slot++;
+        }
+        index_type wanted = after(defragLast_);
+        if(slot >= next_ || wanted == 0)
+        {
+            defragSlot_ = 1;
+            defragLast_ = 0;
+            return false;
+        }
+        if(wanted != slot)
+        {
+            swapSlots(wanted, slot);
+        }
+        defragLast_ = slot;
+        defragSlot_ = slot + 1;
+    }
+    return true;
+}
+
+template<class Key, class Value>
+typename CompactAVLTree<Key, Value>::Node& CompactAVLTree<Key, Value>::node(index_type index) const
+{
+    return chunks_[index >> CHUNK_BITS][index & (CHUNK - 1)];
+}
+
+template<class Key, class Value>
+typename CompactAVLTree<Key, Value>::index_type CompactAVLTree<Key, Value>::right(index_type index) const
+{
+    return node(index).rightBalance >> 3;
+}
+
+template<class Key, class Value>
+void CompactAVLTree<Key, Value>::setRight(index_type index, index_type right)
+{
+    Node& n = node(index);
+    n.rightBalance = (right << 3) | (n.rightBalance & 7);
+}
+
+// The balance (right height - left height) is stored offset by 2, so the
+// transient -2 and +2 fit as well.
+template<class Key, class Value>
+int CompactAVLTree<Key, Value>::balance(index_type index) const
+{
+    return static_cast<int>(node(index).rightBalance & 7) - 2;
+}
+
+template<class Key, class Value>
+void CompactAVLTree<Key, Value>::setBalance(index_type index, int balance)
+{
+    Node& n = node(index);
+    n.rightBalance = (n.rightBalance & ~7u) | static_cast<index_type>(balance + 2);
+}
+
+/**
+* Points the left or right link of parent at child, or the root if
+* parent is 0.
+*/
+template<class Key, class Value>
+void CompactAVLTree<Key, Value>::setChild(index_type parent, bool isRight, index_type child)
+{
+    if(parent == 0)
+    {
+        root_ = child;
+    }
+    else if(isRight)
+    {
+        setRight(parent, child);
+    }
+    else
+    {
+        node(parent).left = child;
+    }
+}
+
+template<class Key, class Value>
+typename CompactAVLTree<Key, Value>::index_type CompactAVLTree<Key, Value>::allocate(const Key& key, const Value& value)
+{
+    index_type index = free_;
+    if(index != 0)
+    {
+        free_ = node(index).left;
+    }
+    else
+    {
+        if(next_ > MAX_NODES)
+        {
+            throw std::length_error("CompactAVLTree is full");
+        }
+        if((next_ >> CHUNK_BITS) == chunks_.size())
+        {
+            chunks_.push_back(static_cast<Node*>(arena_.allocate(CHUNK * sizeof(Node))));
+        }
+        index = next_++;
+    }
+    new (&node(index)) Node(key, value);
+    size_++;
+    return index;
+}
+
+template<class Key, class Value>
+void CompactAVLTree<Key, Value>::release(index_type index)
+{
+    node(index).~Node();
+    // the slot is raw memory now; only its left index and the mark are used again
+    new (&node(index).left) index_type(free_);
+    new (&node(index).rightBalance) index_type(FREE);
+    free_ = index;
+    size_--;
+}
+
+/**
+* Rotates the right child of index up and returns it; the caller relinks
+* it in place of index. The balance updates hold for any starting
+* balances, including the double rotation cases.
+*/
+template<class Key, class Value>
+typename CompactAVLTree<Key, Value>::index_type CompactAVLTree<Key, Value>::rotateLeft(index_type index)
+{
+    index_type child = right(index);
+    setRight(index, node(child).left);
+    node(child).left = index;
+
+    int b = balance(index);
+    int c = balance(child);
+    int nb = b - 1 - std::max(c, 0);
+    setBalance(index, nb);
+    setBalance(child, c - 1 + std::min(nb, 0));
+    return child;
+}
+
+template<class Key, class Value>
+typename CompactAVLTree<Key, Value>::index_type CompactAVLTree<Key, Value>::rotateRight(index_type index)
+{
+    index_type child = node(index).left;
+    node(index).left = right(child);
+    setRight(child, index);
+
+    int b = balance(index);
+    int c = balance(child);
+    int nb = b + 1 - std::min(c, 0);
+    setBalance(index, nb);
+    setBalance(child, c + 1 + std::max(nb, 0));
+    return child;
+}
+
+/**
+* Fixes a node whose balance is -2 or +2 and returns the new root of its
+* subtree.
+*/
+template<class Key, class Value>
+typename CompactAVLTree<Key, Value>::index_type CompactAVLTree<Key, Value>::rebalance(index_type index)
+{
+    if(balance(index) > 0)
+    {
+        if(balance(right(index)) < 0)
+        {
+            setRight(index, rotateRight(right(index)));
+        }
+        return rotateLeft(index);
+    }
+    if(balance(node(index).left) > 0)
+    {
+        node(index).left = rotateLeft(node(index).left);
+    }
+    return rotateRight(index);
+}
+
+/**
+* Height of the subtree, or -1 if it is out of balance or a stored
+* balance is wrong.
+*/
+template<class Key, class Value>
+int CompactAVLTree<Key, Value>::checkHeight(index_type index) const
+{
+    if(index == 0)
+    {
+        return 0;
+    }
+    int left = checkHeight(node(index).left);
+    int right = checkHeight(this->right(index));
+    if(left < 0 || right < 0 || right - left != balance(index) || std::abs(right - left) > 1)
+    {
+        return -1;
+    }
+    return 1 + std::max(left, right);
+}
+
+template<class Key, class Value>
+bool CompactAVLTree<Key, Value>::isFree(index_type index) const
+{
+    return node(index).rightBalance == FREE;
+}
+
+/*
+ * The height follows the taller child all the way down.
+ */
+template<class Key, class Value>
+int CompactAVLTree<Key, Value>::height(index_type index) const
+{
+    int h = 0;
+    for(; index != 0; h++)
+    {
+        index = balance(index) > 0 ? right(index) : node(index).left;
+    }
+    return h;
+}
+
+/*
+ * Appends the top levels of the subtree (the upper half of its height),
+ * laid out recursively, then each subtree hanging below them in turn.
+ */
+template<class Key, class Value>
+void CompactAVLTree<Key, Value>::vanEmdeBoas(index_type index, int height, std::vector<index_type>& order) const
+{
+    if(index == 0 || height <= 0)
+    {
+        return;
+    }
+    if(height == 1)
+    {
+        order.push_back(index);
+        return;
+    }
+    int top = (height + 1) / 2;
+    vanEmdeBoas(index, top, order);
+    std::vector<index_type> roots;
+    subtreeRoots(index, top, roots);
+    for(size_t i = 0; i < roots.size(); i++)
+    {
+        vanEmdeBoas(roots[i], height - top, order);
+    }
+}
+
+template<class Key, class Value>
+void CompactAVLTree<Key, Value>::subtreeRoots(index_type index, int depth, std::vector<index_type>& roots) const
+{
+    if(index == 0)
+    {
+        return;
+    }
+    if(depth == 0)
+    {
+        roots.push_back(index);
+        return;
+    }
+    subtreeRoots(node(index).left, depth - 1, roots);
+    subtreeRoots(right(index), depth - 1, roots);
+}
+
+/*
+ * There are no parent links, so the parent is found by searching for the
+ * node's key. Returns 0 for the root.
+ */
+template<class Key, class Value>
+typename CompactAVLTree<Key, Value>::index_type CompactAVLTree<Key, Value>::parentOf(index_type index) const
+{
+    const Key& key = node(index).item.first;
+    index_type parent = 0;
+    for(index_type current = root_; current != index; )
+    {
+        parent = current;
+        current = key < node(current).item.first ? node(current).left : right(current);
+    }
+    return parent;
+}
+
+/*
+ * The node with the smallest key above the key in slot index, or the
+ * smallest node of all if index is 0.
+ */
+template<class Key, class Value>
+typename CompactAVLTree<Key, Value>::index_type CompactAVLTree<Key, Value>::after(index_type index) const
+{
+    index_type found = 0;
+    for(index_type current = root_; current != 0; )
+    {
+        if(index == 0 || node(index).item.first < node(current).item.first)
+        {
+            found = current;
+            current = node(current).left;
+        }
+        else
+        {
+            current = right(current);
+        }
+    }
+    return found;
+}
+
+/*
+ * Exchanges the nodes in slots a and b, then points every link that
+ * referred to one of them at the other: in both nodes themselves (one may
+ * be the other's child) and in their parents, which are relabelled once
+ * if they are the same node.
+ */
+template<class Key, class Value>
+void CompactAVLTree<Key, Value>::swapSlots(index_type a, index_type b)
+{
+    index_type parentA = parentOf(a);
+    index_type parentB = parentOf(b);
+    typename std::aligned_storage<sizeof(Node), alignof(Node)>::type spare;
+    moveNode(node(a), &spare);
+    moveNode(node(b), &node(a));
+    moveNode(*reinterpret_cast<Node*>(&spare), &node(b));
+    relabel(a, a, b);
+    relabel(b, a, b);
+    if(parentA != 0 && parentA != b)
+    {
+        relabel(parentA, a, b);
+    }
+    if(parentB != 0 && parentB != a && parentB != parentA)
+    {
+        relabel(parentB, a, b);
+    }
+    root_ = root_ == a ? b : root_ == b ? a : root_;
+}
+
+template<class Key, class Value>
+void CompactAVLTree<Key, Value>::relabel(index_type index, index_type a, index_type b)
+{
+    Node& n = node(index);
+    n.left = n.left == a ? b : n.left == b ? a : n.left;
+    index_type r = right(index);
+    setRight(index, r == a ? b : r == b ? a : r);
+}
+
+template<class Key, class Value>
+void CompactAVLTree<Key, Value>::moveNode(Node& from, void* to)
+{
+    new (to) Node(std::move(from));
+    from.~Node();
+}
+
+#endif
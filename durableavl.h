@@ -0,0 +1,421 @@
+#ifndef DURABLEAVL_H
+#define DURABLEAVL_H
+
+#include <iostream>
+#include <fstream>
+#include <stdexcept>
+#include <system_error>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cerrno>
+#include <string>
+#include <utility>
+#include <mutex>
+#include <condition_variable>
+#include <fcntl.h>
+#include <unistd.h>
+#include "avlbst.h"
+#include "serialize.h"
+
+/**
+* An AVLTree that survives crashes. Every insert and remove is appended
+* to a write-ahead log and only returns once the log has reached the
+* disk. Writers that arrive while a sync is running are batched behind
+* it (group commit): the next writer to find the log idle writes and
+* syncs everything queued so far in one go, so concurrent writers share
+* the cost of each fdatasync.
+*
+* The state lives in two files: path.snapshot, in the serialize format,
+* and path.wal, the operations since that snapshot. On construction the
+* snapshot is loaded and the log replayed on top of it, dropping a torn
+* record at its end. A checkpoint writes a fresh snapshot and empties the
+* log; it runs automatically once the log grows past checkpointBytes.
+*
+* If writing or syncing the log fails, the batch may be lost while the
+* tree already shows it, so the tree goes into a failed state: that
+* write and every later insert, remove and checkpoint throw, and only
+* reopening it gets back to what is on disk. find keeps working.
+*/
+template <class Key, class Value>
+class DurableAVLTree
+{
+public:
+    DurableAVLTree(const std::string& path, size_t checkpointBytes = 64 << 20);
+    ~DurableAVLTree();
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    bool find(const Key& key, Value& value) const;
+    void checkpoint();
+
+protected:
+    enum { INSERT = 1, REMOVE = 2 };
+
+    void append(const std::string& payload, std::unique_lock<std::mutex>& guard);
+    void commit(uint64_t lsn, std::unique_lock<std::mutex>& guard);
+    void checkpointLocked(std::unique_lock<std::mutex>& guard);
+    void replay();
+    void checkFailed() const;
+    static void syncDirectory(const std::string& path);
+    static uint32_t checksum(const std::string& data);
+    static void fail(const std::string& what);
+
+    std::string walPath_;
+    std::string snapshotPath_;
+    size_t checkpointBytes_;
+    int fd_;
+    AVLTree<Key, Value> tree_;
+
+    mutable std::mutex lock_;
+    std::condition_variable synced_;
+    std::string pending_;
+    uint64_t appendedLsn_;
+    uint64_t durableLsn_;
+    size_t walBytes_;
+    bool flushing_;
+    bool failed_;
+};
+
+/**
+* Loads the snapshot, replays the log and opens it for appending,
+* creating it if needed. The directory is synced either way, since a
+* crash may have left a log that was created but never made durable.
+*/
+template<class Key, class Value>
+DurableAVLTree<Key, Value>::DurableAVLTree(const std::string& path, size_t checkpointBytes) :
+    walPath_(path + ".wal"), snapshotPath_(path + ".snapshot"), checkpointBytes_(checkpointBytes),
+    fd_(-1), appendedLsn_(0), durableLsn_(0), walBytes_(0), flushing_(false), failed_(false)
+{
+    std::ifstream snapshot(snapshotPath_.c_str(), std::ios::binary);
+    if(snapshot)
+    {
+        tree_.deserialize(snapshot);
+    }
+    replay();
+    fd_ = ::open(walPath_.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if(fd_ < 0)
+    {
+        fail("cannot open " + walPath_);
+    }
+    // the log may have just been created; its directory entry has to be
+    // on disk before any write through it is acknowledged
+    try
+    {
+        syncDirectory(walPath_);
+    }
+    catch(...)
+    {
+        ::close(fd_);
+        throw;
+    }
+}
+
+template<class Key, class Value>
+DurableAVLTree<Key, Value>::~DurableAVLTree()
+{
+    if(fd_ >= 0)
+    {
+        ::close(fd_);
+    }
+}
+
+/**
+* Returns once the insert is durable. The tree is updated first, so other
+* threads may see the new value slightly before it is on disk.
+*/
+template<class Key, class Value>
+void DurableAVLTree<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    std::string payload(1, static_cast<char>(INSERT));
+    std::string item;
+    SerializeTraits<Key>::write(item, keyValuePair.first);
+    writeVarint(payload, item.size());
+    payload += item;
+    item.clear();
+    SerializeTraits<Value>::write(item, keyValuePair.second);
+    writeVarint(payload, item.size());
+    payload += item;
+
+    std::unique_lock<std::mutex> guard(lock_);
+    checkFailed();
+    tree_.insert(keyValuePair);
+    append(payload, guard);
+}
+
+template<class Key, class Value>
+void DurableAVLTree<Key, Value>::remove(const Key& key)
+{
+    std::string payload(1, static_cast<char>(REMOVE));
+    std::string item;
+    SerializeTraits<Key>::write(item, key);
+    writeVarint(payload, item.size());
+    payload += item;
+
+    std::unique_lock<std::mutex> guard(lock_);
+    checkFailed();
+    tree_.remove(key);
+    append(payload, guard);
+}
+
+template<class Key, class Value>
+bool DurableAVLTree<Key, Value>::find(const Key& key, Value& value) const
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    typename AVLTree<Key, Value>::iterator it = tree_.find(key);
+    if(it == tree_.end())
+    {
+        return false;
+    }
+    value = it->second;
+    return true;
+}
+
+template<class Key, class Value>
+void DurableAVLTree<Key, Value>::checkpoint()
+{
+    std::unique_lock<std::mutex> guard(lock_);
+    checkpointLocked(guard);
+}
+
+/**
+* Queues a record (length, checksum, payload) and waits for it to be
+* synced. Called with the lock held, right after applying the operation,
+* so the log order matches the order the tree saw.
+*/
+template<class Key, class Value>
+void DurableAVLTree<Key, Value>::append(const std::string& payload, std::unique_lock<std::mutex>& guard)
+{
+    writeVarint(pending_, payload.size());
+    uint32_t sum = checksum(payload);
+    pending_.append(reinterpret_cast<const char*>(&sum), sizeof(sum));
+    pending_ += payload;
+    commit(++appendedLsn_, guard);
+    if(walBytes_ >= checkpointBytes_)
+    {
+        checkpointLocked(guard);
+    }
+}
+
+/**
+* Waits until lsn is durable. If no sync is running, this thread becomes
+* the leader: it takes everything queued so far, writes and syncs it
+* without the lock, then wakes every writer the batch covered. A failed
+* batch fails the tree, and with it every writer that was waiting.
+*/
+template<class Key, class Value>
+void DurableAVLTree<Key, Value>::commit(uint64_t lsn, std::unique_lock<std::mutex>& guard)
+{
+    while(durableLsn_ < lsn)
+    {
+        checkFailed();
+        if(flushing_)
+        {
+            synced_.wait(guard);
+            continue;
+        }
+        flushing_ = true;
+        std::string batch;
+        batch.swap(pending_);
+        uint64_t batchLsn = appendedLsn_;
+        guard.unlock();
+
+        bool ok = true;
+        for(size_t written = 0; ok && written < batch.size(); )
+        {
+            ssize_t n = ::write(fd_, batch.data() + written, batch.size() - written);
+            if(n == 0)
+            {
+                // no progress and no error; retrying would spin forever
+                errno = EIO;
+                ok = false;
+            }
+            else if(n < 0 && errno != EINTR)
+            {
+                ok = false;
+            }
+            written += n > 0 ? n : 0;
+        }
+        ok = ok && ::fdatasync(fd_) == 0;
+        int error = errno;
+
+        guard.lock();
+        flushing_ = false;
+        synced_.notify_all();
+        if(!ok)
+        {
+            failed_ = true;
+            errno = error;
+            fail("cannot write " + walPath_);
+        }
+        walBytes_ += batch.size();
+        durableLsn_ = batchLsn;
+    }
+}
+
+/**
+* Writes the snapshot next to the old one, syncs it and renames it into
+* place, then empties the log. The directory is synced before the log is
+* cut, so the rename cannot be lost while the truncate survives. A crash
+* in between only means the log is replayed on a snapshot that already
+* contains it, which is harmless since replaying inserts and removes in
+* order is idempotent.
+*/
+template<class Key, class Value>
+void DurableAVLTree<Key, Value>::checkpointLocked(std::unique_lock<std::mutex>& guard)
+{
+    while(flushing_)
+    {
+        synced_.wait(guard);
+    }
+    checkFailed();
+    std::string tmpPath = snapshotPath_ + ".tmp";
+    {
+        std::ofstream out(tmpPath.c_str(), std::ios::binary | std::ios::trunc);
+        tree_.serialize(out);
+        out.close();
+        if(!out)
+        {
+            fail("cannot write " + tmpPath);
+        }
+    }
+    int tmp = ::open(tmpPath.c_str(), O_RDONLY);
+    bool ok = tmp >= 0 && ::fsync(tmp) == 0;
+    if(tmp >= 0)
+    {
+        ::close(tmp);
+    }
+    if(!ok || std::rename(tmpPath.c_str(), snapshotPath_.c_str()) != 0)
+    {
+        fail("cannot replace " + snapshotPath_);
+    }
+    syncDirectory(snapshotPath_);
+    // everything applied so far is in the snapshot now
+    pending_.clear();
+    durableLsn_ = appendedLsn_;
+    if(::ftruncate(fd_, 0) != 0 || ::fdatasync(fd_) != 0)
+    {
+        failed_ = true;
+        fail("cannot truncate " + walPath_);
+    }
+    walBytes_ = 0;
+    synced_.notify_all();
+}
+
+/**
+* Applies every complete record in the log and cuts off anything after
+* the first record that is truncated or fails its checksum.
+*/
+template<class Key, class Value>
+void DurableAVLTree<Key, Value>::replay()
+{
+    std::ifstream in(walPath_.c_str(), std::ios::binary);
+    if(!in)
+    {
+        return;
+    }
+    std::string payload;
+    size_t good = 0;
+    while(true)
+    {
+        uint64_t size = 0;
+        uint32_t sum = 0;
+        if(!readVarint(in, size) || !in.read(reinterpret_cast<char*>(&sum), sizeof(sum)))
+        {
+            break;
+        }
+        payload.resize(size);
+        if(size == 0 || !in.read(&payload[0], size) || checksum(payload) != sum)
+        {
+            break;
+        }
+
+        const char* data = payload.data() + 1;
+        const char* end = payload.data() + payload.size();
+        uint64_t keySize = 0;
+        if(!readVarint(data, end, keySize) || keySize > (uint64_t)(end - data))
+        {
+            break;
+        }
+        Key key;
+        SerializeTraits<Key>::read(data, keySize, key);
+        data += keySize;
+        if(payload[0] == INSERT)
+        {
+            uint64_t valueSize = 0;
+            if(!readVarint(data, end, valueSize) || valueSize != (uint64_t)(end - data))
+            {
+                break;
+            }
+            Value value;
+            SerializeTraits<Value>::read(data, valueSize, value);
+            tree_.insert(std::make_pair(key, value));
+        }
+        else if(payload[0] == REMOVE && data == end)
+        {
+            tree_.remove(key);
+        }
+        else
+        {
+            break;
+        }
+        good = static_cast<size_t>(in.tellg());
+    }
+    in.close();
+    if(::truncate(walPath_.c_str(), good) != 0)
+    {
+        fail("cannot truncate " + walPath_);
+    }
+    walBytes_ = good;
+}
+
+template<class Key, class Value>
+void DurableAVLTree<Key, Value>::checkFailed() const
+{
+    if(failed_)
+    {
+        throw std::runtime_error("an earlier write to " + walPath_ + " failed; reopen the tree");
+    }
+}
+
+/**
+* Syncs the directory holding path, which makes a rename into it durable.
+*/
+template<class Key, class Value>
+void DurableAVLTree<Key, Value>::syncDirectory(const std::string& path)
+{
+    size_t slash = path.find_last_of('/');
+    std::string directory = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+    int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+    bool ok = fd >= 0 && ::fsync(fd) == 0;
+    if(fd >= 0)
+    {
+        ::close(fd);
+    }
+    if(!ok)
+    {
+        fail("cannot sync " + directory);
+    }
+}
+
+/**
+* 32-bit FNV-1a, enough to spot a torn or partly written record.
+*/
+template<class Key, class Value>
+uint32_t DurableAVLTree<Key, Value>::checksum(const std::string& data)
+{
+    uint32_t hash = 2166136261u;
+    for(size_t i = 0; i < data.size(); i++)
+    {
+        hash = (hash ^ static_cast<unsigned char>(data[i])) * 16777619u;
+    }
+    return hash;
+}
+
+template<class Key, class Value>
+void DurableAVLTree<Key, Value>::fail(const std::string& what)
+{
+    throw std::system_error(errno, std::generic_category(), what);
+}
+
+#endif
@@ -0,0 +1,407 @@
+#ifndef EPOCHAVL_H
+#define EPOCHAVL_H
+
+#include <iostream>
+#include <exception>
+#include <cstdlib>
+#include <cstddef>
+#include <vector>
+#include <set>
+#include <utility>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include "avlbst.h"
+
+/**
+* Epoch-based reclamation. Readers wrap every access to shared nodes in a
+* Guard; writers hand unlinked nodes to retire instead of deleting them.
+* A retired node is freed once the global epoch has moved on twice, which
+* can only happen after every thread that might have seen it has left its
+* guard.
+*
+* Every thread gets its own record with its own retire list, so retiring
+* never takes a lock. A thread tries to advance the epoch and frees what
+* it can every collectPeriod retires, and waits for readers once it holds
+* maxGarbage nodes, so garbage stays bounded as long as readers do not
+* stall inside a guard. A domain must outlive the threads that use it
+* while they are running; threads that exit hand their leftovers back to
+* the domain.
+*/
+class EpochDomain
+{
+public:
+    EpochDomain(size_t collectPeriod = 64, size_t maxGarbage = 4096);
+    ~EpochDomain();
+
+    /**
+    * Keeps the calling thread inside the domain for its lifetime.
+    * Guards may be nested.
+    */
+    class Guard
+    {
+    public:
+        explicit Guard(EpochDomain& domain);
+        ~Guard();
+    private:
+        Guard(const Guard&);
+        Guard& operator=(const Guard&);
+        EpochDomain& domain_;
+    };
+
+    void enter();
+    void exit();
+    void retire(void* object, void (*deleter)(void*));
+    bool tryAdvance();
+    void collect();
+    size_t pending();
+
+protected:
+    struct Retired
+    {
+        void* object;
+        void (*deleter)(void*);
+        unsigned long epoch;
+    };
+
+    // state is (epoch << 1) | 1 while the owner is inside a guard, else 0
+    struct Record
+    {
+        Record() : state(0), inUse(true), nesting(0), sinceCollect(0), next(NULL) { }
+        std::atomic<unsigned long> state;
+        std::atomic<bool> inUse;
+        unsigned int nesting;
+        size_t sinceCollect;
+        std::vector<Retired> retired;
+        Record* next;
+    };
+
+    // The records a thread holds, released when the thread exits
+    struct Registry
+    {
+        ~Registry();
+        std::vector<std::pair<unsigned long, Record*> > records;
+    };
+
+    Record* local();
+    void collect(Record* record);
+    void release(Record* record);
+    static void reclaim(std::vector<Retired>& retired, unsigned long epoch);
+    static Registry& registry();
+    static std::mutex& liveLock();
+    static std::set<std::pair<unsigned long, EpochDomain*> >& liveDomains();
+
+    unsigned long id_;
+    size_t collectPeriod_;
+    size_t maxGarbage_;
+    std::atomic<unsigned long> epoch_;
+    std::atomic<Record*> records_;
+    std::mutex orphanLock_;
+    std::vector<Retired> orphans_;
+};
+
+inline EpochDomain::EpochDomain(size_t collectPeriod, size_t maxGarbage) :
+    collectPeriod_(collectPeriod), maxGarbage_(maxGarbage), epoch_(2), records_(NULL)
+{
+    static std::atomic<unsigned long> nextId(1);
+    id_ = nextId++;
+    std::lock_guard<std::mutex> guard(liveLock());
+    liveDomains().insert(std::make_pair(id_, this));
+}
+
+/**
+* No thread may be inside a guard any more, so everything can go.
+*/
+inline EpochDomain::~EpochDomain()
+{
+    {
+        std::lock_guard<std::mutex> guard(liveLock());
+        liveDomains().erase(std::make_pair(id_, this));
+    }
+    Record* record = records_;
+    while(record != NULL)
+    {
+        Record* next = record->next;
+        reclaim(record->retired, ~0ul);
+        delete record;
+        record = next;
+    }
+    reclaim(orphans_, ~0ul);
+}
+
+inline EpochDomain::Guard::Guard(EpochDomain& domain) : domain_(domain)
+{
+    domain_.enter();
+}
+
+inline EpochDomain::Guard::~Guard()
+{
+    domain_.exit();
+}
+
+/**
+* Announces the current epoch. The store is sequentially consistent so
+* that it is visible before any node is read.
+*/
+inline void EpochDomain::enter()
+{
+    Record* record = local();
+    if(record->nesting++ == 0)
+    {
+        record->state.store((epoch_.load() << 1) | 1);
+    }
+}
+
+inline void EpochDomain::exit()
+{
+    Record* record = local();
+    if(--record->nesting == 0)
+    {
+        record->state.store(0, std::memory_order_release);
+    }
+}
+
+/**
+* Hands over an object that is no longer reachable from the shared
+* structure. deleter(object) runs once no reader can still hold it.
+*/
+inline void EpochDomain::retire(void* object, void (*deleter)(void*))
+{
+    Record* record = local();
+    Retired item = { object, deleter, epoch_.load() };
+    record->retired.push_back(item);
+    if(++record->sinceCollect >= collectPeriod_ || record->retired.size() >= maxGarbage_)
+    {
+        collect(record);
+    }
+}
+
+/**
+* Moves the global epoch on if every thread inside a guard has already
+* seen the current one.
+*/
+inline bool EpochDomain::tryAdvance()
+{
+    unsigned long epoch = epoch_.load();
+    for(Record* record = records_.load(); record != NULL; record = record->next)
+    {
+        unsigned long state = record->state.load();
+        if((state & 1) && (state >> 1) != epoch)
+        {
+            return false;
+        }
+    }
+    return epoch_.compare_exchange_strong(epoch, epoch + 1);
+}
+
+/**
+* Frees whatever the calling thread has retired that is now safe.
+*/
+inline void EpochDomain::collect()
+{
+    collect(local());
+}
+
+/**
+* The number of objects the calling thread has retired but not freed.
+*/
+inline size_t EpochDomain::pending()
+{
+    return local()->retired.size();
+}
+
+/**
+* If the retire list is full, keeps advancing until the old nodes can go,
+* unless this thread is inside a guard itself and would wait on itself.
+*/
+inline void EpochDomain::collect(Record* record)
+{
+    record->sinceCollect = 0;
+    tryAdvance();
+    reclaim(record->retired, epoch_.load());
+    while(record->retired.size() >= maxGarbage_ && record->nesting == 0)
+    {
+        std::this_thread::yield();
+        tryAdvance();
+        reclaim(record->retired, epoch_.load());
+    }
+
+    std::unique_lock<std::mutex> guard(orphanLock_, std::try_to_lock);
+    if(guard.owns_lock())
+    {
+        reclaim(orphans_, epoch_.load());
+    }
+}
+
+/**
+* Frees every entry retired at least two epochs before epoch.
+*/
+inline void EpochDomain::reclaim(std::vector<Retired>& retired, unsigned long epoch)
+{
+    size_t kept = 0;
+    for(size_t i = 0; i < retired.size(); i++)
+    {
+        if(retired[i].epoch + 2 <= epoch)
+        {
+            retired[i].deleter(retired[i].object);
+        }
+        else
+        {
+            retired[kept++] = retired[i];
+        }
+    }
+    retired.resize(kept);
+}
+
+/**
+* Finds the calling thread's record, reusing one left behind by a thread
+* that has exited before allocating a new one.
+*/
+inline EpochDomain::Record* EpochDomain::local()
+{
+    static thread_local unsigned long cachedId = 0;
+    static thread_local Record* cached = NULL;
+    if(cachedId == id_)
+    {
+        return cached;
+    }
+    Registry& mine = registry();
+    for(size_t i = 0; i < mine.records.size(); i++)
+    {
+        if(mine.records[i].first == id_)
+        {
+            cachedId = id_;
+            cached = mine.records[i].second;
+            return cached;
+        }
+    }
+
+    Record* record = NULL;
+    for(Record* free = records_.load(); free != NULL && record == NULL; free = free->next)
+    {
+        bool expected = false;
+        if(free->inUse.compare_exchange_strong(expected, true))
+        {
+            record = free;
+        }
+    }
+    if(record == NULL)
+    {
+        record = new Record();
+        record->next = records_.load();
+        while(!records_.compare_exchange_weak(record->next, record)) { }
+    }
+    mine.records.push_back(std::make_pair(id_, record));
+    cachedId = id_;
+    cached = record;
+    return record;
+}
+
+/**
+* Called when a thread exits: its garbage goes to the domain's orphan
+* list and the record becomes free for the next thread.
+*/
+inline void EpochDomain::release(Record* record)
+{
+    {
+        std::lock_guard<std::mutex> guard(orphanLock_);
+        orphans_.insert(orphans_.end(), record->retired.begin(), record->retired.end());
+    }
+    record->retired.clear();
+    record->nesting = 0;
+    record->sinceCollect = 0;
+    record->state.store(0);
+    record->inUse.store(false);
+}
+
+/**
+* Skips domains that are already gone (ids are never reused).
+*/
+inline EpochDomain::Registry::~Registry()
+{
+    std::lock_guard<std::mutex> guard(liveLock());
+    std::set<std::pair<unsigned long, EpochDomain*> >& live = liveDomains();
+    for(size_t i = 0; i < records.size(); i++)
+    {
+        std::set<std::pair<unsigned long, EpochDomain*> >::iterator it =
+            live.lower_bound(std::make_pair(records[i].first, (EpochDomain*)NULL));
+        if(it != live.end() && it->first == records[i].first)
+        {
+            it->second->release(records[i].second);
+        }
+    }
+}
+
+inline EpochDomain::Registry& EpochDomain::registry()
+{
+    static thread_local Registry mine;
+    return mine;
+}
+
+inline std::mutex& EpochDomain::liveLock()
+{
+    static std::mutex lock;
+    return lock;
+}
+
+inline std::set<std::pair<unsigned long, EpochDomain*> >& EpochDomain::liveDomains()
+{
+    static std::set<std::pair<unsigned long, EpochDomain*> > live;
+    return live;
+}
+
+/**
+* An AVLTree whose removed nodes are retired to an EpochDomain instead of
+* being deleted, so a reader inside an EpochDomain::Guard never touches
+* freed memory. Writers still have to be serialized. clear() and the
+* destructor free nodes right away and need all readers to be gone.
+*/
+template <class Key, class Value>
+class EpochAVLTree : public AVLTree<Key, Value>
+{
+public:
+    EpochAVLTree(EpochDomain& domain);
+    EpochDomain& domain() const;
+
+protected:
+    virtual void destroyNode(AVLNode<Key, Value>* node);
+    virtual bool parallelBuildSafe() const;
+    static void deleteNode(void* node);
+
+    EpochDomain& domain_;
+};
+
+template<class Key, class Value>
+EpochAVLTree<Key, Value>::EpochAVLTree(EpochDomain& domain) : domain_(domain)
+{
+
+}
+
+template<class Key, class Value>
+EpochDomain& EpochAVLTree<Key, Value>::domain() const
+{
+    return domain_;
+}
+
+template<class Key, class Value>
+void EpochAVLTree<Key, Value>::destroyNode(AVLNode<Key, Value>* node)
+{
+    domain_.retire(node, deleteNode);
+}
+
+/*
+ * A helper thread would delete removed nodes instead of retiring them.
+ */
+template<class Key, class Value>
+bool EpochAVLTree<Key, Value>::parallelBuildSafe() const
+{
+    return false;
+}
+
+template<class Key, class Value>
+void EpochAVLTree<Key, Value>::deleteNode(void* node)
+{
+    delete static_cast<AVLNode<Key, Value>*>(node);
+}
+
+#endif
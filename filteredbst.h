@@ -0,0 +1,334 @@
+#ifndef FILTEREDBST_H
+#define FILTEREDBST_H
+
+#include <iostream>
+#include <exception>
+#include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include <utility>
+#include <functional>
+#include "bst.h"
+#include "avlbst.h"
+#include "hashmix.h"
+
+/**
+* A counting Bloom filter, so keys can be removed again. It is blocked:
+* all probes for a key fall in one 64-byte block of 128 four-bit counters,
+* which keeps a query to a single cache miss. Blocking raises the false
+* positive rate, so blocks get a quarter more counters than a classic
+* filter would need. Counters saturate at 15 and are then never
+* decremented, which can only cost false positives.
+*/
+template <typename Key, typename Hash = std::hash<Key> >
+class CountingBloomFilter
+{
+public:
+    CountingBloomFilter(size_t expectedItems, double falsePositiveRate);
+
+    void add(const Key& key);
+    void remove(const Key& key);
+    bool mayContain(const Key& key) const;
+    void clear();
+    size_t capacity() const;
+
+protected:
+    enum { BLOCK = 64, SLOTS = 128 };
+
+    uint64_t hashOf(const Key& key) const;
+    static unsigned int get(const uint8_t* block, unsigned int slot);
+    static void set(uint8_t* block, unsigned int slot, unsigned int count);
+
+    std::vector<uint8_t> counters_;
+    size_t blocks_;
+    unsigned int probes_;
+    size_t capacity_;
+    Hash hash_;
+};
+
+/**
+* Sizes the filter for expectedItems keys at the given false positive
+* rate, using the usual m = -n ln p / (ln 2)^2 counters and k = m/n ln 2
+* probes per key.
+*/
+template<typename Key, typename Hash>
+CountingBloomFilter<Key, Hash>::CountingBloomFilter(size_t expectedItems, double falsePositiveRate) :
+    capacity_(expectedItems == 0 ? 1 : expectedItems)
+{
+    double counters = -(double)capacity_ * std::log(falsePositiveRate) / (std::log(2.0) * std::log(2.0));
+    blocks_ = (size_t)std::ceil(1.25 * counters / SLOTS);
+    if(blocks_ == 0)
+    {
+        blocks_ = 1;
+    }
+    probes_ = (unsigned int)std::lround(counters / capacity_ * std::log(2.0));
+    if(probes_ < 1)
+    {
+        probes_ = 1;
+    }
+    if(probes_ > 9)
+    {
+        probes_ = 9;
+    }
+    counters_.assign(blocks_ * BLOCK, 0);
+}
+
+template<typename Key, typename Hash>
+uint64_t CountingBloomFilter<Key, Hash>::hashOf(const Key& key) const
+{
+    return mixHash(static_cast<uint64_t>(hash_(key)));
+}
+
+template<typename Key, typename Hash>
+unsigned int CountingBloomFilter<Key, Hash>::get(const uint8_t* block, unsigned int slot)
+{
+    return (block[slot / 2] >> (4 * (slot & 1))) & 0xf;
+}
+
+template<typename Key, typename Hash>
+void CountingBloomFilter<Key, Hash>::set(uint8_t* block, unsigned int slot, unsigned int count)
+{
+    unsigned int shift = 4 * (slot & 1);
+    block[slot / 2] = (block[slot / 2] & ~(0xf << shift)) | (count << shift);
+}
+
+// The hash picks the block, and every probe takes the next 7 bits of a
+// second hash as its slot inside it.
+template<typename Key, typename Hash>
+void CountingBloomFilter<Key, Hash>::add(const Key& key)
+{
+    uint64_t hash = hashOf(key);
+    uint8_t* block = &counters_[(hash % blocks_) * BLOCK];
+    uint64_t slots = mixHash(hash);
+    for(unsigned int i = 0; i < probes_; i++, slots >>= 7)
+    {
+        unsigned int count = get(block, slots & (SLOTS - 1));
+        if(count != 15)
+        {
+            set(block, slots & (SLOTS - 1), count + 1);
+        }
+    }
+}
+
+template<typename Key, typename Hash>
+void CountingBloomFilter<Key, Hash>::remove(const Key& key)
+{
+    uint64_t hash = hashOf(key);
+    uint8_t* block = &counters_[(hash % blocks_) * BLOCK];
+    uint64_t slots = mixHash(hash);
+    for(unsigned int i = 0; i < probes_; i++, slots >>= 7)
+    {
+        unsigned int count = get(block, slots & (SLOTS - 1));
+        if(count != 15 && count != 0)
+        {
+            set(block, slots & (SLOTS - 1), count - 1);
+        }
+    }
+}
+
+/**
+* False means key was definitely never added (or has been removed).
+*/
+template<typename Key, typename Hash>
+bool CountingBloomFilter<Key, Hash>::mayContain(const Key& key) const
+{
+    uint64_t hash = hashOf(key);
+    const uint8_t* block = &counters_[(hash % blocks_) * BLOCK];
+    uint64_t slots = mixHash(hash);
+    for(unsigned int i = 0; i < probes_; i++, slots >>= 7)
+    {
+        if(get(block, slots & (SLOTS - 1)) == 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+template<typename Key, typename Hash>
+void CountingBloomFilter<Key, Hash>::clear()
+{
+    counters_.assign(counters_.size(), 0);
+}
+
+/**
+* The number of keys the filter was sized for.
+*/
+template<typename Key, typename Hash>
+size_t CountingBloomFilter<Key, Hash>::capacity() const
+{
+    return capacity_;
+}
+
+/**
+* A tree with a counting Bloom filter in front of it, so lookups of keys
+* that are not present usually return end() without touching the tree.
+* All changes go through this class to keep the filter in step, which is
+* why it wraps the tree instead of deriving from it: copies, splits,
+* merges and node handles of the tree could otherwise add keys behind the
+* filter's back. The filter is rebuilt at twice the size whenever the
+* tree outgrows it, so the false positive rate stays near its target.
+*/
+template <class Key, class Value, class Tree = AVLTree<Key, Value> >
+class FilteredTree
+{
+public:
+    typedef typename BinarySearchTree<Key, Value>::iterator iterator;
+
+    FilteredTree(size_t expectedItems = 1024, double falsePositiveRate = 0.01);
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    iterator find(const Key& key) const;
+    iterator begin() const;
+    iterator end() const;
+    bool empty() const;
+    size_t size() const;
+
+    size_t lookups() const;
+    size_t shortCircuits() const;
+    const Tree& tree() const;
+
+protected:
+    void grow();
+
+    Tree tree_;
+    CountingBloomFilter<Key> filter_;
+    double falsePositiveRate_;
+    size_t size_;
+    mutable size_t lookups_;
+    mutable size_t shortCircuits_;
+};
+
+template<class Key, class Value, class Tree>
+FilteredTree<Key, Value, Tree>::FilteredTree(size_t expectedItems, double falsePositiveRate) :
+    filter_(expectedItems, falsePositiveRate), falsePositiveRate_(falsePositiveRate),
+    size_(0), lookups_(0), shortCircuits_(0)
+{
+
+}
+
+/**
+* Overwriting an existing key leaves the filter alone; the key only
+* counts once.
+*/
+template<class Key, class Value, class Tree>
+void FilteredTree<Key, Value, Tree>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    const Value& value = keyValuePair.second;
+    if(!tree_.upsert(keyValuePair.first, value, [&value](Value& stored) { stored = value; }))
+    {
+        return;
+    }
+    filter_.add(keyValuePair.first);
+    if(++size_ > filter_.capacity())
+    {
+        grow();
+    }
+}
+
+/**
+* The key is looked up once and its node erased through the iterator, so
+* the filter is only decremented for keys that were really there.
+*/
+template<class Key, class Value, class Tree>
+void FilteredTree<Key, Value, Tree>::remove(const Key& key)
+{
+    if(!filter_.mayContain(key))
+    {
+        return;
+    }
+    iterator it = tree_.find(key);
+    if(it == tree_.end())
+    {
+        return;
+    }
+    tree_.erase(it);
+    filter_.remove(key);
+    size_--;
+}
+
+template<class Key, class Value, class Tree>
+void FilteredTree<Key, Value, Tree>::clear()
+{
+    tree_.clear();
+    filter_.clear();
+    size_ = 0;
+}
+
+template<class Key, class Value, class Tree>
+typename FilteredTree<Key, Value, Tree>::iterator FilteredTree<Key, Value, Tree>::find(const Key& key) const
+{
+    lookups_++;
+    if(!filter_.mayContain(key))
+    {
+        shortCircuits_++;
+        return tree_.end();
+    }
+    return tree_.find(key);
+}
+
+template<class Key, class Value, class Tree>
+typename FilteredTree<Key, Value, Tree>::iterator FilteredTree<Key, Value, Tree>::begin() const
+{
+    return tree_.begin();
+}
+
+template<class Key, class Value, class Tree>
+typename FilteredTree<Key, Value, Tree>::iterator FilteredTree<Key, Value, Tree>::end() const
+{
+    return tree_.end();
+}
+
+template<class Key, class Value, class Tree>
+bool FilteredTree<Key, Value, Tree>::empty() const
+{
+    return size_ == 0;
+}
+
+template<class Key, class Value, class Tree>
+size_t FilteredTree<Key, Value, Tree>::size() const
+{
+    return size_;
+}
+
+/**
+* How many finds were made, and how many of them the filter answered
+* without searching the tree.
+*/
+template<class Key, class Value, class Tree>
+size_t FilteredTree<Key, Value, Tree>::lookups() const
+{
+    return lookups_;
+}
+
+template<class Key, class Value, class Tree>
+size_t FilteredTree<Key, Value, Tree>::shortCircuits() const
+{
+    return shortCircuits_;
+}
+
+/**
+* Read-only access to the tree, for anything this class does not wrap.
+*/
+template<class Key, class Value, class Tree>
+const Tree& FilteredTree<Key, Value, Tree>::tree() const
+{
+    return tree_;
+}
+
+template<class Key, class Value, class Tree>
+void FilteredTree<Key, Value, Tree>::grow()
+{
+    CountingBloomFilter<Key> bigger(2 * filter_.capacity(), falsePositiveRate_);
+    for(iterator it = tree_.begin(); it != tree_.end(); ++it)
+    {
+        bigger.add(it->first);
+    }
+    filter_ = bigger;
+}
+
+#endif
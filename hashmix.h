@@ -0,0 +1,21 @@
+#ifndef HASHMIX_H
+#define HASHMIX_H
+
+#include <cstdint>
+
+/*
+ * The splitmix64 finalizer. Hash tables and filters run std::hash through
+ * it first, since std::hash<int> is the identity and would put runs of
+ * keys into runs of buckets.
+ */
+inline uint64_t mixHash(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    return x;
+}
+
+#endif
@@ -0,0 +1,238 @@
+#ifndef HUGEPAGES_H
+#define HUGEPAGES_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <vector>
+#include <sys/mman.h>
+
+/**
+* Hands out memory from large regions that are backed by huge pages when
+* the system allows it, so a big tree spans a few hundred TLB entries
+* instead of one per 4K page. Each region is tried as:
+*
+*   HUGETLB     mmap with MAP_HUGETLB, from the reserved huge page pool
+*               (vm.nr_hugepages), which is usually empty;
+*   TRANSPARENT an ordinary mapping aligned to 2M and marked with
+*               madvise(MADV_HUGEPAGE), which the kernel backs with huge
+*               pages as it can when transparent huge pages are enabled;
+*   PAGES       the same mapping if madvise is refused;
+*   HEAP        aligned heap memory, if mmap fails or huge pages are off.
+*
+* Region memory is only given back all at once, by release() or the
+* destructor; the arena is meant for containers that keep their own free
+* lists. Without huge pages there are no regions: every allocate is a
+* plain heap allocation that the caller hands back with deallocate.
+*/
+class HugePageArena
+{
+public:
+    enum Backing { HEAP, PAGES, TRANSPARENT, HUGETLB };
+    enum { HUGE_PAGE = 2 << 20, ALIGN = 64 };
+
+    explicit HugePageArena(bool hugePages = true, size_t regionBytes = 32 << 20);
+    ~HugePageArena();
+
+    void* allocate(size_t bytes);
+    void deallocate(void* memory, size_t bytes);
+    void release();
+    bool hugePages() const;
+    Backing backing() const;
+    size_t reserved() const;
+
+protected:
+    struct Region
+    {
+        void* base;
+        size_t bytes;
+        Backing backing;
+    };
+
+    Region map(size_t bytes) const;
+    static void unmap(const Region& region);
+    static void* heapAllocate(size_t bytes);
+
+    bool hugePages_;
+    size_t regionBytes_;
+    std::vector<Region> regions_;
+    char* next_;
+    char* end_;
+    size_t heapBytes_;
+
+private:
+    HugePageArena(const HugePageArena&);
+    HugePageArena& operator=(const HugePageArena&);
+};
+
+/**
+* regionBytes is rounded up to whole huge pages.
+*/
+inline HugePageArena::HugePageArena(bool hugePages, size_t regionBytes) :
+    hugePages_(hugePages), regionBytes_((regionBytes + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE),
+    next_(NULL), end_(NULL), heapBytes_(0)
+{
+    if(regionBytes_ == 0)
+    {
+        regionBytes_ = HUGE_PAGE;
+    }
+}
+
+inline HugePageArena::~HugePageArena()
+{
+    release();
+}
+
+/**
+* Returns bytes of memory aligned to a cache line. Requests that do not
+* fit in the current region start a new one; the rest of the old region
+* is left unused.
+*/
+inline void* HugePageArena::allocate(size_t bytes)
+{
+    bytes = (bytes + ALIGN - 1) / ALIGN * ALIGN;
+    if(!hugePages_)
+    {
+        void* memory = heapAllocate(bytes);
+        heapBytes_ += bytes;
+        return memory;
+    }
+    if(next_ == NULL || (size_t)(end_ - next_) < bytes)
+    {
+        size_t size = bytes > regionBytes_ ? (bytes + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE : regionBytes_;
+        Region region = map(size);
+        regions_.push_back(region);
+        next_ = static_cast<char*>(region.base);
+        end_ = next_ + region.bytes;
+    }
+    void* result = next_;
+    next_ += bytes;
+    return result;
+}
+
+/**
+* Frees memory from allocate right away when it came from the heap. Memory
+* in a region stays reserved until release.
+*/
+inline void HugePageArena::deallocate(void* memory, size_t bytes)
+{
+    if(!hugePages_)
+    {
+        heapBytes_ -= (bytes + ALIGN - 1) / ALIGN * ALIGN;
+        std::free(memory);
+    }
+}
+
+/**
+* Gives every region back. Whatever was allocated from them must not be
+* used any more.
+*/
+inline void HugePageArena::release()
+{
+    for(size_t i = 0; i < regions_.size(); i++)
+    {
+        unmap(regions_[i]);
+    }
+    regions_.clear();
+    next_ = NULL;
+    end_ = NULL;
+}
+
+inline bool HugePageArena::hugePages() const
+{
+    return hugePages_;
+}
+
+/**
+* How the most recent region is backed. TRANSPARENT only means the kernel
+* was asked; AnonHugePages in /proc/self/smaps tells how much it granted.
+*/
+inline HugePageArena::Backing HugePageArena::backing() const
+{
+    return regions_.empty() ? HEAP : regions_.back().backing;
+}
+
+/**
+* Bytes held in regions, used or not, plus heap memory not yet handed back.
+*/
+inline size_t HugePageArena::reserved() const
+{
+    size_t total = heapBytes_;
+    for(size_t i = 0; i < regions_.size(); i++)
+    {
+        total += regions_[i].bytes;
+    }
+    return total;
+}
+
+/*
+ * For transparent huge pages the mapping is made one huge page larger
+ * than needed and trimmed to a 2M boundary, since only aligned 2M ranges
+ * can be backed by a huge page.
+ */
+inline HugePageArena::Region HugePageArena::map(size_t bytes) const
+{
+    Region region = { NULL, bytes, HUGETLB };
+#ifdef MAP_HUGETLB
+    void* base = ::mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if(base != MAP_FAILED)
+    {
+        region.base = base;
+        return region;
+    }
+#endif
+    void* raw = ::mmap(NULL, bytes + HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(raw == MAP_FAILED)
+    {
+        region.base = heapAllocate(bytes);
+        region.backing = HEAP;
+        return region;
+    }
+    uintptr_t start = reinterpret_cast<uintptr_t>(raw);
+    uintptr_t aligned = (start + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+    if(aligned != start)
+    {
+        ::munmap(raw, aligned - start);
+    }
+    if(aligned + bytes != start + bytes + HUGE_PAGE)
+    {
+        ::munmap(reinterpret_cast<void*>(aligned + bytes), start + HUGE_PAGE - aligned);
+    }
+    region.base = reinterpret_cast<void*>(aligned);
+    region.backing = PAGES;
+#ifdef MADV_HUGEPAGE
+    if(::madvise(region.base, bytes, MADV_HUGEPAGE) == 0)
+    {
+        region.backing = TRANSPARENT;
+    }
+#endif
+    return region;
+}
+
+inline void HugePageArena::unmap(const Region& region)
+{
+    if(region.backing == HEAP)
+    {
+        std::free(region.base);
+    }
+    else
+    {
+        ::munmap(region.base, region.bytes);
+    }
+}
+
+/*
+ * ::operator new only promises 16-byte alignment before C++17.
+ */
+inline void* HugePageArena::heapAllocate(size_t bytes)
+{
+    void* memory = NULL;
+    if(::posix_memalign(&memory, ALIGN, bytes) != 0)
+    {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+#endif
@@ -0,0 +1,196 @@
+#ifndef INTERVALBST_H
+#define INTERVALBST_H
+
+#include <iostream>
+#include <exception>
+#include <cstdlib>
+#include <cstddef>
+#include <limits>
+#include <utility>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include "aggavlbst.h"
+
+/*
+ * Keeps the largest high endpoint in a subtree of [low, high] intervals.
+ */
+template <typename Key, typename Value>
+struct MaxEndMonoid
+{
+    typedef Key type;
+    static type identity() { return std::numeric_limits<Key>::lowest(); }
+    static type combine(const type& a, const type& b) { return a < b ? b : a; }
+    static type lift(const std::pair<Key, Key>& interval, const Value&) { return interval.second; }
+};
+
+/**
+* A tree of closed intervals [low, high] ordered by (low, high), built on
+* the AVL rotations with the largest high endpoint kept per subtree.
+* Overlap and stabbing queries report intervals in key order. Pruning on
+* the largest high endpoint bounds a query reporting k intervals by
+* O(min(n, (k + 1) log n)); it is not the O(log n + k) of a centered or
+* priority search tree. Intervals with low above high are rejected with
+* std::invalid_argument, since they would break the pruning.
+*/
+template <class Key, class Value>
+class IntervalTree : public AggregateAVLTree<std::pair<Key, Key>, Value, MaxEndMonoid<Key, Value> >
+{
+public:
+    typedef std::pair<Key, Key> Interval;
+    typedef std::pair<const Interval, Value> Item;
+
+    void insert(const Key& low, const Key& high, const Value& value);
+    void remove(const Key& low, const Key& high);
+    using AggregateAVLTree<Interval, Value, MaxEndMonoid<Key, Value> >::insert;
+    using AggregateAVLTree<Interval, Value, MaxEndMonoid<Key, Value> >::remove;
+    virtual void insert(const Item& item);
+    template<typename Iterator>
+    void applySorted(Iterator first, Iterator last, unsigned int threads = 1);
+
+    template<typename Visitor>
+    size_t overlaps(const Key& low, const Key& high, Visitor visit) const;
+    template<typename Visitor>
+    size_t stab(const Key& point, Visitor visit) const;
+    template<typename Visitor>
+    size_t overlapsBatch(const std::vector<Interval>& queries, Visitor visit) const;
+
+protected:
+    typedef AggregateAVLNode<Interval, Value, MaxEndMonoid<Key, Value> > IntervalNode;
+
+    virtual Node<Interval, Value>* findOrCreate(const Interval& key, const Value& init, bool& created);
+    static void checkInterval(const Interval& interval);
+
+    template<typename Visitor>
+    size_t overlapsHelper(IntervalNode* node, const Key& low, const Key& high, Visitor& visit) const;
+};
+
+template<class Key, class Value>
+void IntervalTree<Key, Value>::insert(const Key& low, const Key& high, const Value& value)
+{
+    this->insert(std::make_pair(Interval(low, high), value));
+}
+
+template<class Key, class Value>
+void IntervalTree<Key, Value>::remove(const Key& low, const Key& high)
+{
+    this->remove(Interval(low, high));
+}
+
+template<class Key, class Value>
+void IntervalTree<Key, Value>::insert(const Item& item)
+{
+    checkInterval(item.first);
+    AggregateAVLTree<Interval, Value, MaxEndMonoid<Key, Value> >::insert(item);
+}
+
+/**
+* Checks every interval in the batch before any of it is applied.
+*/
+template<class Key, class Value>
+template<typename Iterator>
+void IntervalTree<Key, Value>::applySorted(Iterator first, Iterator last, unsigned int threads)
+{
+    for(Iterator it = first; it != last; ++it)
+    {
+        if(!it->erase)
+        {
+            checkInterval(it->key);
+        }
+    }
+    AggregateAVLTree<Interval, Value, MaxEndMonoid<Key, Value> >::applySorted(first, last, threads);
+}
+
+/**
+* Calls visit(item) for every interval that overlaps [low, high] and
+* returns how many there were.
+*/
+template<class Key, class Value>
+template<typename Visitor>
+size_t IntervalTree<Key, Value>::overlaps(const Key& low, const Key& high, Visitor visit) const
+{
+    return overlapsHelper(this->getRoot(), low, high, visit);
+}
+
+/**
+* Calls visit(item) for every interval that contains point.
+*/
+template<class Key, class Value>
+template<typename Visitor>
+size_t IntervalTree<Key, Value>::stab(const Key& point, Visitor visit) const
+{
+    return overlapsHelper(this->getRoot(), point, point, visit);
+}
+
+/**
+* Answers many overlap queries at once, calling visit(queryIndex, item).
+* Queries are run in order of their low endpoint so that consecutive
+* searches walk mostly the same upper levels of the tree while they
+* are still in cache.
+*/
+template<class Key, class Value>
+template<typename Visitor>
+size_t IntervalTree<Key, Value>::overlapsBatch(const std::vector<Interval>& queries, Visitor visit) const
+{
+    std::vector<std::pair<Interval, size_t> > order(queries.size());
+    for(size_t i = 0; i < queries.size(); i++)
+    {
+        order[i] = std::make_pair(queries[i], i);
+    }
+    std::sort(order.begin(), order.end());
+
+    size_t found = 0;
+    for(size_t i = 0; i < order.size(); i++)
+    {
+        size_t index = order[i].second;
+        found += overlaps(order[i].first.first, order[i].first.second,
+            [&visit, index](const Item& item) { visit(index, item); });
+    }
+    return found;
+}
+
+/**
+* Skips any subtree whose largest high endpoint is below low, and stops
+* going right once the intervals start after high.
+*/
+template<class Key, class Value>
+template<typename Visitor>
+size_t IntervalTree<Key, Value>::overlapsHelper(IntervalNode* node, const Key& low, const Key& high, Visitor& visit) const
+{
+    if(node == nullptr || node->getAggregate() < low)
+    {
+        return 0;
+    }
+    size_t found = overlapsHelper(node->getLeft(), low, high, visit);
+    if(high < node->getKey().first)
+    {
+        return found;
+    }
+    if(!(node->getKey().second < low))
+    {
+        visit(node->getItem());
+        found++;
+    }
+    return found + overlapsHelper(node->getRight(), low, high, visit);
+}
+
+/*
+ * Covers upsert and items copied in by merge.
+ */
+template<class Key, class Value>
+Node<std::pair<Key, Key>, Value>* IntervalTree<Key, Value>::findOrCreate(const Interval& key, const Value& init, bool& created)
+{
+    checkInterval(key);
+    return AggregateAVLTree<Interval, Value, MaxEndMonoid<Key, Value> >::findOrCreate(key, init, created);
+}
+
+template<class Key, class Value>
+void IntervalTree<Key, Value>::checkInterval(const Interval& interval)
+{
+    if(interval.second < interval.first)
+    {
+        throw std::invalid_argument("interval low is above high");
+    }
+}
+
+#endif
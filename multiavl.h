@@ -0,0 +1,649 @@
+#ifndef MULTIAVL_H
+#define MULTIAVL_H
+
+#include <iostream>
+#include <exception>
+#include <cstdlib>
+#include <cstddef>
+#include <iterator>
+#include <new>
+#include <string>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include "avlbst.h"
+#include "serialize.h"
+
+/**
+* An AVLNode that holds every value stored under its key, in insertion
+* order. The first value is the node's own item and the next Inline are
+* built in raw storage inside the node, so a key repeated a few times
+* costs no allocation besides the node and Value needs no default
+* constructor. Only values past those spill into a heap block that grows
+* by doubling and is freed once it empties.
+*/
+template <typename Key, typename Value, size_t Inline = 3>
+class MultiAVLNode : public AVLNode<Key, Value>
+{
+    static_assert(Inline > 0, "MultiAVLNode needs room for at least one inline value");
+
+public:
+    typedef std::pair<const Key, Value> Item;
+
+    MultiAVLNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent);
+    MultiAVLNode(const MultiAVLNode& other) = delete;
+    MultiAVLNode& operator=(const MultiAVLNode& other) = delete;
+    virtual ~MultiAVLNode();
+
+    size_t count() const;
+    Item& occurrence(size_t index);
+    void add(const Value& value);
+    void removeAt(size_t index);
+
+    virtual MultiAVLNode<Key, Value, Inline>* getParent() const override;
+    virtual MultiAVLNode<Key, Value, Inline>* getLeft() const override;
+    virtual MultiAVLNode<Key, Value, Inline>* getRight() const override;
+    virtual MultiAVLNode<Key, Value, Inline>* clone() const override;
+
+protected:
+    Item* extra(size_t index);
+    void growSpill();
+    void freeSpill();
+
+    size_t count_;
+    size_t spillCapacity_;
+    typename std::aligned_storage<sizeof(Item), alignof(Item)>::type inline_[Inline];
+    Item* spill_;
+};
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the MultiAVLNode class.
+  ---------------------------------------------------
+*/
+
+template<class Key, class Value, size_t Inline>
+MultiAVLNode<Key, Value, Inline>::MultiAVLNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent) :
+    AVLNode<Key, Value>(key, value, parent), count_(1), spillCapacity_(0), spill_(NULL)
+{
+
+}
+
+template<class Key, class Value, size_t Inline>
+MultiAVLNode<Key, Value, Inline>::~MultiAVLNode()
+{
+    for(size_t i = 0; i + 1 < count_; i++)
+    {
+        extra(i)->~Item();
+    }
+    freeSpill();
+}
+
+/**
+* How many values are stored under the key; never 0 while the node is in
+* a tree.
+*/
+template<class Key, class Value, size_t Inline>
+size_t MultiAVLNode<Key, Value, Inline>::count() const
+{
+    return count_;
+}
+
+/**
+* The item inserted index-th under the key, counting from 0.
+*/
+template<class Key, class Value, size_t Inline>
+typename MultiAVLNode<Key, Value, Inline>::Item& MultiAVLNode<Key, Value, Inline>::occurrence(size_t index)
+{
+    return index == 0 ? this->item_ : *extra(index - 1);
+}
+
+template<class Key, class Value, size_t Inline>
+void MultiAVLNode<Key, Value, Inline>::add(const Value& value)
+{
+    if(count_ > Inline && count_ - 1 - Inline == spillCapacity_)
+    {
+        growSpill();
+    }
+    new (extra(count_ - 1)) Item(this->item_.first, value);
+    count_++;
+}
+
+/**
+* Drops one value and moves the later ones down, so the rest keep their
+* order. The last value of a node cannot be removed this way; the node
+* has to go instead.
+*/
+template<class Key, class Value, size_t Inline>
+void MultiAVLNode<Key, Value, Inline>::removeAt(size_t index)
+{
+    for(size_t i = index; i + 1 < count_; i++)
+    {
+        occurrence(i).second = std::move(occurrence(i + 1).second);
+    }
+    extra(count_ - 2)->~Item();
+    count_--;
+    if(count_ <= Inline + 1)
+    {
+        freeSpill();
+    }
+}
+
+/**
+* The index-th value after the first, inline or spilled.
+*/
+template<class Key, class Value, size_t Inline>
+typename MultiAVLNode<Key, Value, Inline>::Item* MultiAVLNode<Key, Value, Inline>::extra(size_t index)
+{
+    if(index < Inline)
+    {
+        return reinterpret_cast<Item*>(&inline_[index]);
+    }
+    return spill_ + (index - Inline);
+}
+
+/**
+* Doubles the spill block. The spilled items are moved over if that
+* cannot throw and copied otherwise, so a failure leaves them in place.
+*/
+template<class Key, class Value, size_t Inline>
+void MultiAVLNode<Key, Value, Inline>::growSpill()
+{
+    size_t capacity = spillCapacity_ == 0 ? Inline + 1 : 2 * spillCapacity_;
+    Item* spill = static_cast<Item*>(::operator new(capacity * sizeof(Item)));
+    size_t built = 0;
+    try
+    {
+        for(; built < spillCapacity_; built++)
+        {
+            new (spill + built) Item(this->item_.first, std::move_if_noexcept(spill_[built].second));
+        }
+    }
+    catch(...)
+    {
+        while(built > 0)
+        {
+            spill[--built].~Item();
+        }
+        ::operator delete(spill);
+        throw;
+    }
+    for(size_t i = 0; i < spillCapacity_; i++)
+    {
+        spill_[i].~Item();
+    }
+    ::operator delete(spill_);
+    spill_ = spill;
+    spillCapacity_ = capacity;
+}
+
+/**
+* Releases the spill block, whose items must already be destroyed.
+*/
+template<class Key, class Value, size_t Inline>
+void MultiAVLNode<Key, Value, Inline>::freeSpill()
+{
+    ::operator delete(spill_);
+    spill_ = NULL;
+    spillCapacity_ = 0;
+}
+
+template<class Key, class Value, size_t Inline>
+MultiAVLNode<Key, Value, Inline>* MultiAVLNode<Key, Value, Inline>::getParent() const
+{
+    return static_cast<MultiAVLNode<Key, Value, Inline>*>(this->parent_);
+}
+
+template<class Key, class Value, size_t Inline>
+MultiAVLNode<Key, Value, Inline>* MultiAVLNode<Key, Value, Inline>::getLeft() const
+{
+    return static_cast<MultiAVLNode<Key, Value, Inline>*>(this->left_);
+}
+
+template<class Key, class Value, size_t Inline>
+MultiAVLNode<Key, Value, Inline>* MultiAVLNode<Key, Value, Inline>::getRight() const
+{
+    return static_cast<MultiAVLNode<Key, Value, Inline>*>(this->right_);
+}
+
+/**
+* Copies the item, balance and the other values, but none of the links.
+*/
+template<class Key, class Value, size_t Inline>
+MultiAVLNode<Key, Value, Inline>* MultiAVLNode<Key, Value, Inline>::clone() const
+{
+    MultiAVLNode<Key, Value, Inline>* copy = new MultiAVLNode<Key, Value, Inline>(this->item_.first, this->item_.second, NULL);
+    copy->setBalance(this->balance_);
+    try
+    {
+        for(size_t i = 1; i < count_; i++)
+        {
+            copy->add(const_cast<MultiAVLNode<Key, Value, Inline>*>(this)->occurrence(i).second);
+        }
+    }
+    catch(...)
+    {
+        delete copy;
+        throw;
+    }
+    return copy;
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the MultiAVLNode class.
+  -------------------------------------------------
+*/
+
+/**
+* An AVLTree that keeps duplicate keys, like std::multimap. Equal keys
+* share one counted node, so count and equal_range take one descent and
+* the tree is no deeper than it would be with the distinct keys alone.
+*
+* The iterator of this class visits every item, key by key and in
+* insertion order within a key, and erase(pos) removes just the one item
+* it points at. remove(key) drops the key with all its values, update
+* and upsert change every value stored under the key, and merge and
+* serialize keep every value. operator[] and applySorted, which assume
+* one value per key, are not available.
+*
+* Node handles and split and join move a key's node with all its values.
+* The rest of the AVLTree interface, and anything called through a base
+* class reference, sees only the first value of each key; in particular
+* a tree of another type that merges this one takes the first value of
+* each key and frees the others.
+*/
+template <class Key, class Value, size_t Inline = 3>
+class AVLMultiTree : public AVLTree<Key, Value>
+{
+public:
+    /**
+    * Points at one item stored under a key.
+    */
+    class iterator
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef value_type* pointer;
+        typedef value_type& reference;
+
+        iterator();
+
+        reference operator*() const;
+        pointer operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+
+    protected:
+        friend class AVLMultiTree<Key, Value, Inline>;
+
+        iterator(MultiAVLNode<Key, Value, Inline>* node, size_t index = 0);
+
+        MultiAVLNode<Key, Value, Inline>* node_;
+        // which of the node's values, in insertion order
+        size_t index_;
+    };
+
+    using AVLTree<Key, Value>::insert;
+    virtual void insert(const std::pair<const Key, Value>& keyValuePair);
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    size_t count(const Key& key) const;
+    std::pair<iterator, iterator> equal_range(const Key& key) const;
+    iterator erase(iterator pos);
+
+    template<typename Function>
+    bool update(const Key& key, Function fn);
+    template<typename Function>
+    bool upsert(const Key& key, const Value& init, Function fn);
+    void merge(AVLTree<Key, Value>& other);
+    void serialize(std::ostream& out) const;
+    void deserialize(std::istream& in);
+
+    Value& operator[](const Key& key) = delete;
+    Value const & operator[](const Key& key) const = delete;
+    template<typename Iterator>
+    void applySorted(Iterator first, Iterator last, unsigned int threads = 1) = delete;
+
+protected:
+    typedef MultiAVLNode<Key, Value, Inline> MultiNode;
+
+    virtual AVLNode<Key, Value>* createNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent) const;
+    virtual const std::type_info& nodeType() const;
+
+    MultiNode* multiFind(const Key& key) const;
+    static iterator nextKey(MultiNode* node);
+};
+
+/*
+---------------------------------------------------------
+Begin implementations for the AVLMultiTree::iterator class.
+---------------------------------------------------------
+*/
+
+template<class Key, class Value, size_t Inline>
+AVLMultiTree<Key, Value, Inline>::iterator::iterator() : node_(NULL), index_(0)
+{
+
+}
+
+template<class Key, class Value, size_t Inline>
+AVLMultiTree<Key, Value, Inline>::iterator::iterator(MultiAVLNode<Key, Value, Inline>* node, size_t index) :
+    node_(node), index_(index)
+{
+
+}
+
+template<class Key, class Value, size_t Inline>
+typename AVLMultiTree<Key, Value, Inline>::iterator::reference
+AVLMultiTree<Key, Value, Inline>::iterator::operator*() const
+{
+    return node_->occurrence(index_);
+}
+
+template<class Key, class Value, size_t Inline>
+typename AVLMultiTree<Key, Value, Inline>::iterator::pointer
+AVLMultiTree<Key, Value, Inline>::iterator::operator->() const
+{
+    return &**this;
+}
+
+template<class Key, class Value, size_t Inline>
+bool AVLMultiTree<Key, Value, Inline>::iterator::operator==(const iterator& rhs) const
+{
+    return node_ == rhs.node_ && index_ == rhs.index_;
+}
+
+template<class Key, class Value, size_t Inline>
+bool AVLMultiTree<Key, Value, Inline>::iterator::operator!=(const iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+/**
+* Moves to the next value under the same key, or to the first value of
+* the next key.
+*/
+template<class Key, class Value, size_t Inline>
+typename AVLMultiTree<Key, Value, Inline>::iterator&
+AVLMultiTree<Key, Value, Inline>::iterator::operator++()
+{
+    if(++index_ == node_->count())
+    {
+        *this = nextKey(node_);
+    }
+    return *this;
+}
+
+/*
+-------------------------------------------------------
+End implementations for the AVLMultiTree::iterator class.
+-------------------------------------------------------
+*/
+
+/*
+ * An equal key gets one more value instead of having its value
+ * overwritten.
+ */
+template<class Key, class Value, size_t Inline>
+void AVLMultiTree<Key, Value, Inline>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    bool goesLeft = 0;
+    AVLNode<Key, Value>* parent = nullptr;
+    AVLNode<Key, Value>* current = this->insertPosition(keyValuePair.first, parent, goesLeft);
+    if(current != nullptr)
+    {
+        static_cast<MultiNode*>(current)->add(keyValuePair.second);
+        this->updatePath(current);
+        return;
+    }
+    this->linkNode(createNode(keyValuePair.first, keyValuePair.second, parent), parent, goesLeft);
+}
+
+template<class Key, class Value, size_t Inline>
+typename AVLMultiTree<Key, Value, Inline>::iterator AVLMultiTree<Key, Value, Inline>::begin() const
+{
+    return iterator(static_cast<MultiNode*>(this->getSmallestNode()));
+}
+
+template<class Key, class Value, size_t Inline>
+typename AVLMultiTree<Key, Value, Inline>::iterator AVLMultiTree<Key, Value, Inline>::end() const
+{
+    return iterator();
+}
+
+/**
+* Returns an iterator to the first value stored under key, or end().
+*/
+template<class Key, class Value, size_t Inline>
+typename AVLMultiTree<Key, Value, Inline>::iterator AVLMultiTree<Key, Value, Inline>::find(const Key& key) const
+{
+    return iterator(multiFind(key));
+}
+
+/**
+* How many values are stored under key, in O(log n).
+*/
+template<class Key, class Value, size_t Inline>
+size_t AVLMultiTree<Key, Value, Inline>::count(const Key& key) const
+{
+    MultiNode* node = multiFind(key);
+    return node == nullptr ? 0 : node->count();
+}
+
+/**
+* The values stored under key, as a range that is empty if there are
+* none. One descent, plus a successor step to find where the range ends.
+*/
+template<class Key, class Value, size_t Inline>
+std::pair<typename AVLMultiTree<Key, Value, Inline>::iterator, typename AVLMultiTree<Key, Value, Inline>::iterator>
+AVLMultiTree<Key, Value, Inline>::equal_range(const Key& key) const
+{
+    MultiNode* node = multiFind(key);
+    if(node == nullptr)
+    {
+        return std::make_pair(end(), end());
+    }
+    return std::make_pair(iterator(node), nextKey(node));
+}
+
+/**
+* Removes the one item pos points at and returns an iterator to the item
+* after it. The key's node is only unlinked with its last value. The
+* later values of the key move down one place, so iterators to them are
+* invalidated as well.
+*/
+template<class Key, class Value, size_t Inline>
+typename AVLMultiTree<Key, Value, Inline>::iterator AVLMultiTree<Key, Value, Inline>::erase(iterator pos)
+{
+    MultiNode* node = pos.node_;
+    if(node == nullptr)
+    {
+        return end();
+    }
+    if(node->count() > 1)
+    {
+        node->removeAt(pos.index_);
+        this->valueChanged(node);
+        return pos.index_ < node->count() ? pos : nextKey(node);
+    }
+    // nodeSwap moves nodes rather than items, so the successor survives the removal
+    iterator next = nextKey(node);
+    this->removeNode(node);
+    return next;
+}
+
+/**
+ * Calls fn(value) on every value stored under key, in place, and
+ * returns true; returns false if the key is not in the map.
+ */
+template<class Key, class Value, size_t Inline>
+template<typename Function>
+bool AVLMultiTree<Key, Value, Inline>::update(const Key& key, Function fn)
+{
+    MultiNode* node = multiFind(key);
+    if(node == nullptr)
+    {
+        return false;
+    }
+    for(size_t i = 0; i < node->count(); i++)
+    {
+        fn(node->occurrence(i).second);
+    }
+    this->valueChanged(node);
+    return true;
+}
+
+/**
+ * Inserts init under key if the key is new, otherwise calls fn(value) on
+ * every value stored under it. Returns true if a new item was inserted.
+ */
+template<class Key, class Value, size_t Inline>
+template<typename Function>
+bool AVLMultiTree<Key, Value, Inline>::upsert(const Key& key, const Value& init, Function fn)
+{
+    if(update(key, fn))
+    {
+        return false;
+    }
+    insert(std::make_pair(key, init));
+    return true;
+}
+
+/**
+* Moves every item of other into this tree, as std::multimap::merge
+* does, leaving other empty. Nodes of keys this tree does not have yet
+* are relinked as they are; the values of the other keys are copied in
+* after the ones this tree already holds.
+*/
+template<class Key, class Value, size_t Inline>
+void AVLMultiTree<Key, Value, Inline>::merge(AVLTree<Key, Value>& other)
+{
+    if(&other == this)
+    {
+        return;
+    }
+    AVLTree<Key, Value>::merge(other);
+    for(typename BinarySearchTree<Key, Value>::iterator it = other.begin(); it != other.end(); ++it)
+    {
+        MultiNode* node = multiFind(it->first);
+        node->add(it->second);
+        MultiNode* source = dynamic_cast<MultiNode*>(this->iteratorNode(it));
+        for(size_t i = 1; source != nullptr && i < source->count(); i++)
+        {
+            node->add(source->occurrence(i).second);
+        }
+        this->valueChanged(node);
+    }
+    other.clear();
+}
+
+/**
+* Writes every item in the format of BinarySearchTree::serialize, equal
+* keys one after another, behind a magic string of its own so that a
+* tree without duplicates refuses the stream.
+*/
+template<class Key, class Value, size_t Inline>
+void AVLMultiTree<Key, Value, Inline>::serialize(std::ostream& out) const
+{
+    uint64_t count = 0;
+    for(iterator it = begin(); it != end(); ++it)
+    {
+        count++;
+    }
+    std::string buffer("BSM", 3);
+    buffer += static_cast<char>(1);
+    writeVarint(buffer, count);
+
+    std::string item;
+    for(iterator it = begin(); it != end(); ++it)
+    {
+        item.clear();
+        SerializeTraits<Key>::write(item, it->first);
+        writeVarint(buffer, item.size());
+        buffer += item;
+        item.clear();
+        SerializeTraits<Value>::write(item, it->second);
+        writeVarint(buffer, item.size());
+        buffer += item;
+        if(buffer.size() >= 65536)
+        {
+            out.write(buffer.data(), buffer.size());
+            buffer.clear();
+        }
+    }
+    out.write(buffer.data(), buffer.size());
+    if(!out)
+    {
+        throw std::runtime_error("failed to write tree stream");
+    }
+}
+
+/**
+* Replaces the contents of the tree with a stream written by serialize,
+* either this class's or BinarySearchTree's. The items are inserted one
+* by one into a new tree, so a bad stream throws and leaves this one
+* unchanged.
+*/
+template<class Key, class Value, size_t Inline>
+void AVLMultiTree<Key, Value, Inline>::deserialize(std::istream& in)
+{
+    char header[4];
+    uint64_t count = 0;
+    if(!in.read(header, 4) || (std::string(header, 3) != "BSM" && std::string(header, 3) != "BST"))
+    {
+        throw std::runtime_error("not a tree stream");
+    }
+    if(header[3] != 1)
+    {
+        throw std::runtime_error("unsupported tree stream version");
+    }
+    if(!readVarint(in, count))
+    {
+        throw std::runtime_error("truncated tree stream");
+    }
+    AVLMultiTree<Key, Value, Inline> built;
+    std::string buffer;
+    for(uint64_t i = 0; i < count; i++)
+    {
+        Key key;
+        Value value;
+        readItem(in, buffer, key);
+        readItem(in, buffer, value);
+        built.insert(std::make_pair(key, value));
+    }
+    this->swap(built);
+}
+
+template<class Key, class Value, size_t Inline>
+AVLNode<Key, Value>* AVLMultiTree<Key, Value, Inline>::createNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent) const
+{
+    return new MultiNode(key, value, parent);
+}
+
+template<class Key, class Value, size_t Inline>
+const std::type_info& AVLMultiTree<Key, Value, Inline>::nodeType() const
+{
+    return typeid(MultiNode);
+}
+
+template<class Key, class Value, size_t Inline>
+typename AVLMultiTree<Key, Value, Inline>::MultiNode* AVLMultiTree<Key, Value, Inline>::multiFind(const Key& key) const
+{
+    return static_cast<MultiNode*>(this->internalFind(key));
+}
+
+template<class Key, class Value, size_t Inline>
+typename AVLMultiTree<Key, Value, Inline>::iterator AVLMultiTree<Key, Value, Inline>::nextKey(MultiNode* node)
+{
+    return iterator(static_cast<MultiNode*>(BinarySearchTree<Key, Value>::successor(node)));
+}
+
+#endif
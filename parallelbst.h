@@ -0,0 +1,324 @@
+#ifndef PARALLELBST_H
+#define PARALLELBST_H
+
+#include <iostream>
+#include <exception>
+#include <cstdlib>
+#include <cstddef>
+#include <vector>
+#include <deque>
+#include <utility>
+#include <algorithm>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include "bst.h"
+
+/**
+* Runs over the pieces of a BinarySearchTree::range_type on a set of
+* worker threads. Every worker keeps its own deque of ranges: it takes
+* work from the back of its own deque and, once that is empty, steals
+* from the front of the others, where the largest ranges are.
+*
+* Ranges are split eagerly down to a few levels so that every worker
+* starts with several pieces, and after that only while some worker is
+* idle, so a skewed tree still keeps everyone busy without cutting it
+* into tiny pieces. The workers are started for each run and joined
+* before it returns.
+*/
+template <class Key, class Value>
+class WorkStealingPool
+{
+public:
+    typedef typename BinarySearchTree<Key, Value>::range_type range_type;
+
+    WorkStealingPool(unsigned int threads = 0);
+
+    unsigned int threads() const;
+    template<typename Leaf>
+    void run(const range_type& range, Leaf leaf);
+
+protected:
+    struct Task
+    {
+        range_type range;
+        unsigned int depth;
+    };
+
+    struct Worker
+    {
+        std::mutex lock;
+        std::deque<Task> tasks;
+    };
+
+    template<typename Leaf>
+    void work(size_t self, Leaf& leaf);
+    template<typename Leaf>
+    void process(size_t self, Task task, Leaf& leaf);
+    void push(size_t self, const Task& task);
+    bool pop(size_t self, Task& task);
+
+    unsigned int threads_;
+    unsigned int eagerDepth_;
+    std::vector<Worker> workers_;
+    std::atomic<size_t> pending_;
+    std::atomic<int> idle_;
+};
+
+/**
+* threads == 0 uses one worker per hardware thread.
+*/
+template<class Key, class Value>
+WorkStealingPool<Key, Value>::WorkStealingPool(unsigned int threads) :
+    threads_(threads), eagerDepth_(0), pending_(0), idle_(0)
+{
+    if(threads_ == 0)
+    {
+        threads_ = std::max(1u, std::thread::hardware_concurrency());
+    }
+    // about eight pieces per worker before any stealing happens
+    while((1u << eagerDepth_) < 8 * threads_)
+    {
+        eagerDepth_++;
+    }
+}
+
+template<class Key, class Value>
+unsigned int WorkStealingPool<Key, Value>::threads() const
+{
+    return threads_;
+}
+
+/**
+* Calls leaf(worker, piece) on disjoint pieces that together cover range.
+* worker is the index (below threads()) of the thread making the call,
+* so a leaf can keep per-worker results without locking.
+*/
+template<class Key, class Value>
+template<typename Leaf>
+void WorkStealingPool<Key, Value>::run(const range_type& range, Leaf leaf)
+{
+    if(range.empty())
+    {
+        return;
+    }
+    std::vector<Worker> workers(threads_);
+    workers_.swap(workers);
+    pending_ = 0;
+    idle_ = 0;
+    Task root = { range, 0 };
+    push(0, root);
+
+    std::vector<std::thread> helpers;
+    for(size_t i = 1; i < threads_; i++)
+    {
+        helpers.push_back(std::thread([this, i, &leaf]() { work(i, leaf); }));
+    }
+    work(0, leaf);
+    for(size_t i = 0; i < helpers.size(); i++)
+    {
+        helpers[i].join();
+    }
+}
+
+template<class Key, class Value>
+template<typename Leaf>
+void WorkStealingPool<Key, Value>::work(size_t self, Leaf& leaf)
+{
+    bool idle = false;
+    while(true)
+    {
+        Task task;
+        if(pop(self, task))
+        {
+            if(idle)
+            {
+                idle_--;
+                idle = false;
+            }
+            process(self, task, leaf);
+        }
+        else if(pending_ == 0)
+        {
+            break;
+        }
+        else
+        {
+            if(!idle)
+            {
+                idle_++;
+                idle = true;
+            }
+            std::this_thread::yield();
+        }
+    }
+    if(idle)
+    {
+        idle_--;
+    }
+}
+
+/**
+* Keeps cutting off the right subtree for others to take while the
+* range is shallow or someone is waiting, then runs what is left.
+*/
+template<class Key, class Value>
+template<typename Leaf>
+void WorkStealingPool<Key, Value>::process(size_t self, Task task, Leaf& leaf)
+{
+    while(task.range.divisible() && (task.depth < eagerDepth_ || idle_ > 0))
+    {
+        range_type left, middle, right;
+        task.range.split(left, middle, right);
+        task.depth++;
+        if(!right.empty())
+        {
+            Task rest = { right, task.depth };
+            push(self, rest);
+        }
+        leaf(self, middle);
+        task.range = left;
+    }
+    if(!task.range.empty())
+    {
+        leaf(self, task.range);
+    }
+    pending_--;
+}
+
+template<class Key, class Value>
+void WorkStealingPool<Key, Value>::push(size_t self, const Task& task)
+{
+    pending_++;
+    std::lock_guard<std::mutex> guard(workers_[self].lock);
+    workers_[self].tasks.push_back(task);
+}
+
+/**
+* Takes the newest task of this worker, or else the oldest task of
+* another one.
+*/
+template<class Key, class Value>
+bool WorkStealingPool<Key, Value>::pop(size_t self, Task& task)
+{
+    {
+        std::lock_guard<std::mutex> guard(workers_[self].lock);
+        if(!workers_[self].tasks.empty())
+        {
+            task = workers_[self].tasks.back();
+            workers_[self].tasks.pop_back();
+            return true;
+        }
+    }
+    for(size_t i = 1; i < workers_.size(); i++)
+    {
+        Worker& victim = workers_[(self + i) % workers_.size()];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if(!victim.tasks.empty())
+        {
+            task = victim.tasks.front();
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+* Calls f(item) on every item of the tree, in no particular order.
+* f may run on several threads at once.
+*/
+template<class Key, class Value, typename Function>
+void parallel_for_each(const BinarySearchTree<Key, Value>& tree, Function f, unsigned int threads = 0)
+{
+    typedef typename BinarySearchTree<Key, Value>::range_type range_type;
+    typedef typename BinarySearchTree<Key, Value>::iterator iterator;
+    WorkStealingPool<Key, Value> pool(threads);
+    pool.run(tree.range(), [&f](size_t, const range_type& piece) {
+        for(iterator it = piece.begin(); it != piece.end(); ++it)
+        {
+            f(*it);
+        }
+    });
+}
+
+/**
+* Folds every item into a result: each piece of the tree is folded with
+* accumulate(result, item) starting from identity, and the piece results
+* are then combined in key order, so combine has to be associative but
+* not commutative. identity must be neutral for combine.
+*/
+template<class Key, class Value, typename T, typename Accumulate, typename Combine>
+T parallel_reduce(const BinarySearchTree<Key, Value>& tree, const T& identity,
+    Accumulate accumulate, Combine combine, unsigned int threads = 0)
+{
+    typedef typename BinarySearchTree<Key, Value>::range_type range_type;
+    typedef typename BinarySearchTree<Key, Value>::iterator iterator;
+    typedef std::pair<const Key*, T> Partial;
+
+    WorkStealingPool<Key, Value> pool(threads);
+    std::vector<std::vector<Partial> > partials(pool.threads());
+    pool.run(tree.range(), [&](size_t worker, const range_type& piece) {
+        T result = identity;
+        for(iterator it = piece.begin(); it != piece.end(); ++it)
+        {
+            result = accumulate(result, *it);
+        }
+        partials[worker].push_back(Partial(&piece.begin()->first, result));
+    });
+
+    std::vector<Partial> pieces;
+    for(size_t i = 0; i < partials.size(); i++)
+    {
+        pieces.insert(pieces.end(), partials[i].begin(), partials[i].end());
+    }
+    std::sort(pieces.begin(), pieces.end(),
+        [](const Partial& a, const Partial& b) { return *a.first < *b.first; });
+    T result = identity;
+    for(size_t i = 0; i < pieces.size(); i++)
+    {
+        result = combine(result, pieces[i].second);
+    }
+    return result;
+}
+
+/**
+* Returns init combined, in key order, with transform(item) of every item,
+* like std::transform_reduce. reduce has to be associative.
+*/
+template<class Key, class Value, typename T, typename Reduce, typename Transform>
+T parallel_transform_reduce(const BinarySearchTree<Key, Value>& tree, const T& init,
+    Reduce reduce, Transform transform, unsigned int threads = 0)
+{
+    typedef typename BinarySearchTree<Key, Value>::range_type range_type;
+    typedef typename BinarySearchTree<Key, Value>::iterator iterator;
+    typedef std::pair<const Key*, T> Partial;
+
+    WorkStealingPool<Key, Value> pool(threads);
+    std::vector<std::vector<Partial> > partials(pool.threads());
+    pool.run(tree.range(), [&](size_t worker, const range_type& piece) {
+        iterator it = piece.begin();
+        T result = transform(*it);
+        for(++it; it != piece.end(); ++it)
+        {
+            result = reduce(result, transform(*it));
+        }
+        partials[worker].push_back(Partial(&piece.begin()->first, result));
+    });
+
+    std::vector<Partial> pieces;
+    for(size_t i = 0; i < partials.size(); i++)
+    {
+        pieces.insert(pieces.end(), partials[i].begin(), partials[i].end());
+    }
+    std::sort(pieces.begin(), pieces.end(),
+        [](const Partial& a, const Partial& b) { return *a.first < *b.first; });
+    T result = init;
+    for(size_t i = 0; i < pieces.size(); i++)
+    {
+        result = reduce(result, pieces[i].second);
+    }
+    return result;
+}
+
+#endif
@@ -92,6 +92,24 @@ int getSubtreeHeight(Node<Key, Value> * root, int recursionDepth = 1)
 
     */
 
+// Prints a key or value. Pairs (e.g. interval keys) are printed
+// element by element since they have no operator<<.
+template<typename T>
+void printBSTElement(T const & element)
+{
+    std::cout << element;
+}
+
+template<typename First, typename Second>
+void printBSTElement(std::pair<First, Second> const & element)
+{
+    std::cout << '[';
+    printBSTElement(element.first);
+    std::cout << ", ";
+    printBSTElement(element.second);
+    std::cout << ']';
+}
+
 template<typename Key, typename Value>
 void BinarySearchTree<Key, Value>::printRoot (Node<Key, Value>* root) const
 {
@@ -271,7 +289,9 @@ void BinarySearchTree<Key, Value>::printRoot (Node<Key, Value>* root) const
 
             // print element with original cout flags
             std::cout.flags(origCoutState);
-            std::cout << '(' << placeholdersIter->first << ", ";
+            std::cout << '(';
+            printBSTElement(placeholdersIter->first);
+            std::cout << ", ";
 
             typename BinarySearchTree<Key, Value>::iterator elementIter = this->find(placeholdersIter->first);
             if(elementIter == this->end())
@@ -280,7 +300,7 @@ void BinarySearchTree<Key, Value>::printRoot (Node<Key, Value>* root) const
             }
             else
             {
-                std::cout << elementIter->second;
+                printBSTElement(elementIter->second);
             }
 
             std::cout << ')' << std::endl;
@@ -0,0 +1,486 @@
+#ifndef RBBST_H
+#define RBBST_H
+
+#include <iostream>
+#include <exception>
+#include <cstdlib>
+#include "bst.h"
+
+enum RBColor { RED, BLACK };
+
+/**
+* A special kind of node for a red-black tree, which adds the color as a data member.
+*/
+template <typename Key, typename Value>
+class RBNode : public Node<Key, Value>
+{
+public:
+    // Constructor/destructor.
+    RBNode(const Key& key, const Value& value, RBNode<Key, Value>* parent);
+    virtual ~RBNode();
+
+    // Getter/setter for the node's color.
+    RBColor getColor() const;
+    void setColor(RBColor color);
+
+    // Getters for parent, left, and right. These need to be redefined since they
+    // return pointers to RBNodes - not plain Nodes.
+    virtual RBNode<Key, Value>* getParent() const override;
+    virtual RBNode<Key, Value>* getLeft() const override;
+    virtual RBNode<Key, Value>* getRight() const override;
+    virtual RBNode<Key, Value>* clone() const override;
+
+protected:
+    RBColor color_;
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the RBNode class.
+  -------------------------------------------------
+*/
+
+/**
+* An explicit constructor to initialize the elements by calling the base class constructor and setting
+* the color to red since every new node will be red when it is first inserted.
+*/
+template<class Key, class Value>
+RBNode<Key, Value>::RBNode(const Key& key, const Value& value, RBNode<Key, Value> *parent) :
+    Node<Key, Value>(key, value, parent), color_(RED)
+{
+
+}
+
+/**
+* A destructor which does nothing.
+*/
+template<class Key, class Value>
+RBNode<Key, Value>::~RBNode()
+{
+
+}
+
+/**
+* A getter for the color of a RBNode.
+*/
+template<class Key, class Value>
+RBColor RBNode<Key, Value>::getColor() const
+{
+    return color_;
+}
+
+/**
+* A setter for the color of a RBNode.
+*/
+template<class Key, class Value>
+void RBNode<Key, Value>::setColor(RBColor color)
+{
+    color_ = color;
+}
+
+/**
+* An overridden function for getting the parent since a static_cast is necessary to make sure
+* that our node is a RBNode.
+*/
+template<class Key, class Value>
+RBNode<Key, Value> *RBNode<Key, Value>::getParent() const
+{
+    return static_cast<RBNode<Key, Value>*>(this->parent_);
+}
+
+/**
+* Overridden for the same reasons as above.
+*/
+template<class Key, class Value>
+RBNode<Key, Value> *RBNode<Key, Value>::getLeft() const
+{
+    return static_cast<RBNode<Key, Value>*>(this->left_);
+}
+
+/**
+* Overridden for the same reasons as above.
+*/
+template<class Key, class Value>
+RBNode<Key, Value> *RBNode<Key, Value>::getRight() const
+{
+    return static_cast<RBNode<Key, Value>*>(this->right_);
+}
+/**
+* Copies the item and the color, but none of the links.
+*/
+template<class Key, class Value>
+RBNode<Key, Value> *RBNode<Key, Value>::clone() const
+{
+    RBNode<Key, Value>* copy = new RBNode<Key, Value>(this->item_.first, this->item_.second, NULL);
+    copy->setColor(color_);
+    return copy;
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the RBNode class.
+  -----------------------------------------------
+*/
+
+/**
+* A red-black tree. Insert does at most two rotations and remove at most
+* three, so updates never rotate all the way up to the root like AVL removes can.
+*/
+template <class Key, class Value>
+class RedBlackTree : public BinarySearchTree<Key, Value>
+{
+public:
+    virtual void insert (const std::pair<const Key, Value> &new_item);
+    virtual void remove(const Key& key);
+    bool isValidRedBlack() const;
+protected:
+    virtual void nodeSwap( RBNode<Key,Value>* n1, RBNode<Key,Value>* n2);
+    virtual void removeNode(Node<Key, Value>* target);
+    virtual Node<Key, Value>* findOrCreate(const Key& key, const Value& init, bool& created);
+    virtual Node<Key, Value>* buildNode(const Key& key, const Value& value,
+        Node<Key, Value>* left, uint64_t leftSize, Node<Key, Value>* right, uint64_t rightSize);
+    static int fullLevels(uint64_t size);
+
+    void insertFix(RBNode<Key, Value>* current);
+    void removeFix(RBNode<Key, Value>* current, RBNode<Key, Value>* parent, bool isLeft);
+    static bool isRed(RBNode<Key, Value>* node);
+    int blackHeight(RBNode<Key, Value>* node) const;
+    RBNode<Key, Value>* getRoot() const;
+};
+
+template<class Key, class Value>
+RBNode<Key, Value>* RedBlackTree<Key, Value>::getRoot() const
+{
+    return static_cast<RBNode<Key, Value>*>(this->root_);
+}
+
+/**
+* NULL leaves count as black.
+*/
+template<class Key, class Value>
+bool RedBlackTree<Key, Value>::isRed(RBNode<Key, Value>* node)
+{
+    return node != nullptr && node->getColor() == RED;
+}
+
+/*
+ * If key is already in the tree, the current value is overwritten.
+ */
+template<class Key, class Value>
+void RedBlackTree<Key, Value>::insert (const std::pair<const Key, Value> &new_item)
+{
+    bool created = false;
+    Node<Key, Value>* node = findOrCreate(new_item.first, new_item.second, created);
+    if(!created)
+    {
+        node->setValue(new_item.second);
+    }
+}
+
+template<class Key, class Value>
+Node<Key, Value>* RedBlackTree<Key, Value>::findOrCreate(const Key& key, const Value& init, bool& created)
+{
+    RBNode<Key, Value>* parent = nullptr;
+    RBNode<Key, Value>* current = getRoot();
+    while(current != nullptr)
+    {
+        parent = current;
+        if(key < current->getKey())
+        {
+            current = current->getLeft();
+        }
+        else if(current->getKey() < key)
+        {
+            current = current->getRight();
+        }
+        else
+        {
+            created = false;
+            return current;
+        }
+    }
+
+    RBNode<Key, Value>* newNode = new RBNode<Key, Value>(key, init, parent);
+    if(parent == nullptr)
+    {
+        this->root_ = newNode;
+    }
+    else if(key < parent->getKey())
+    {
+        parent->setLeft(newNode);
+    }
+    else
+    {
+        parent->setRight(newNode);
+    }
+    insertFix(newNode);
+    created = true;
+    return newNode;
+}
+
+template<class Key, class Value>
+void RedBlackTree<Key, Value>::insertFix(RBNode<Key, Value>* current)
+{
+    while(isRed(current->getParent()))
+    {
+        RBNode<Key, Value>* parent = current->getParent();
+        // parent is red so it is not the root
+        RBNode<Key, Value>* grandparent = parent->getParent();
+        if(grandparent->getLeft() == parent)
+        {
+            RBNode<Key, Value>* uncle = grandparent->getRight();
+            if(isRed(uncle))
+            {
+                parent->setColor(BLACK);
+                uncle->setColor(BLACK);
+                grandparent->setColor(RED);
+                current = grandparent;
+            }
+            else
+            {
+                if(parent->getRight() == current)
+                {
+                    this->rotateLeft(parent);
+                    current = parent;
+                    parent = current->getParent();
+                }
+                parent->setColor(BLACK);
+                grandparent->setColor(RED);
+                this->rotateRight(grandparent);
+            }
+        }
+        else
+        {
+            RBNode<Key, Value>* uncle = grandparent->getLeft();
+            if(isRed(uncle))
+            {
+                parent->setColor(BLACK);
+                uncle->setColor(BLACK);
+                grandparent->setColor(RED);
+                current = grandparent;
+            }
+            else
+            {
+                if(parent->getLeft() == current)
+                {
+                    this->rotateRight(parent);
+                    current = parent;
+                    parent = current->getParent();
+                }
+                parent->setColor(BLACK);
+                grandparent->setColor(RED);
+                this->rotateLeft(grandparent);
+            }
+        }
+    }
+    getRoot()->setColor(BLACK);
+}
+
+/*
+ * As with the other trees, a node with 2 children is swapped
+ * with its predecessor before it is removed.
+ */
+template<class Key, class Value>
+void RedBlackTree<Key, Value>::remove(const Key& key)
+{
+    Node<Key, Value>* target = this->internalFind(key);
+    if(target == nullptr) return;
+    removeNode(target);
+}
+
+template<class Key, class Value>
+void RedBlackTree<Key, Value>::removeNode(Node<Key, Value>* target)
+{
+    RBNode<Key, Value>* current = static_cast<RBNode<Key, Value>*>(target);
+    if(current->getLeft() != nullptr && current->getRight() != nullptr)
+    {
+        nodeSwap(current, static_cast<RBNode<Key, Value>*>(BinarySearchTree<Key, Value>::predecessor(current)));
+    }
+
+    RBNode<Key, Value>* child = current->getLeft() != nullptr ? current->getLeft() : current->getRight();
+    RBNode<Key, Value>* parent = current->getParent();
+    bool isLeft = false;
+    if(child != nullptr)
+    {
+        child->setParent(parent);
+    }
+    if(parent == nullptr)
+    {
+        this->root_ = child;
+    }
+    else if(parent->getLeft() == current)
+    {
+        parent->setLeft(child);
+        isLeft = true;
+    }
+    else
+    {
+        parent->setRight(child);
+    }
+
+    if(current->getColor() == BLACK)
+    {
+        removeFix(child, parent, isLeft);
+    }
+    delete current;
+}
+
+/**
+* Restores the black height after a black node was removed above current.
+* current may be NULL, so its parent and side are passed explicitly.
+*/
+template<class Key, class Value>
+void RedBlackTree<Key, Value>::removeFix(RBNode<Key, Value>* current, RBNode<Key, Value>* parent, bool isLeft)
+{
+    while(parent != nullptr && !isRed(current))
+    {
+        if(isLeft)
+        {
+            RBNode<Key, Value>* sibling = parent->getRight();
+            if(isRed(sibling))
+            {
+                sibling->setColor(BLACK);
+                parent->setColor(RED);
+                this->rotateLeft(parent);
+                sibling = parent->getRight();
+            }
+            if(!isRed(sibling->getLeft()) && !isRed(sibling->getRight()))
+            {
+                sibling->setColor(RED);
+                current = parent;
+            }
+            else
+            {
+                if(!isRed(sibling->getRight()))
+                {
+                    sibling->getLeft()->setColor(BLACK);
+                    sibling->setColor(RED);
+                    this->rotateRight(sibling);
+                    sibling = parent->getRight();
+                }
+                sibling->setColor(parent->getColor());
+                parent->setColor(BLACK);
+                sibling->getRight()->setColor(BLACK);
+                this->rotateLeft(parent);
+                current = getRoot();
+            }
+        }
+        else
+        {
+            RBNode<Key, Value>* sibling = parent->getLeft();
+            if(isRed(sibling))
+            {
+                sibling->setColor(BLACK);
+                parent->setColor(RED);
+                this->rotateRight(parent);
+                sibling = parent->getLeft();
+            }
+            if(!isRed(sibling->getLeft()) && !isRed(sibling->getRight()))
+            {
+                sibling->setColor(RED);
+                current = parent;
+            }
+            else
+            {
+                if(!isRed(sibling->getLeft()))
+                {
+                    sibling->getRight()->setColor(BLACK);
+                    sibling->setColor(RED);
+                    this->rotateLeft(sibling);
+                    sibling = parent->getLeft();
+                }
+                sibling->setColor(parent->getColor());
+                parent->setColor(BLACK);
+                sibling->getLeft()->setColor(BLACK);
+                this->rotateRight(parent);
+                current = getRoot();
+            }
+        }
+        parent = current->getParent();
+        isLeft = parent != nullptr && parent->getLeft() == current;
+    }
+    if(current != nullptr)
+    {
+        current->setColor(BLACK);
+    }
+}
+
+/**
+* The number of levels that are completely filled in a subtree of size
+* nodes built by buildTree, i.e. how many nodes the shortest path has.
+*/
+template<class Key, class Value>
+int RedBlackTree<Key, Value>::fullLevels(uint64_t size)
+{
+    int levels = 0;
+    for(size++; size > 1; size >>= 1) levels++;
+    return levels;
+}
+
+/**
+* Every built node starts black. A child whose subtree has as many full
+* levels as this one sits on the incomplete bottom level of the path and
+* is colored red, which evens out the black height.
+*/
+template<class Key, class Value>
+Node<Key, Value>* RedBlackTree<Key, Value>::buildNode(const Key& key, const Value& value,
+    Node<Key, Value>* left, uint64_t leftSize, Node<Key, Value>* right, uint64_t rightSize)
+{
+    RBNode<Key, Value>* node = new RBNode<Key, Value>(key, value, nullptr);
+    node->setColor(BLACK);
+    node->setLeft(left);
+    node->setRight(right);
+    int levels = fullLevels(leftSize + rightSize + 1);
+    if(left != nullptr)
+    {
+        left->setParent(node);
+        if(fullLevels(leftSize) == levels) node->getLeft()->setColor(RED);
+    }
+    if(right != nullptr)
+    {
+        right->setParent(node);
+        if(fullLevels(rightSize) == levels) node->getRight()->setColor(RED);
+    }
+    return node;
+}
+
+template<class Key, class Value>
+void RedBlackTree<Key, Value>::nodeSwap( RBNode<Key,Value>* n1, RBNode<Key,Value>* n2)
+{
+    BinarySearchTree<Key, Value>::nodeSwap(n1, n2);
+    RBColor tempC = n1->getColor();
+    n1->setColor(n2->getColor());
+    n2->setColor(tempC);
+}
+
+/**
+* Returns true iff the root is black, no red node has a red child and
+* every root-to-leaf path has the same number of black nodes.
+*/
+template<class Key, class Value>
+bool RedBlackTree<Key, Value>::isValidRedBlack() const
+{
+    return !isRed(getRoot()) && blackHeight(getRoot()) != -1;
+}
+
+template<class Key, class Value>
+int RedBlackTree<Key, Value>::blackHeight(RBNode<Key, Value>* node) const
+{
+    if(node == nullptr)
+    {
+        return 1;
+    }
+    if(isRed(node) && (isRed(node->getLeft()) || isRed(node->getRight())))
+    {
+        return -1;
+    }
+    int left = blackHeight(node->getLeft());
+    int right = blackHeight(node->getRight());
+    if(left == -1 || right == -1 || left != right)
+    {
+        return -1;
+    }
+    return left + (isRed(node) ? 0 : 1);
+}
+
+#endif
@@ -0,0 +1,370 @@
+#ifndef RELAXEDAVL_H
+#define RELAXEDAVL_H
+
+#include <iostream>
+#include <exception>
+#include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <stdexcept>
+#include <algorithm>
+#include "avlbst.h"
+
+/**
+* An AVLTree that lets inserts and removes leave nodes out of balance and
+* repairs them later, in rebalance(budget) steps, so that write bursts do
+* no rotations at all.
+*
+* Balances stay exact (right height - left height), they are just allowed
+* to grow past +-1. A write walks up only while the height of the subtree
+* it changed keeps changing, and remembers its key if it left some node
+* out of balance: every such node lies on the search path of that key.
+* rebalance() walks those paths from the root and rotates the deepest
+* unbalanced node first. A node whose balance would pass 1 + slack is
+* fixed right away, so the height stays within a constant factor of the
+* AVL bound (slack 0 is a plain AVL tree) and lookups stay logarithmic.
+*
+* split, join, applySorted and range erase need a strict AVL tree; they
+* settle all pending work first and then run as in AVLTree, so
+* applySorted may use several threads. The pending keys belong to this
+* object, so swapping roots with another tree through the base class can
+* leave imbalance behind that only a later write on the same path repairs.
+* slack may be at most 100, since balances are kept in an int8_t.
+*/
+template <class Key, class Value>
+class RelaxedAVLTree : public AVLTree<Key, Value>
+{
+public:
+    RelaxedAVLTree(unsigned int slack = 2);
+
+    size_t rebalance(size_t budget = SIZE_MAX);
+    size_t pending() const;
+    unsigned int slack() const;
+
+    void split(const Key& key, AVLTree<Key, Value>& greater);
+    void join(AVLTree<Key, Value>& greater);
+    template<typename Iterator>
+    void applySorted(Iterator first, Iterator last, unsigned int threads = 1);
+    using AVLTree<Key, Value>::erase;
+    virtual typename BinarySearchTree<Key, Value>::iterator erase(
+        typename BinarySearchTree<Key, Value>::iterator first,
+        typename BinarySearchTree<Key, Value>::iterator last);
+
+protected:
+    // Makes the hooks below behave like AVLTree's while it is alive
+    class StrictScope
+    {
+    public:
+        explicit StrictScope(RelaxedAVLTree<Key, Value>& tree) : tree_(tree) { tree_.rebalance(); tree_.strict_ = true; }
+        ~StrictScope() { tree_.strict_ = false; }
+    private:
+        RelaxedAVLTree<Key, Value>& tree_;
+    };
+
+    virtual void linkNode(AVLNode<Key, Value>* newPair, AVLNode<Key, Value>* parent, bool goesLeft);
+    virtual void removeFix(AVLNode<Key, Value>* current, int diff);
+
+    void heightChanged(AVLNode<Key, Value>* current, bool rightSide, int delta, const Key& key);
+    static int childChanged(AVLNode<Key, Value>* current, bool rightSide, int delta);
+    int fix(AVLNode<Key, Value>* current);
+    int rotateLeftTracked(AVLNode<Key, Value>* current);
+    int rotateRightTracked(AVLNode<Key, Value>* current);
+    void note(AVLNode<Key, Value>* node);
+    bool outOfBalance(AVLNode<Key, Value>* node) const;
+
+    unsigned int slack_;
+    bool strict_;
+    std::deque<Key> pending_;
+};
+
+template<class Key, class Value>
+RelaxedAVLTree<Key, Value>::RelaxedAVLTree(unsigned int slack) : slack_(slack), strict_(false)
+{
+    if(slack_ > 100)
+    {
+      throw std::invalid_argument("slack must be at most 100");
+    }
+}
+
+/**
+* Does at most budget rotations and returns how many paths may still hold
+* unbalanced nodes. rebalance() with no budget leaves a strict AVL tree.
+*/
+template<class Key, class Value>
+size_t RelaxedAVLTree<Key, Value>::rebalance(size_t budget)
+{
+    for(size_t done = 0; done < budget && !pending_.empty(); )
+    {
+        const Key key = pending_.front();
+        AVLNode<Key, Value>* deepest = nullptr;
+        AVLNode<Key, Value>* current = static_cast<AVLNode<Key, Value>*>(this->root_);
+        while(current != nullptr)
+        {
+            if(outOfBalance(current))
+            {
+                deepest = current;
+            }
+            if(key < current->getKey())
+            {
+                current = current->getLeft();
+            }
+            else if(current->getKey() < key)
+            {
+                current = current->getRight();
+            }
+            else
+            {
+                break;
+            }
+        }
+        if(deepest == nullptr)
+        {
+            pending_.pop_front();
+            continue;
+        }
+        AVLNode<Key, Value>* parent = deepest->getParent();
+        bool rightSide = parent != nullptr && parent->getRight() == deepest;
+        int delta = fix(deepest);
+        done++;
+        heightChanged(parent, rightSide, delta, key);
+    }
+    return pending_.size();
+}
+
+template<class Key, class Value>
+size_t RelaxedAVLTree<Key, Value>::pending() const
+{
+    return pending_.size();
+}
+
+template<class Key, class Value>
+unsigned int RelaxedAVLTree<Key, Value>::slack() const
+{
+    return slack_;
+}
+
+template<class Key, class Value>
+void RelaxedAVLTree<Key, Value>::split(const Key& key, AVLTree<Key, Value>& greater)
+{
+    StrictScope scope(*this);
+    AVLTree<Key, Value>::split(key, greater);
+}
+
+template<class Key, class Value>
+void RelaxedAVLTree<Key, Value>::join(AVLTree<Key, Value>& greater)
+{
+    StrictScope scope(*this);
+    RelaxedAVLTree<Key, Value>* relaxed = dynamic_cast<RelaxedAVLTree<Key, Value>*>(&greater);
+    if(relaxed != nullptr)
+    {
+        relaxed->rebalance();
+    }
+    AVLTree<Key, Value>::join(greater);
+}
+
+template<class Key, class Value>
+template<typename Iterator>
+void RelaxedAVLTree<Key, Value>::applySorted(Iterator first, Iterator last, unsigned int threads)
+{
+    StrictScope scope(*this);
+    AVLTree<Key, Value>::applySorted(first, last, threads);
+}
+
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator
+RelaxedAVLTree<Key, Value>::erase(typename BinarySearchTree<Key, Value>::iterator first,
+                                  typename BinarySearchTree<Key, Value>::iterator last)
+{
+    StrictScope scope(*this);
+    return AVLTree<Key, Value>::erase(first, last);
+}
+
+/*
+ * Same links as AVLTree::linkNode, but the new height only travels up
+ * as far as it changes anything and nothing is rotated unless the slack
+ * runs out.
+ */
+template<class Key, class Value>
+void RelaxedAVLTree<Key, Value>::linkNode(AVLNode<Key, Value>* newPair, AVLNode<Key, Value>* parent, bool goesLeft)
+{
+    if(strict_)
+    {
+      AVLTree<Key, Value>::linkNode(newPair, parent, goesLeft);
+      return;
+    }
+    newPair->setParent(parent);
+    newPair->setRight(nullptr);
+    newPair->setLeft(nullptr);
+    newPair->setBalance(0);
+    if(parent == nullptr)
+    {
+      this->root_ = newPair;
+      this->updatePath(newPair);
+      return;
+    }
+    if(goesLeft)
+    {
+      parent->setLeft(newPair);
+    }
+    else
+    {
+      parent->setRight(newPair);
+    }
+    this->updatePath(newPair);
+    heightChanged(parent, !goesLeft, 1, newPair->getKey());
+}
+
+/*
+ * diff is +1 if the left subtree of current lost a level and -1 for the
+ * right one, as in AVLTree::removeFix.
+ */
+template<class Key, class Value>
+void RelaxedAVLTree<Key, Value>::removeFix(AVLNode<Key, Value>* current, int diff)
+{
+    if(strict_)
+    {
+      AVLTree<Key, Value>::removeFix(current, diff);
+    }
+    else if(current != nullptr)
+    {
+      const Key key = current->getKey();
+      heightChanged(current, diff < 0, -1, key);
+    }
+}
+
+/*
+ * The subtree on the rightSide of current changed height by delta. Walks
+ * up while heights keep changing, fixing nodes that run out of slack, and
+ * notes key once if that puts a node out of balance. Nodes that already
+ * were have been noted before, under a key whose path still leads to them.
+ */
+template<class Key, class Value>
+void RelaxedAVLTree<Key, Value>::heightChanged(AVLNode<Key, Value>* current, bool rightSide, int delta, const Key& key)
+{
+    bool noted = false;
+    while(current != nullptr && delta != 0)
+    {
+      AVLNode<Key, Value>* parent = current->getParent();
+      bool currentIsRight = parent != nullptr && parent->getRight() == current;
+      bool wasOut = outOfBalance(current);
+      delta = childChanged(current, rightSide, delta);
+      int balance = current->getBalance();
+      if(balance > 1 + (int)slack_ || balance < -1 - (int)slack_)
+      {
+        delta += fix(current);
+        // whatever took its place is on the path of key as well
+        current = parent == nullptr ? static_cast<AVLNode<Key, Value>*>(this->root_)
+                : currentIsRight ? parent->getRight() : parent->getLeft();
+        wasOut = false;
+      }
+      if(!noted && !wasOut && outOfBalance(current))
+      {
+        pending_.push_back(key);
+        noted = true;
+      }
+      current = parent;
+      rightSide = currentIsRight;
+    }
+}
+
+/*
+ * Adjusts the balance of current for a child subtree whose height changed
+ * by delta and returns how much the height of current changed.
+ */
+template<class Key, class Value>
+int RelaxedAVLTree<Key, Value>::childChanged(AVLNode<Key, Value>* current, bool rightSide, int delta)
+{
+    int left = 0;
+    int right = current->getBalance();
+    int before = std::max(left, right);
+    (rightSide ? right : left) += delta;
+    current->setBalance(right - left);
+    return std::max(left, right) - before;
+}
+
+/*
+ * One single or double rotation at an unbalanced node. Returns how much
+ * the height of the subtree changed. Nodes pushed down that are still
+ * out of balance are noted under their own keys, since they may have
+ * left the path being repaired.
+ */
+template<class Key, class Value>
+int RelaxedAVLTree<Key, Value>::fix(AVLNode<Key, Value>* current)
+{
+    int delta = 0;
+    AVLNode<Key, Value>* child;
+    if(current->getBalance() > 0)
+    {
+      child = current->getRight();
+      if(child->getBalance() < 0)
+      {
+        delta = childChanged(current, true, rotateRightTracked(child));
+      }
+      delta += rotateLeftTracked(current);
+    }
+    else
+    {
+      child = current->getLeft();
+      if(child->getBalance() > 0)
+      {
+        delta = childChanged(current, false, rotateLeftTracked(child));
+      }
+      delta += rotateRightTracked(current);
+    }
+    note(current);
+    note(child);
+    return delta;
+}
+
+/*
+ * AVLTree::rotateLeft with the balances recomputed from heights relative
+ * to the right child, which works for any balances. Returns the change in
+ * height of the rotated subtree.
+ */
+template<class Key, class Value>
+int RelaxedAVLTree<Key, Value>::rotateLeftTracked(AVLNode<Key, Value>* current)
+{
+    AVLNode<Key, Value>* child = current->getRight();
+    int left = -current->getBalance();
+    int childLeft = -1 - std::max(0, (int)child->getBalance());
+    int childRight = -1 - std::max(0, -(int)child->getBalance());
+    int before = 1 + std::max(left, 0);
+    this->rotateLeft(current);
+    int lowered = 1 + std::max(left, childLeft);
+    current->setBalance(childLeft - left);
+    child->setBalance(childRight - lowered);
+    return 1 + std::max(lowered, childRight) - before;
+}
+
+template<class Key, class Value>
+int RelaxedAVLTree<Key, Value>::rotateRightTracked(AVLNode<Key, Value>* current)
+{
+    AVLNode<Key, Value>* child = current->getLeft();
+    int right = current->getBalance();
+    int childLeft = -1 - std::max(0, (int)child->getBalance());
+    int childRight = -1 - std::max(0, -(int)child->getBalance());
+    int before = 1 + std::max(0, right);
+    this->rotateRight(current);
+    int lowered = 1 + std::max(childRight, right);
+    current->setBalance(right - childRight);
+    child->setBalance(lowered - childLeft);
+    return 1 + std::max(childLeft, lowered) - before;
+}
+
+template<class Key, class Value>
+void RelaxedAVLTree<Key, Value>::note(AVLNode<Key, Value>* node)
+{
+    if(outOfBalance(node))
+    {
+      pending_.push_back(node->getKey());
+    }
+}
+
+template<class Key, class Value>
+bool RelaxedAVLTree<Key, Value>::outOfBalance(AVLNode<Key, Value>* node) const
+{
+    return node->getBalance() > 1 || node->getBalance() < -1;
+}
+
+#endif
@@ -0,0 +1,147 @@
+#ifndef SERIALIZE_H
+#define SERIALIZE_H
+
+#include <iostream>
+#include <stdexcept>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <type_traits>
+
+/*
+ * Lengths and counts are LEB128 varints: seven bits per byte, low bits
+ * first, with the high bit set on every byte but the last.
+ */
+inline void writeVarint(std::string& out, uint64_t number)
+{
+    while(number >= 0x80)
+    {
+        out += static_cast<char>((number & 0x7f) | 0x80);
+        number >>= 7;
+    }
+    out += static_cast<char>(number);
+}
+
+inline bool readVarint(const char*& data, const char* end, uint64_t& number)
+{
+    number = 0;
+    for(int shift = 0; data != end && shift < 64; shift += 7)
+    {
+        unsigned char byte = static_cast<unsigned char>(*data++);
+        number |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if(!(byte & 0x80))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+inline bool readVarint(std::istream& in, uint64_t& number)
+{
+    number = 0;
+    for(int shift = 0; shift < 64; shift += 7)
+    {
+        int byte = in.get();
+        if(byte == std::char_traits<char>::eof())
+        {
+            return false;
+        }
+        number |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if(!(byte & 0x80))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Encodes keys and values for BinarySearchTree::serialize. write appends
+ * the encoding of an item to out and read decodes exactly size bytes;
+ * the tree adds the length prefix itself. Trivially copyable types are
+ * stored as their bytes in host order. Other types need a specialization.
+ */
+template <typename T, typename Enable = void>
+struct SerializeTraits
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+        "specialize SerializeTraits for types that are not trivially copyable");
+
+    static void write(std::string& out, const T& item)
+    {
+        out.append(reinterpret_cast<const char*>(&item), sizeof(T));
+    }
+    static void read(const char* data, size_t size, T& item)
+    {
+        if(size != sizeof(T))
+        {
+            throw std::runtime_error("serialized item has the wrong size");
+        }
+        std::memcpy(&item, data, sizeof(T));
+    }
+};
+
+template <>
+struct SerializeTraits<std::string>
+{
+    static void write(std::string& out, const std::string& item)
+    {
+        out += item;
+    }
+    static void read(const char* data, size_t size, std::string& item)
+    {
+        item.assign(data, size);
+    }
+};
+
+/*
+ * Pairs (such as interval keys) store the first half behind its own
+ * length prefix, followed by the second half.
+ */
+template <typename First, typename Second>
+struct SerializeTraits<std::pair<First, Second> >
+{
+    static void write(std::string& out, const std::pair<First, Second>& item)
+    {
+        std::string first;
+        SerializeTraits<First>::write(first, item.first);
+        writeVarint(out, first.size());
+        out += first;
+        SerializeTraits<Second>::write(out, item.second);
+    }
+    static void read(const char* data, size_t size, std::pair<First, Second>& item)
+    {
+        const char* end = data + size;
+        uint64_t firstSize = 0;
+        if(!readVarint(data, end, firstSize) || firstSize > (uint64_t)(end - data))
+        {
+            throw std::runtime_error("truncated pair");
+        }
+        SerializeTraits<First>::read(data, firstSize, item.first);
+        SerializeTraits<Second>::read(data + firstSize, end - data - firstSize, item.second);
+    }
+};
+
+/*
+ * Reads one length-prefixed item into buffer and decodes it.
+ */
+template <typename T>
+void readItem(std::istream& in, std::string& buffer, T& item)
+{
+    uint64_t size = 0;
+    if(!readVarint(in, size))
+    {
+        throw std::runtime_error("truncated tree stream");
+    }
+    buffer.resize(size);
+    if(size > 0 && !in.read(&buffer[0], size))
+    {
+        throw std::runtime_error("truncated tree stream");
+    }
+    SerializeTraits<T>::read(buffer.data(), buffer.size(), item);
+}
+
+#endif
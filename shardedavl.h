@@ -0,0 +1,294 @@
+#ifndef SHARDEDAVL_H
+#define SHARDEDAVL_H
+
+#include <iostream>
+#include <exception>
+#include <cstdlib>
+#include <cstddef>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include "avlbst.h"
+
+/**
+* A concurrent map that range-partitions its keys over several independent
+* AVLTrees. Every shard has its own lock and owns its own nodes, so point
+* operations on different shards never contend.
+*
+* The shard directory (boundaries plus shards) is immutable once published.
+* Readers grab the current directory, lock their shard and retry if the
+* shard was retired by a concurrent split or merge in the meantime.
+* Splits and merges move whole subtrees with AVLTree::split/join, so they
+* cost O(log n) while holding only the locks of the shards involved.
+*/
+template <class Key, class Value>
+class ShardedAVLMap
+{
+public:
+    ShardedAVLMap(const std::vector<Key>& boundaries);
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    bool find(const Key& key, Value& value) const;
+    template<typename Visitor>
+    void forEach(Visitor visit) const;
+
+    size_t shardCount() const;
+    bool splitShard(size_t index);
+    bool mergeShards(size_t index);
+    void rebalanceShards(double hotFactor = 4.0);
+
+protected:
+    // Gives the map a cheap split point: the root key of a shard's tree.
+    class ShardTree : public AVLTree<Key, Value>
+    {
+    public:
+        const Key* rootKey() const;
+    };
+
+    struct Shard
+    {
+        Shard() : retired(false), ops(0) { }
+        mutable std::mutex lock;
+        ShardTree tree;
+        bool retired;
+        mutable std::atomic<unsigned long> ops;
+    };
+
+    // bounds[i] is the smallest key that belongs to shards[i + 1]
+    struct Directory
+    {
+        std::vector<Key> bounds;
+        std::vector<std::shared_ptr<Shard> > shards;
+    };
+
+    std::shared_ptr<Shard> lockShard(const Key& key, std::unique_lock<std::mutex>& guard) const;
+    std::shared_ptr<const Directory> directory() const;
+
+    std::shared_ptr<const Directory> directory_;
+    mutable std::mutex resizeLock_;
+};
+
+template<class Key, class Value>
+const Key* ShardedAVLMap<Key, Value>::ShardTree::rootKey() const
+{
+    return this->root_ == nullptr ? nullptr : &this->root_->getKey();
+}
+
+/**
+* Creates boundaries.size() + 1 shards. The boundaries must be sorted.
+*/
+template<class Key, class Value>
+ShardedAVLMap<Key, Value>::ShardedAVLMap(const std::vector<Key>& boundaries)
+{
+    std::shared_ptr<Directory> dir(new Directory());
+    dir->bounds = boundaries;
+    for(size_t i = 0; i <= boundaries.size(); i++)
+    {
+        dir->shards.push_back(std::make_shared<Shard>());
+    }
+    directory_ = dir;
+}
+
+template<class Key, class Value>
+std::shared_ptr<const typename ShardedAVLMap<Key, Value>::Directory> ShardedAVLMap<Key, Value>::directory() const
+{
+    return std::atomic_load(&directory_);
+}
+
+/**
+* Locks and returns the live shard that owns key.
+*/
+template<class Key, class Value>
+std::shared_ptr<typename ShardedAVLMap<Key, Value>::Shard>
+ShardedAVLMap<Key, Value>::lockShard(const Key& key, std::unique_lock<std::mutex>& guard) const
+{
+    while(true)
+    {
+        std::shared_ptr<const Directory> dir = directory();
+        size_t index = std::upper_bound(dir->bounds.begin(), dir->bounds.end(), key) - dir->bounds.begin();
+        std::shared_ptr<Shard> shard = dir->shards[index];
+        guard = std::unique_lock<std::mutex>(shard->lock);
+        if(!shard->retired)
+        {
+            shard->ops++;
+            return shard;
+        }
+        guard.unlock();
+    }
+}
+
+template<class Key, class Value>
+void ShardedAVLMap<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    std::unique_lock<std::mutex> guard;
+    lockShard(keyValuePair.first, guard)->tree.insert(keyValuePair);
+}
+
+template<class Key, class Value>
+void ShardedAVLMap<Key, Value>::remove(const Key& key)
+{
+    std::unique_lock<std::mutex> guard;
+    lockShard(key, guard)->tree.remove(key);
+}
+
+/**
+* Copies the value out, since the shard lock is released on return.
+* Returns false if key is not in the map.
+*/
+template<class Key, class Value>
+bool ShardedAVLMap<Key, Value>::find(const Key& key, Value& value) const
+{
+    std::unique_lock<std::mutex> guard;
+    std::shared_ptr<Shard> shard = lockShard(key, guard);
+    typename AVLTree<Key, Value>::iterator it = shard->tree.find(key);
+    if(it == shard->tree.end())
+    {
+        return false;
+    }
+    value = it->second;
+    return true;
+}
+
+/**
+* Calls visit(item) on every item in key order. Since shards hold
+* disjoint, ordered key ranges, merging them is a concatenation: shards
+* are visited one at a time under their own lock, and splits and merges
+* wait until the walk is done.
+*/
+template<class Key, class Value>
+template<typename Visitor>
+void ShardedAVLMap<Key, Value>::forEach(Visitor visit) const
+{
+    std::lock_guard<std::mutex> resizeGuard(resizeLock_);
+    std::shared_ptr<const Directory> dir = directory();
+    for(size_t i = 0; i < dir->shards.size(); i++)
+    {
+        std::lock_guard<std::mutex> guard(dir->shards[i]->lock);
+        const ShardTree& tree = dir->shards[i]->tree;
+        for(typename AVLTree<Key, Value>::iterator it = tree.begin(); it != tree.end(); ++it)
+        {
+            visit(*it);
+        }
+    }
+}
+
+template<class Key, class Value>
+size_t ShardedAVLMap<Key, Value>::shardCount() const
+{
+    return directory()->shards.size();
+}
+
+/**
+* Splits a shard in two at the root key of its tree. Returns false if
+* the shard is too small to split.
+*/
+template<class Key, class Value>
+bool ShardedAVLMap<Key, Value>::splitShard(size_t index)
+{
+    std::lock_guard<std::mutex> resizeGuard(resizeLock_);
+    std::shared_ptr<const Directory> dir = directory();
+    if(index >= dir->shards.size())
+    {
+        return false;
+    }
+    std::shared_ptr<Shard> shard = dir->shards[index];
+    std::lock_guard<std::mutex> guard(shard->lock);
+    const Key* splitKey = shard->tree.rootKey();
+    if(splitKey == nullptr || shard->tree.begin()->first == *splitKey)
+    {
+        // nothing would end up in the lower half
+        return false;
+    }
+    Key boundary = *splitKey;
+
+    std::shared_ptr<Shard> lower = std::make_shared<Shard>();
+    std::shared_ptr<Shard> upper = std::make_shared<Shard>();
+    lower->tree.swap(shard->tree);
+    lower->tree.split(boundary, upper->tree);
+    shard->retired = true;
+
+    std::shared_ptr<Directory> next(new Directory(*dir));
+    next->bounds.insert(next->bounds.begin() + index, boundary);
+    next->shards[index] = lower;
+    next->shards.insert(next->shards.begin() + index + 1, upper);
+    std::atomic_store(&directory_, std::shared_ptr<const Directory>(next));
+    return true;
+}
+
+/**
+* Merges shard index with the shard after it. Returns false if there
+* is no shard after it.
+*/
+template<class Key, class Value>
+bool ShardedAVLMap<Key, Value>::mergeShards(size_t index)
+{
+    std::lock_guard<std::mutex> resizeGuard(resizeLock_);
+    std::shared_ptr<const Directory> dir = directory();
+    if(index + 1 >= dir->shards.size())
+    {
+        return false;
+    }
+    std::shared_ptr<Shard> lowerOld = dir->shards[index];
+    std::shared_ptr<Shard> upperOld = dir->shards[index + 1];
+    std::lock_guard<std::mutex> lowerGuard(lowerOld->lock);
+    std::lock_guard<std::mutex> upperGuard(upperOld->lock);
+
+    std::shared_ptr<Shard> merged = std::make_shared<Shard>();
+    merged->tree.swap(lowerOld->tree);
+    merged->tree.join(upperOld->tree);
+    lowerOld->retired = true;
+    upperOld->retired = true;
+
+    std::shared_ptr<Directory> next(new Directory(*dir));
+    next->bounds.erase(next->bounds.begin() + index);
+    next->shards[index] = merged;
+    next->shards.erase(next->shards.begin() + index + 1);
+    std::atomic_store(&directory_, std::shared_ptr<const Directory>(next));
+    return true;
+}
+
+/**
+* Splits every shard that saw more than hotFactor times the average
+* number of operations since the last call, then merges neighbouring
+* shards that both saw less than 1/hotFactor of the average.
+*/
+template<class Key, class Value>
+void ShardedAVLMap<Key, Value>::rebalanceShards(double hotFactor)
+{
+    std::vector<unsigned long> ops;
+    {
+        std::shared_ptr<const Directory> dir = directory();
+        for(size_t i = 0; i < dir->shards.size(); i++)
+        {
+            ops.push_back(dir->shards[i]->ops.exchange(0));
+        }
+    }
+    double average = 0;
+    for(size_t i = 0; i < ops.size(); i++)
+    {
+        average += ops[i];
+    }
+    average /= ops.size();
+
+    // back to front so that the indices of unvisited shards stay valid
+    for(size_t i = ops.size(); i-- > 0; )
+    {
+        if(ops[i] > hotFactor * average && splitShard(i))
+        {
+            ops.insert(ops.begin() + i + 1, 0);
+        }
+    }
+    for(size_t i = ops.size() - 1; i-- > 0; )
+    {
+        if(ops[i] * hotFactor < average && ops[i + 1] * hotFactor < average && mergeShards(i))
+        {
+            ops[i] += ops[i + 1];
+            ops.erase(ops.begin() + i + 1);
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,260 @@
+#ifndef SPLAYBST_H
+#define SPLAYBST_H
+
+#include <iostream>
+#include <exception>
+#include <cstdlib>
+#include <vector>
+#include "bst.h"
+
+/**
+* A self-adjusting binary search tree. Every access moves the touched node
+* towards the root so that hot keys end up near the top of the tree.
+*
+* splayPeriod limits the write amplification of splaying: with a period of k
+* only every k-th access restructures the tree (1 means splay every access).
+* When semiSplay is set, zig-zig steps only rotate the parent, which roughly
+* halves the depth of the access path instead of moving the node to the root.
+*
+* Plain Nodes are used since a splay tree needs no extra bookkeeping.
+*/
+template <class Key, class Value>
+class SplayTree : public BinarySearchTree<Key, Value>
+{
+public:
+    SplayTree(unsigned int splayPeriod = 1, bool semiSplay = false);
+    virtual void insert(const std::pair<const Key, Value> &new_item);
+    virtual void remove(const Key& key);
+
+    // Non-const since a lookup restructures the tree.
+    typename BinarySearchTree<Key, Value>::iterator find(const Key& key);
+    template<typename KeyIterator, typename Function>
+    void findEach(KeyIterator first, KeyIterator last, Function fn, unsigned int group = 8);
+    Value& operator[](const Key& key);
+
+protected:
+    void access(Node<Key, Value>* current);
+    void splay(Node<Key, Value>* current);
+    void rotateUp(Node<Key, Value>* current);
+    virtual void removeNode(Node<Key, Value>* target);
+    virtual Node<Key, Value>* findOrCreate(const Key& key, const Value& init, bool& created);
+    virtual void valueChanged(Node<Key, Value>* node);
+
+    unsigned int splayPeriod_;
+    unsigned int accessCount_;
+    bool semiSplay_;
+};
+
+template<class Key, class Value>
+SplayTree<Key, Value>::SplayTree(unsigned int splayPeriod, bool semiSplay) :
+    BinarySearchTree<Key, Value>(),
+    splayPeriod_(splayPeriod == 0 ? 1 : splayPeriod),
+    accessCount_(0),
+    semiSplay_(semiSplay)
+{
+
+}
+
+/**
+* Inserts like a regular BST, then splays the new (or overwritten) node.
+*/
+template<class Key, class Value>
+void SplayTree<Key, Value>::insert(const std::pair<const Key, Value> &new_item)
+{
+    bool created = false;
+    Node<Key, Value>* current = findOrCreate(new_item.first, new_item.second, created);
+    if(!created)
+    {
+        current->setValue(new_item.second);
+        access(current);
+    }
+}
+
+/**
+* New nodes are splayed right away; existing ones are left to the caller,
+* which splays them once it has used them.
+*/
+template<class Key, class Value>
+Node<Key, Value>* SplayTree<Key, Value>::findOrCreate(const Key& key, const Value& init, bool& created)
+{
+    Node<Key, Value>* current = BinarySearchTree<Key, Value>::findOrCreate(key, init, created);
+    if(created)
+    {
+        access(current);
+    }
+    return current;
+}
+
+/**
+* Values changed through update or upsert count as an access.
+*/
+template<class Key, class Value>
+void SplayTree<Key, Value>::valueChanged(Node<Key, Value>* node)
+{
+    access(node);
+}
+
+/**
+* Removal reuses the BST predecessor swap; the parent of the removed
+* node is splayed so the neighbourhood of the key stays hot.
+*/
+template<class Key, class Value>
+void SplayTree<Key, Value>::remove(const Key& key)
+{
+    Node<Key, Value>* target = this->internalFind(key);
+    if(target == NULL)
+    {
+        return;
+    }
+    removeNode(target);
+}
+
+template<class Key, class Value>
+void SplayTree<Key, Value>::removeNode(Node<Key, Value>* target)
+{
+    if(target->getLeft() && target->getRight())
+    {
+        this->nodeSwap(target, BinarySearchTree<Key, Value>::predecessor(target));
+    }
+    Node<Key, Value>* child = target->getLeft() != NULL ? target->getLeft() : target->getRight();
+    Node<Key, Value>* parent = target->getParent();
+    if(child != NULL)
+    {
+        child->setParent(parent);
+    }
+    if(parent == NULL)
+    {
+        this->root_ = child;
+    }
+    else if(parent->getLeft() == target)
+    {
+        parent->setLeft(child);
+    }
+    else
+    {
+        parent->setRight(child);
+    }
+    delete target;
+    if(parent != NULL)
+    {
+        access(parent);
+    }
+}
+
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator
+SplayTree<Key, Value>::find(const Key& key)
+{
+    Node<Key, Value>* curr = this->internalFind(key);
+    if(curr != NULL)
+    {
+        access(curr);
+    }
+    // rotations move nodes, not items, so curr still holds key
+    return this->nodeIterator(curr);
+}
+
+/**
+* The batched lookup of BinarySearchTree::findEach, counting an access to
+* every key found as find does. The searches share the tree, so the
+* splaying waits until all of them are done; it moves nodes, not items,
+* so the iterators fn was given stay valid.
+*/
+template<class Key, class Value>
+template<typename KeyIterator, typename Function>
+void SplayTree<Key, Value>::findEach(KeyIterator first, KeyIterator last, Function fn, unsigned int group)
+{
+    std::vector<Node<Key, Value>*> found;
+    BinarySearchTree<Key, Value>::findEach(first, last,
+        [&](const Key& key, typename BinarySearchTree<Key, Value>::iterator it) {
+          Node<Key, Value>* node = this->iteratorNode(it);
+          if(node != NULL)
+          {
+            found.push_back(node);
+          }
+          fn(key, it);
+        }, group);
+    for(size_t i = 0; i < found.size(); i++)
+    {
+        access(found[i]);
+    }
+}
+
+template<class Key, class Value>
+Value& SplayTree<Key, Value>::operator[](const Key& key)
+{
+    bool created = false;
+    Node<Key, Value>* curr = findOrCreate(key, Value(), created);
+    if(!created)
+    {
+        access(curr);
+    }
+    return curr->getValue();
+}
+
+/**
+* Counts an access to current and splays it if this is a k-th access.
+*/
+template<class Key, class Value>
+void SplayTree<Key, Value>::access(Node<Key, Value>* current)
+{
+    accessCount_++;
+    if(accessCount_ >= splayPeriod_)
+    {
+        accessCount_ = 0;
+        splay(current);
+    }
+}
+
+/**
+* Rotates current above its parent.
+*/
+template<class Key, class Value>
+void SplayTree<Key, Value>::rotateUp(Node<Key, Value>* current)
+{
+    Node<Key, Value>* parent = current->getParent();
+    if(parent->getLeft() == current)
+    {
+        this->rotateRight(parent);
+    }
+    else
+    {
+        this->rotateLeft(parent);
+    }
+}
+
+template<class Key, class Value>
+void SplayTree<Key, Value>::splay(Node<Key, Value>* current)
+{
+    while(current->getParent() != NULL)
+    {
+        Node<Key, Value>* parent = current->getParent();
+        Node<Key, Value>* grandParent = parent->getParent();
+        if(grandParent == NULL)
+        {
+            // zig
+            rotateUp(current);
+        }
+        else if((grandParent->getLeft() == parent) == (parent->getLeft() == current))
+        {
+            // zig-zig
+            rotateUp(parent);
+            if(semiSplay_)
+            {
+                current = parent;
+            }
+            else
+            {
+                rotateUp(current);
+            }
+        }
+        else
+        {
+            // zig-zag
+            rotateUp(current);
+            rotateUp(current);
+        }
+    }
+}
+
+#endif
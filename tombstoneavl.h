@@ -0,0 +1,720 @@
+#ifndef TOMBSTONEAVL_H
+#define TOMBSTONEAVL_H
+
+#include <iostream>
+#include <exception>
+#include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+#include "avlbst.h"
+
+/**
+* An AVLNode that can be marked dead: it stays linked in the tree as a
+* tombstone until the tree gets around to removing it. queued is set
+* while the tree's graveyard holds the node's key.
+*/
+template <typename Key, typename Value>
+class TombstoneAVLNode : public AVLNode<Key, Value>
+{
+public:
+    TombstoneAVLNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent);
+    virtual ~TombstoneAVLNode();
+
+    bool isDead() const;
+    void setDead(bool dead);
+    bool isQueued() const;
+    void setQueued(bool queued);
+
+    virtual TombstoneAVLNode<Key, Value>* getParent() const override;
+    virtual TombstoneAVLNode<Key, Value>* getLeft() const override;
+    virtual TombstoneAVLNode<Key, Value>* getRight() const override;
+    virtual TombstoneAVLNode<Key, Value>* clone() const override;
+
+protected:
+    bool dead_;
+    bool queued_;
+};
+
+/*
+  ------------------------------------------------------
+  Begin implementations for the TombstoneAVLNode class.
+  ------------------------------------------------------
+*/
+
+template<class Key, class Value>
+TombstoneAVLNode<Key, Value>::TombstoneAVLNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent) :
+    AVLNode<Key, Value>(key, value, parent), dead_(false), queued_(false)
+{
+
+}
+
+template<class Key, class Value>
+TombstoneAVLNode<Key, Value>::~TombstoneAVLNode()
+{
+
+}
+
+template<class Key, class Value>
+bool TombstoneAVLNode<Key, Value>::isDead() const
+{
+    return dead_;
+}
+
+template<class Key, class Value>
+void TombstoneAVLNode<Key, Value>::setDead(bool dead)
+{
+    dead_ = dead;
+}
+
+template<class Key, class Value>
+bool TombstoneAVLNode<Key, Value>::isQueued() const
+{
+    return queued_;
+}
+
+template<class Key, class Value>
+void TombstoneAVLNode<Key, Value>::setQueued(bool queued)
+{
+    queued_ = queued;
+}
+
+template<class Key, class Value>
+TombstoneAVLNode<Key, Value>* TombstoneAVLNode<Key, Value>::getParent() const
+{
+    return static_cast<TombstoneAVLNode<Key, Value>*>(this->parent_);
+}
+
+template<class Key, class Value>
+TombstoneAVLNode<Key, Value>* TombstoneAVLNode<Key, Value>::getLeft() const
+{
+    return static_cast<TombstoneAVLNode<Key, Value>*>(this->left_);
+}
+
+template<class Key, class Value>
+TombstoneAVLNode<Key, Value>* TombstoneAVLNode<Key, Value>::getRight() const
+{
+    return static_cast<TombstoneAVLNode<Key, Value>*>(this->right_);
+}
+
+/**
+* Copies the item, balance and marks, but none of the links.
+*/
+template<class Key, class Value>
+TombstoneAVLNode<Key, Value>* TombstoneAVLNode<Key, Value>::clone() const
+{
+    TombstoneAVLNode<Key, Value>* copy = new TombstoneAVLNode<Key, Value>(this->item_.first, this->item_.second, NULL);
+    copy->setBalance(this->balance_);
+    copy->setDead(dead_);
+    copy->setQueued(queued_);
+    return copy;
+}
+
+/*
+  ----------------------------------------------------
+  End implementations for the TombstoneAVLNode class.
+  ----------------------------------------------------
+*/
+
+/**
+* An AVLTree whose removes only mark the node dead, which is one search
+* and no structural change at all. Dead nodes are skipped by find,
+* iteration and the other lookups redefined here, and inserting a dead
+* key brings its node back to life in place.
+*
+* The tombstones are cleared out later: compact(budget) physically
+* removes up to budget of them, oldest first, and once the dead nodes
+* make up more than rebuildThreshold of the tree the whole tree is
+* rebuilt, perfectly balanced, in O(n) without allocating. A threshold
+* of 1 or more turns the automatic rebuild off.
+*
+* Functions that are not redefined here (split, join, merge, node
+* handles, and anything called through a base class reference) treat
+* tombstones as ordinary items and do not keep the counts below; call
+* rebuild() afterwards to clear the tombstones out and recount.
+*/
+template <class Key, class Value>
+class TombstoneAVLTree : public AVLTree<Key, Value>
+{
+public:
+    /**
+    * The tree's iterator, which steps over dead nodes.
+    */
+    class iterator : public BinarySearchTree<Key, Value>::iterator
+    {
+    public:
+        iterator();
+        iterator& operator++();
+
+    protected:
+        friend class TombstoneAVLTree<Key, Value>;
+        iterator(Node<Key, Value>* ptr);
+        void skipDead();
+    };
+
+    TombstoneAVLTree(double rebuildThreshold = 0.5);
+
+    using AVLTree<Key, Value>::insert;
+    virtual void insert(const std::pair<const Key, Value>& keyValuePair);
+    virtual void remove(const Key& key);
+    void clear();
+    bool empty() const;
+    size_t size() const;
+    size_t deadCount() const;
+    size_t compact(size_t budget);
+    void rebuild();
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    template<typename KeyIterator, typename Function>
+    void findEach(KeyIterator first, KeyIterator last, Function fn, unsigned int group = 8) const;
+    iterator erase(typename BinarySearchTree<Key, Value>::iterator pos);
+    virtual typename BinarySearchTree<Key, Value>::iterator erase(
+        typename BinarySearchTree<Key, Value>::iterator first,
+        typename BinarySearchTree<Key, Value>::iterator last);
+    template<typename Predicate>
+    size_t erase_if(Predicate pred);
+    template<typename Function>
+    bool update(const Key& key, Function fn);
+    using BinarySearchTree<Key, Value>::operator[];
+    Value const & operator[](const Key& key) const;
+    template<typename Iterator>
+    void applySorted(Iterator first, Iterator last, unsigned int threads = 1);
+    typename AVLTree<Key, Value>::node_type extract(const Key& key);
+    typename AVLTree<Key, Value>::node_type extract(typename BinarySearchTree<Key, Value>::iterator pos);
+
+protected:
+    typedef TombstoneAVLNode<Key, Value> TombNode;
+
+    virtual AVLNode<Key, Value>* createNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent) const;
+    virtual const std::type_info& nodeType() const;
+    virtual void destroyNode(AVLNode<Key, Value>* node);
+    virtual void removeNode(Node<Key, Value>* target);
+    virtual Node<Key, Value>* findOrCreate(const Key& key, const Value& init, bool& created);
+
+    TombNode* liveNode(const Key& key) const;
+    void markDead(TombNode* node);
+    void bury(TombNode* node);
+    void purgeGraveyard();
+    bool tooManyDead() const;
+    AVLNode<Key, Value>* relink(std::vector<TombNode*>& nodes, size_t lo, size_t hi, int& height);
+
+    double rebuildThreshold_;
+    size_t live_;
+    size_t dead_;
+    std::deque<Key> graveyard_;
+};
+
+/*
+-----------------------------------------------------------
+Begin implementations for the TombstoneAVLTree::iterator class.
+-----------------------------------------------------------
+*/
+
+template<class Key, class Value>
+TombstoneAVLTree<Key, Value>::iterator::iterator()
+{
+
+}
+
+template<class Key, class Value>
+TombstoneAVLTree<Key, Value>::iterator::iterator(Node<Key, Value>* ptr) :
+    BinarySearchTree<Key, Value>::iterator(ptr)
+{
+    skipDead();
+}
+
+template<class Key, class Value>
+typename TombstoneAVLTree<Key, Value>::iterator&
+TombstoneAVLTree<Key, Value>::iterator::operator++()
+{
+    BinarySearchTree<Key, Value>::iterator::operator++();
+    skipDead();
+    return *this;
+}
+
+template<class Key, class Value>
+void TombstoneAVLTree<Key, Value>::iterator::skipDead()
+{
+    while(this->current_ != nullptr && static_cast<TombNode*>(this->current_)->isDead())
+    {
+      this->current_ = BinarySearchTree<Key, Value>::successor(this->current_);
+    }
+}
+
+/*
+---------------------------------------------------------
+End implementations for the TombstoneAVLTree::iterator class.
+---------------------------------------------------------
+*/
+
+template<class Key, class Value>
+TombstoneAVLTree<Key, Value>::TombstoneAVLTree(double rebuildThreshold) :
+    rebuildThreshold_(rebuildThreshold), live_(0), dead_(0)
+{
+
+}
+
+/*
+ * A dead key is revived by findOrCreate, so it counts as a new item.
+ */
+template<class Key, class Value>
+void TombstoneAVLTree<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    bool created = false;
+    Node<Key, Value>* node = findOrCreate(keyValuePair.first, keyValuePair.second, created);
+    if(!created)
+    {
+      node->setValue(keyValuePair.second);
+      this->valueChanged(node);
+    }
+}
+
+template<class Key, class Value>
+void TombstoneAVLTree<Key, Value>::remove(const Key& key)
+{
+    TombNode* node = liveNode(key);
+    if(node != nullptr)
+    {
+      markDead(node);
+    }
+}
+
+template<class Key, class Value>
+void TombstoneAVLTree<Key, Value>::clear()
+{
+    BinarySearchTree<Key, Value>::clear();
+    live_ = 0;
+    dead_ = 0;
+    graveyard_.clear();
+}
+
+template<class Key, class Value>
+bool TombstoneAVLTree<Key, Value>::empty() const
+{
+    return live_ == 0;
+}
+
+/**
+* The number of live items.
+*/
+template<class Key, class Value>
+size_t TombstoneAVLTree<Key, Value>::size() const
+{
+    return live_;
+}
+
+/**
+* The number of tombstones still linked in the tree.
+*/
+template<class Key, class Value>
+size_t TombstoneAVLTree<Key, Value>::deadCount() const
+{
+    return dead_;
+}
+
+/**
+* Physically removes up to budget tombstones, in the order the keys were
+* removed, and returns how many are left. Each one costs an ordinary
+* AVLTree remove, so the budget bounds the time taken.
+*/
+template<class Key, class Value>
+size_t TombstoneAVLTree<Key, Value>::compact(size_t budget)
+{
+    while(budget > 0 && !graveyard_.empty())
+    {
+      TombNode* node = static_cast<TombNode*>(this->internalFind(graveyard_.front()));
+      graveyard_.pop_front();
+      if(node == nullptr)
+      {
+        continue;
+      }
+      // keys that were revived are skipped; a later remove queues them again
+      node->setQueued(false);
+      if(node->isDead())
+      {
+        AVLTree<Key, Value>::removeNode(node);
+        budget--;
+      }
+    }
+    return dead_;
+}
+
+/**
+* Frees every tombstone and relinks the live nodes into a perfectly
+* balanced tree. O(n), and the only allocation is the node list.
+*/
+template<class Key, class Value>
+void TombstoneAVLTree<Key, Value>::rebuild()
+{
+    // successor climbs through parents, so nothing is freed until the walk is done
+    std::vector<TombNode*> nodes;
+    nodes.reserve(live_ + dead_);
+    for(TombNode* current = static_cast<TombNode*>(this->getSmallestNode()); current != nullptr;
+        current = static_cast<TombNode*>(AVLTree<Key, Value>::successor(current)))
+    {
+      nodes.push_back(current);
+    }
+    size_t kept = 0;
+    for(size_t i = 0; i < nodes.size(); i++)
+    {
+      if(nodes[i]->isDead())
+      {
+        destroyNode(nodes[i]);
+      }
+      else
+      {
+        nodes[i]->setQueued(false);
+        nodes[kept++] = nodes[i];
+      }
+    }
+    nodes.resize(kept);
+    int height = 0;
+    this->root_ = relink(nodes, 0, nodes.size(), height);
+    live_ = nodes.size();
+    dead_ = 0;
+    graveyard_.clear();
+}
+
+template<class Key, class Value>
+typename TombstoneAVLTree<Key, Value>::iterator TombstoneAVLTree<Key, Value>::begin() const
+{
+    return iterator(this->getSmallestNode());
+}
+
+template<class Key, class Value>
+typename TombstoneAVLTree<Key, Value>::iterator TombstoneAVLTree<Key, Value>::end() const
+{
+    return iterator();
+}
+
+template<class Key, class Value>
+typename TombstoneAVLTree<Key, Value>::iterator TombstoneAVLTree<Key, Value>::find(const Key& key) const
+{
+    return iterator(liveNode(key));
+}
+
+/**
+* The batched lookup of BinarySearchTree::findEach, reporting dead keys
+* with end() like find does. fn is given this tree's iterator.
+*/
+template<class Key, class Value>
+template<typename KeyIterator, typename Function>
+void TombstoneAVLTree<Key, Value>::findEach(KeyIterator first, KeyIterator last, Function fn, unsigned int group) const
+{
+    AVLTree<Key, Value>::findEach(first, last,
+        [&](const Key& key, typename BinarySearchTree<Key, Value>::iterator it) {
+          TombNode* node = static_cast<TombNode*>(this->iteratorNode(it));
+          fn(key, iterator(node != nullptr && node->isDead() ? nullptr : node));
+        }, group);
+}
+
+/*
+ * The next live node is found first: it survives any rebuild the
+ * remove sets off.
+ */
+template<class Key, class Value>
+typename TombstoneAVLTree<Key, Value>::iterator
+TombstoneAVLTree<Key, Value>::erase(typename BinarySearchTree<Key, Value>::iterator pos)
+{
+    Node<Key, Value>* node = this->iteratorNode(pos);
+    if(node == nullptr)
+    {
+      return end();
+    }
+    iterator next(AVLTree<Key, Value>::successor(static_cast<TombNode*>(node)));
+    removeNode(node);
+    return next;
+}
+
+/*
+ * Marks every live node in [first, last), which takes O(k) and changes
+ * nothing structurally. A rebuild here could free the node last points
+ * to, so it waits for the next remove.
+ */
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator
+TombstoneAVLTree<Key, Value>::erase(typename BinarySearchTree<Key, Value>::iterator first,
+                                    typename BinarySearchTree<Key, Value>::iterator last)
+{
+    Node<Key, Value>* current = this->iteratorNode(first);
+    Node<Key, Value>* lastNode = this->iteratorNode(last);
+    while(current != lastNode)
+    {
+      TombNode* node = static_cast<TombNode*>(current);
+      current = AVLTree<Key, Value>::successor(node);
+      if(!node->isDead())
+      {
+        bury(node);
+      }
+    }
+    return last;
+}
+
+/*
+ * Marks as it goes and rebuilds, if needed, once the walk is over.
+ */
+template<class Key, class Value>
+template<typename Predicate>
+size_t TombstoneAVLTree<Key, Value>::erase_if(Predicate pred)
+{
+    size_t removed = 0;
+    for(iterator it = begin(); it != end(); ++it)
+    {
+      if(pred(*it))
+      {
+        bury(static_cast<TombNode*>(this->iteratorNode(it)));
+        removed++;
+      }
+    }
+    if(tooManyDead())
+    {
+      rebuild();
+    }
+    return removed;
+}
+
+template<class Key, class Value>
+template<typename Function>
+bool TombstoneAVLTree<Key, Value>::update(const Key& key, Function fn)
+{
+    TombNode* node = liveNode(key);
+    if(node == nullptr)
+    {
+      return false;
+    }
+    fn(node->getValue());
+    this->valueChanged(node);
+    return true;
+}
+
+template<class Key, class Value>
+Value const & TombstoneAVLTree<Key, Value>::operator[](const Key& key) const
+{
+    TombNode* node = liveNode(key);
+    if(node == nullptr) throw std::out_of_range("Invalid key");
+    return node->getValue();
+}
+
+/*
+ * The batch is applied item by item: AVLTree's batch path would write
+ * over tombstones without reviving them. It is checked first, so an
+ * unsorted batch changes nothing, as in AVLTree.
+ */
+template<class Key, class Value>
+template<typename Iterator>
+void TombstoneAVLTree<Key, Value>::applySorted(Iterator first, Iterator last, unsigned int)
+{
+    for(Iterator prev = first, current = first; current != last; prev = current++)
+    {
+      if(current->key < prev->key)
+      {
+        throw std::invalid_argument("applySorted batch is not sorted");
+      }
+    }
+    for(; first != last; ++first)
+    {
+      if(first->erase)
+      {
+        remove(first->key);
+      }
+      else
+      {
+        insert(std::make_pair(first->key, first->value));
+      }
+    }
+}
+
+/*
+ * Tombstones cannot be extracted; their handle comes back empty.
+ */
+template<class Key, class Value>
+typename AVLTree<Key, Value>::node_type TombstoneAVLTree<Key, Value>::extract(const Key& key)
+{
+    if(liveNode(key) == nullptr)
+    {
+      return typename AVLTree<Key, Value>::node_type();
+    }
+    live_--;
+    return AVLTree<Key, Value>::extract(key);
+}
+
+template<class Key, class Value>
+typename AVLTree<Key, Value>::node_type
+TombstoneAVLTree<Key, Value>::extract(typename BinarySearchTree<Key, Value>::iterator pos)
+{
+    TombNode* node = static_cast<TombNode*>(this->iteratorNode(pos));
+    if(node == nullptr || node->isDead())
+    {
+      return typename AVLTree<Key, Value>::node_type();
+    }
+    live_--;
+    return AVLTree<Key, Value>::extract(pos);
+}
+
+template<class Key, class Value>
+AVLNode<Key, Value>* TombstoneAVLTree<Key, Value>::createNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent) const
+{
+    return new TombNode(key, value, parent);
+}
+
+template<class Key, class Value>
+const std::type_info& TombstoneAVLTree<Key, Value>::nodeType() const
+{
+    return typeid(TombNode);
+}
+
+template<class Key, class Value>
+void TombstoneAVLTree<Key, Value>::destroyNode(AVLNode<Key, Value>* node)
+{
+    if(static_cast<TombNode*>(node)->isDead())
+    {
+      dead_--;
+    }
+    AVLTree<Key, Value>::destroyNode(node);
+}
+
+template<class Key, class Value>
+void TombstoneAVLTree<Key, Value>::removeNode(Node<Key, Value>* target)
+{
+    TombNode* node = static_cast<TombNode*>(target);
+    if(!node->isDead())
+    {
+      markDead(node);
+    }
+}
+
+/*
+ * A dead node found on the way is brought back holding init, as if it
+ * had just been created.
+ */
+template<class Key, class Value>
+Node<Key, Value>* TombstoneAVLTree<Key, Value>::findOrCreate(const Key& key, const Value& init, bool& created)
+{
+    TombNode* node = static_cast<TombNode*>(AVLTree<Key, Value>::findOrCreate(key, init, created));
+    if(!created && node->isDead())
+    {
+      node->setDead(false);
+      node->setValue(init);
+      this->valueChanged(node);
+      dead_--;
+      created = true;
+    }
+    if(created)
+    {
+      live_++;
+    }
+    return node;
+}
+
+template<class Key, class Value>
+typename TombstoneAVLTree<Key, Value>::TombNode* TombstoneAVLTree<Key, Value>::liveNode(const Key& key) const
+{
+    TombNode* node = static_cast<TombNode*>(this->internalFind(key));
+    return (node != nullptr && !node->isDead()) ? node : nullptr;
+}
+
+template<class Key, class Value>
+void TombstoneAVLTree<Key, Value>::markDead(TombNode* node)
+{
+    bury(node);
+    if(tooManyDead())
+    {
+      rebuild();
+    }
+}
+
+/*
+ * A node is queued only once, so removing and reviving the same key over
+ * and over does not grow the graveyard. Keys can still go stale when
+ * their node leaves by other means (extract, split, merge), hence the
+ * purge once they clearly outnumber the tombstones.
+ */
+template<class Key, class Value>
+void TombstoneAVLTree<Key, Value>::bury(TombNode* node)
+{
+    node->setDead(true);
+    dead_++;
+    live_--;
+    if(!node->isQueued())
+    {
+      node->setQueued(true);
+      graveyard_.push_back(node->getKey());
+    }
+    if(graveyard_.size() > 2 * dead_ + 16)
+    {
+      purgeGraveyard();
+    }
+}
+
+/*
+ * Keeps one key, in the original order, for every tombstone still
+ * queued and drops the rest. The queued marks are cleared on the way to
+ * spot duplicates and set again on the keys that stay.
+ */
+template<class Key, class Value>
+void TombstoneAVLTree<Key, Value>::purgeGraveyard()
+{
+    std::deque<Key> kept;
+    std::vector<TombNode*> nodes;
+    for(size_t i = 0; i < graveyard_.size(); i++)
+    {
+      TombNode* node = static_cast<TombNode*>(this->internalFind(graveyard_[i]));
+      if(node == nullptr || !node->isQueued())
+      {
+        continue;
+      }
+      node->setQueued(false);
+      if(node->isDead())
+      {
+        kept.push_back(graveyard_[i]);
+        nodes.push_back(node);
+      }
+    }
+    for(size_t i = 0; i < nodes.size(); i++)
+    {
+      nodes[i]->setQueued(true);
+    }
+    graveyard_.swap(kept);
+}
+
+template<class Key, class Value>
+bool TombstoneAVLTree<Key, Value>::tooManyDead() const
+{
+    return dead_ > rebuildThreshold_ * (double)(live_ + dead_);
+}
+
+/*
+ * Links nodes[lo, hi) into a complete tree and returns its root. The
+ * halves differ in size by at most one, so their heights do too.
+ */
+template<class Key, class Value>
+AVLNode<Key, Value>* TombstoneAVLTree<Key, Value>::relink(std::vector<TombNode*>& nodes, size_t lo, size_t hi, int& height)
+{
+    if(lo == hi)
+    {
+      height = 0;
+      return nullptr;
+    }
+    size_t mid = lo + (hi - lo) / 2;
+    int leftHeight = 0, rightHeight = 0;
+    AVLNode<Key, Value>* left = relink(nodes, lo, mid, leftHeight);
+    AVLNode<Key, Value>* right = relink(nodes, mid + 1, hi, rightHeight);
+    TombNode* node = nodes[mid];
+    node->setParent(nullptr);
+    node->setLeft(left);
+    node->setRight(right);
+    if(left != nullptr) left->setParent(node);
+    if(right != nullptr) right->setParent(node);
+    node->setBalance(rightHeight - leftHeight);
+    this->updatePath(node);
+    height = 1 + std::max(leftHeight, rightHeight);
+    return node;
+}
+
+#endif